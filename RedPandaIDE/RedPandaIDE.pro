@@ -96,6 +96,7 @@ SOURCES += \
     parser/cppparser.cpp \
     parser/cpppreprocessor.cpp \
     parser/cpptokenizer.cpp \
+    parser/parserbenchmark.cpp \
     parser/parserutils.cpp \
     parser/statementmodel.cpp \
     problems/ojproblemset.cpp \
@@ -150,6 +151,7 @@ SOURCES += \
     widgets/choosethemedialog.cpp \
     widgets/classbrowser.cpp \
     widgets/codecompletionlistview.cpp \
+    widgets/codecompletionmatcher.cpp \
     widgets/codecompletionpopup.cpp \
     widgets/cpudialog.cpp \
     debugger.cpp \
@@ -231,6 +233,7 @@ HEADERS += \
     parser/cppparser.h \
     parser/cpppreprocessor.h \
     parser/cpptokenizer.h \
+    parser/parserbenchmark.h \
     parser/parserutils.h \
     parser/statementmodel.h \
     problems/ojproblemset.h \
@@ -285,6 +288,7 @@ HEADERS += \
     widgets/choosethemedialog.h \
     widgets/classbrowser.h \
     widgets/codecompletionlistview.h \
+    widgets/codecompletionmatcher.h \
     widgets/codecompletionpopup.h \
     widgets/cpudialog.h \
     debugger.h \
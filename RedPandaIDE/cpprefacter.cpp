@@ -208,6 +208,7 @@ PSearchResultTreeItem CppRefacter::findOccurenceInFile(
         editor.document()->loadFromFile(filename,ENCODING_AUTO_DETECT,encoding);
     }
     editor.setHighlighter(HighlighterManager().getCppHighlighter());
+    editor.ensureRangesScanned();
     int posY = 0;
     while (posY < editor.document()->count()) {
         QString line = editor.document()->getString(posY);
@@ -273,6 +274,7 @@ void CppRefacter::renameSymbolInFile(const QString &filename, const PStatement &
     }
     QStringList newContents;
     editor.setHighlighter(HighlighterManager().getCppHighlighter());
+    editor.ensureRangesScanned();
     int posY = 0;
     while (posY < editor.document()->count()) {
         QString line = editor.document()->getString(posY);
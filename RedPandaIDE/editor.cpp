@@ -51,6 +51,10 @@
 #include <QDebug>
 #include "project.h"
 #include <qt_utils/charsetinfo.h>
+#include <QElapsedTimer>
+
+#define SEMANTIC_TOKENS_FILL_TIME 20 // ms
+#define INCLUDE_PREFETCH_DELAY 500 // ms
 
 SaveException::SaveException(const QString& reason) {
     mReason = reason;
@@ -95,7 +99,9 @@ Editor::Editor(QWidget *parent, const QString& filename,
   mOldHighlightedWord(),
   mCurrentHighlightedWord(),
   mSaving(false),
-  mHoverModifiedLine(-1)
+  mHoverModifiedLine(-1),
+  mSemanticTokensFillLine(1),
+  mSemanticTokensFillCount(0)
 {
     mHighlightCharPos1 = QSynedit::BufferCoord{0,0};
     mHighlightCharPos2 = QSynedit::BufferCoord{0,0};
@@ -194,6 +200,15 @@ Editor::Editor(QWidget *parent, const QString& filename,
         connect(&mFunctionTipTimer, &QTimer::timeout,
             this, &Editor::onFunctionTipsTimer);
 
+    mSemanticTokensTimer.setSingleShot(true);
+    mSemanticTokensTimer.setInterval(0);
+    connect(&mSemanticTokensTimer, &QTimer::timeout,
+            this, &Editor::onSemanticTokensTimer);
+
+    mIncludePrefetchTimer.setSingleShot(true);
+    connect(&mIncludePrefetchTimer, &QTimer::timeout,
+            this, &Editor::onIncludePrefetchTimer);
+
     connect(horizontalScrollBar(), &QScrollBar::valueChanged,
             this, &Editor::onScrollBarValueChanged);
     connect(verticalScrollBar(), &QScrollBar::valueChanged,
@@ -603,7 +618,7 @@ void Editor::keyPressEvent(QKeyEvent *event)
                     QStringList params;
                     QString funcName = function->command;
                     bool isVoid = (function->type  == "void");
-                    foreach (const PStatement& child, function->children) {
+                    foreach (const PStatement& child, mParser->statementList().childrenStatements(function)) {
                         if (child->kind == StatementKind::skParameter)
                             params.append(child->command);
                     }
@@ -985,30 +1000,7 @@ void Editor::onPreparePaintHighlightToken(int line, int aChar, const QString &to
                 }
             }
         } else if (mParser->enabled() && attr->tokenType() == QSynedit::TokenType::Identifier) {
-            QSynedit::BufferCoord p{aChar,line};
-    //        BufferCoord pBeginPos,pEndPos;
-    //        QString s= getWordAtPosition(this,p, pBeginPos,pEndPos, WordPurpose::wpInformation);
-    //        qDebug()<<s;
-    //        PStatement statement = mParser->findStatementOf(mFilename,
-    //          s , p.Line);
-            QStringList expression = getExpressionAtPosition(p);
-            PStatement statement = parser()->findStatementOf(
-                        filename(),
-                        expression,
-                        p.line);
-            StatementKind kind = getKindOfStatement(statement);
-            if (kind == StatementKind::skUnknown) {
-                QSynedit::BufferCoord pBeginPos,pEndPos;
-                QString s= getWordAtPosition(this,p, pBeginPos,pEndPos, WordPurpose::wpInformation);
-                if ((pEndPos.line>=1)
-                  && (pEndPos.ch>=0)
-                  && (pEndPos.ch+1 < document()->getString(pEndPos.line-1).length())
-                  && (document()->getString(pEndPos.line-1)[pEndPos.ch+1] == '(')) {
-                    kind = StatementKind::skFunction;
-                } else {
-                    kind = StatementKind::skVariable;
-                }
-            }
+            StatementKind kind = getIdentifierKind(line, aChar);
             PColorSchemeItem item = mStatementColors->value(kind,PColorSchemeItem());
 
             if (item) {
@@ -1373,6 +1365,8 @@ void Editor::showEvent(QShowEvent */*event*/)
                 &QSynedit::SynEdit::invalidate);
         reparse(false);
     }
+    // go on finding kinds of the identifiers
+    mSemanticTokensTimer.start();
     if (mParentPageControl) {
         pMainWindow->debugger()->setIsForProject(inProject());
         pMainWindow->bookmarkModel()->setIsForProject(inProject());
@@ -1415,6 +1409,7 @@ void Editor::hideEvent(QHideEvent */*event*/)
                 this,
                 &QSynedit::SynEdit::invalidate);
     }
+    mSemanticTokensTimer.stop();
     pMainWindow->updateForEncodingInfo(nullptr);
     pMainWindow->updateStatusbarForLineCol(nullptr);
     pMainWindow->updateForStatusbarModeInfo(nullptr);
@@ -1671,6 +1666,10 @@ void Editor::onStatusChanged(QSynedit::StatusChanges changes)
         mCurrentLineModified = true;
         if (mParentPageControl)
             mCanAutoSave = true;
+        if (mParser && mParser->isIncludeLine(lineText())) {
+            mIncludePrefetchTimer.stop();
+            mIncludePrefetchTimer.start(INCLUDE_PREFETCH_DELAY);
+        }
     }
 
     if (changes.testFlag(QSynedit::StatusChange::scCaretX)
@@ -1800,6 +1799,8 @@ void Editor::onTipEvalValueReady(const QString& value)
 
 void Editor::onLinesDeleted(int first, int count)
 {
+    if (first>=1 && first<=mSemanticTokens.count())
+        mSemanticTokens.remove(first-1, std::min(count, mSemanticTokens.count()-first+1));
     pMainWindow->caretList().linesDeleted(this,first,count);
     pMainWindow->debugger()->breakpointModel()->onFileDeleteLines(mFilename,first,count,inProject());
     pMainWindow->bookmarkModel()->onFileDeleteLines(mFilename,first,count, inProject());
@@ -1812,6 +1813,8 @@ void Editor::onLinesDeleted(int first, int count)
 
 void Editor::onLinesInserted(int first, int count)
 {
+    if (first>=1 && first<=mSemanticTokens.count())
+        mSemanticTokens.insert(first-1, count, SemanticLineTokens());
     pMainWindow->caretList().linesInserted(this,first,count);
     pMainWindow->debugger()->breakpointModel()->onFileInsertLines(mFilename,first,count, inProject());
     pMainWindow->bookmarkModel()->onFileInsertLines(mFilename,first,count, inProject());
@@ -1828,6 +1831,69 @@ void Editor::onFunctionTipsTimer()
     updateFunctionTip(true);
 }
 
+void Editor::onIncludePrefetchTimer()
+{
+    if (!mParentPageControl)
+        return;
+    if (!pSettings->codeCompletion().enabled())
+        return;
+    if (!highlighter())
+        return;
+    if (highlighter()->language() != QSynedit::HighlighterLanguage::Cpp
+             && highlighter()->language() != QSynedit::HighlighterLanguage::GLSL)
+        return;
+    if (!mParser || !mParser->enabled())
+        return;
+    // headers that are not parsed yet are from newly added include lines
+    QStringList headers;
+    for (int i=0;i<document()->count();i++) {
+        QString s = document()->getString(i);
+        QString header;
+        if (mParser->isIncludeNextLine(s))
+            header = mParser->getHeaderFileName(mFilename, s, true);
+        else if (mParser->isIncludeLine(s))
+            header = mParser->getHeaderFileName(mFilename, s);
+        if (!header.isEmpty() && !headers.contains(header)
+                && !mParser->isFileParsed(header))
+            headers.append(header);
+    }
+    if (!headers.isEmpty())
+        prefetchHeaders(mParser, headers);
+}
+
+void Editor::onSemanticTokensTimer()
+{
+    if (!mParser || !mParser->enabled() || !isVisible())
+        return;
+    if (!highlighter())
+        return;
+    if (highlighter()->language() != QSynedit::HighlighterLanguage::Cpp
+             && highlighter()->language() != QSynedit::HighlighterLanguage::GLSL)
+        return;
+    checkSemanticTokens();
+    QSynedit::PHighlighter highlighter;
+    if (isNew())
+        highlighter = highlighterManager.getCppHighlighter();
+    else
+        highlighter = highlighterManager.getHighlighter(mFilename);
+    if (!highlighter)
+        return;
+    QElapsedTimer timer;
+    timer.start();
+    while (mSemanticTokensFillCount<document()->count()) {
+        if (mSemanticTokensFillLine<1 || mSemanticTokensFillLine>document()->count())
+            mSemanticTokensFillLine = 1;
+        fillSemanticTokens(highlighter, mSemanticTokensFillLine);
+        mSemanticTokensFillLine++;
+        mSemanticTokensFillCount++;
+        if (timer.elapsed()>=SEMANTIC_TOKENS_FILL_TIME) {
+            // give the event loop a chance to handle user input
+            mSemanticTokensTimer.start();
+            return;
+        }
+    }
+}
+
 bool Editor::isBraceChar(QChar ch)
 {
     switch( ch.unicode()) {
@@ -1935,6 +2001,99 @@ QStringList Editor::getOwnerExpressionAndMemberAtPositionForCompletion(
     return getOwnerExpressionAndMember(expression,memberOperator,memberExpression);
 }
 
+void Editor::checkSemanticTokens()
+{
+    QString serialId = mParser->serialId();
+    if (serialId!=mSemanticTokensSerialId) {
+        QString reparsedFile;
+        int startLine, endLine;
+        if (mParser->findReparsedBody(mSemanticTokensSerialId, serialId,
+                                      reparsedFile, startLine, endLine)) {
+            // only local statements of the body are changed, kinds of other lines are kept
+            if (reparsedFile == mFilename && startLine<=endLine) {
+                startLine = std::max(startLine, 1);
+                endLine = std::min(endLine, mSemanticTokens.count());
+                for (int i=startLine;i<=endLine;i++)
+                    mSemanticTokens[i-1].kinds.clear();
+                mSemanticTokensFillLine = startLine;
+                mSemanticTokensFillCount = std::max(0, document()->count() - (endLine - startLine + 1));
+            }
+        } else {
+            mSemanticTokens.clear();
+            // visible lines first
+            mSemanticTokensFillLine = rowToLine(topLine());
+            mSemanticTokensFillCount = 0;
+        }
+        mSemanticTokensSerialId = serialId;
+        mSemanticTokensTimer.start();
+    }
+}
+
+StatementKind Editor::getIdentifierKind(int line, int aChar)
+{
+    // kinds are kept for the snapshot they are found in
+    checkSemanticTokens();
+    if (line<1 || line>document()->count())
+        return findIdentifierKind(QSynedit::BufferCoord{aChar,line});
+    if (mSemanticTokens.count()<document()->count())
+        mSemanticTokens.resize(document()->count());
+    SemanticLineTokens& lineTokens = mSemanticTokens[line-1];
+    QString lineText = document()->getString(line-1);
+    if (lineTokens.lineText!=lineText) {
+        lineTokens.lineText = lineText;
+        lineTokens.kinds.clear();
+    }
+    auto iter = lineTokens.kinds.constFind(aChar);
+    if (iter!=lineTokens.kinds.constEnd())
+        return iter.value();
+    StatementKind kind = findIdentifierKind(QSynedit::BufferCoord{aChar,line});
+    // a new snapshot may have been published while searching
+    if (mParser->serialId()==mSemanticTokensSerialId)
+        lineTokens.kinds.insert(aChar,kind);
+    return kind;
+}
+
+StatementKind Editor::findIdentifierKind(const QSynedit::BufferCoord &pos)
+{
+    QStringList expression = getExpressionAtPosition(pos);
+    PStatement statement = parser()->findStatementOf(
+                filename(),
+                expression,
+                pos.line);
+    StatementKind kind = getKindOfStatement(statement);
+    if (kind == StatementKind::skUnknown) {
+        QSynedit::BufferCoord pBeginPos,pEndPos;
+        QString s= getWordAtPosition(this,pos, pBeginPos,pEndPos, WordPurpose::wpInformation);
+        if ((pEndPos.line>=1)
+          && (pEndPos.ch>=0)
+          && (pEndPos.ch+1 < document()->getString(pEndPos.line-1).length())
+          && (document()->getString(pEndPos.line-1)[pEndPos.ch+1] == '(')) {
+            kind = StatementKind::skFunction;
+        } else {
+            kind = StatementKind::skVariable;
+        }
+    }
+    return kind;
+}
+
+void Editor::fillSemanticTokens(QSynedit::PHighlighter highlighter, int line)
+{
+    QString lineText = document()->getString(line-1);
+    if (mParser->isIncludeLine(lineText))
+        return;
+    if (line==1)
+        highlighter->resetState();
+    else
+        highlighter->setState(document()->ranges(line-2));
+    highlighter->setLine(lineText,line-1);
+    while (!highlighter->eol()) {
+        QSynedit::PHighlighterAttribute attr = highlighter->getTokenAttribute();
+        if (attr && attr->tokenType() == QSynedit::TokenType::Identifier)
+            getIdentifierKind(line, highlighter->getTokenPos()+1);
+        highlighter->next();
+    }
+}
+
 QStringList Editor::getExpressionAtPosition(
         const QSynedit::BufferCoord &pos)
 {
@@ -2351,6 +2510,7 @@ bool Editor::handleParentheseSkip()
       if (document()->count()==0)
           return false;
       if (highlighter()) {
+          ensureRangesScanned();
           QSynedit::HighlighterState lastLineState = document()->ranges(document()->count()-1);
           if (lastLineState.parenthesisLevel==0) {
               setCaretXY( QSynedit::BufferCoord{caretX() + 1, caretY()}); // skip over
@@ -2402,6 +2562,7 @@ bool Editor::handleBracketSkip()
     if (document()->count()==0)
         return false;
     if (highlighter()) {
+        ensureRangesScanned();
         QSynedit::HighlighterState lastLineState = document()->ranges(document()->count()-1);
         if (lastLineState.bracketLevel==0) {
             setCaretXY( QSynedit::BufferCoord{caretX() + 1, caretY()}); // skip over
@@ -2488,6 +2649,7 @@ bool Editor::handleBraceSkip()
     if (document()->count()==0)
         return false;
     if (highlighter()) {
+        ensureRangesScanned();
         QSynedit::HighlighterState lastLineState = document()->ranges(document()->count()-1);
         if (lastLineState.braceLevel==0) {
             bool oldInsertMode = insertMode();
@@ -3278,9 +3440,10 @@ void Editor::completionInsert(bool appendFunc)
 
     if (pSettings->codeCompletion().recordUsage()
             && statement->kind != StatementKind::skUserCodeSnippet) {
-        statement->usageCount+=1;
-        pMainWindow->symbolUsageManager()->updateUsage(statement->fullName,
-                                                         statement->usageCount);
+        // statements are read by completion searches in background, keep the count in the manager only
+        PSymbolUsageManager usageManager = pMainWindow->symbolUsageManager();
+        usageManager->updateUsage(statement->fullName,
+                                  usageManager->usageCount(statement->fullName) + 1);
     }
 
     QString funcAddOn = "";
@@ -3428,7 +3591,7 @@ bool Editor::onCompletionKeyPressed(QKeyEvent *event)
         if (phrase.isEmpty()) {
             mCompletionPopup->hide();
         } else {
-            mCompletionPopup->search(phrase, false);
+            mCompletionPopup->searchInBackground(phrase);
         }
         return true;
     case Qt::Key_Escape:
@@ -3457,7 +3620,7 @@ bool Editor::onCompletionKeyPressed(QKeyEvent *event)
                                             pBeginPos,pEndPos,
                                             purpose);
         mLastIdCharPressed = phrase.length();
-        mCompletionPopup->search(phrase, false);
+        mCompletionPopup->searchInBackground(phrase);
         return true;
     } else {
         //stop completion
@@ -3534,7 +3697,7 @@ bool Editor::onCompletionInputMethod(QInputMethodEvent *event)
     if (!s.isEmpty()) {
         QString phrase = getWordForCompletionSearch(caretXY(),mCompletionPopup->memberOperator()=="::");
         mLastIdCharPressed = phrase.length();
-        mCompletionPopup->search(phrase, false);
+        mCompletionPopup->searchInBackground(phrase);
         return true;
     }
     return processed;
@@ -3883,8 +4046,7 @@ void Editor::updateFunctionTip(bool showTip)
 
     // Only do the cumbersome list filling when showing a new tooltip...
 
-    if (s != pMainWindow->functionTip()->functionFullName()
-            && !mParser->parsing()) {
+    if (s != pMainWindow->functionTip()->functionFullName()) {
         pMainWindow->functionTip()->clearTips();
         QList<PStatement> statements=mParser->getListOfFunctions(mFilename,
                                                                   s,
@@ -41,6 +41,11 @@ struct TabStop {
 
 using PTabStop = std::shared_ptr<TabStop>;
 
+struct SemanticLineTokens {
+    QString lineText; // kinds are dropped when the line's text changes
+    QHash<int,StatementKind> kinds; // start char of the identifier -> kind
+};
+
 class SaveException: public std::exception {
 
 public:
@@ -242,6 +247,8 @@ private slots:
     void onLinesDeleted(int first,int count);
     void onLinesInserted(int first,int count);
     void onFunctionTipsTimer();
+    void onSemanticTokensTimer();
+    void onIncludePrefetchTimer();
 
 private:
     bool isBraceChar(QChar ch);
@@ -293,6 +300,10 @@ private:
     void onExportedFormatToken(QSynedit::PHighlighter syntaxHighlighter, int Line, int column, const QString& token,
         QSynedit::PHighlighterAttribute &attr);
     void onScrollBarValueChanged();
+    void checkSemanticTokens();
+    StatementKind getIdentifierKind(int line, int aChar);
+    StatementKind findIdentifierKind(const QSynedit::BufferCoord& pos);
+    void fillSemanticTokens(QSynedit::PHighlighter highlighter, int line);
     static PCppParser sharedParser(ParserLanguage language);
 private:
     QByteArray mEncodingOption; // the encoding type set by the user
@@ -343,6 +354,13 @@ private:
     std::shared_ptr<QHash<StatementKind, std::shared_ptr<ColorSchemeItem> > > mStatementColors;
     QTimer mFunctionTipTimer;
     int mHoverModifiedLine;
+    // kinds of the identifiers, so painting doesn't search the parser for each token
+    QVector<SemanticLineTokens> mSemanticTokens; // index is line-1
+    QString mSemanticTokensSerialId; // serial id of the parser the kinds are found in
+    QTimer mSemanticTokensTimer;
+    int mSemanticTokensFillLine;
+    int mSemanticTokensFillCount;
+    QTimer mIncludePrefetchTimer; // parse headers of include lines being typed
 
     static QHash<ParserLanguage,std::weak_ptr<CppParser>> mSharedParsers;
 
@@ -34,6 +34,7 @@
 #include "autolinkmanager.h"
 #include <qt_utils/charsetinfo.h>
 #include "parser/parserutils.h"
+#include "parser/parserbenchmark.h"
 #include "editorlist.h"
 #include "widgets/choosethemedialog.h"
 #include "thememanager.h"
@@ -263,7 +264,8 @@ int main(int argc, char *argv[])
             openInSingleInstance = envSetting.value("open_files_in_single_instance",false).toBool();
         } else if (!settingFilename.isEmpty() && firstRun)
             openInSingleInstance = false;
-        if (app.arguments().contains("-ns")) {
+        if (app.arguments().contains("-ns")
+                || app.arguments().contains(PARSER_BENCHMARK_OPTION)) {
             openInSingleInstance = false;
         } else if (app.arguments().contains("-s"))
             openInSingleInstance = true;
@@ -336,6 +338,16 @@ int main(int argc, char *argv[])
             pSettings->compilerSets().saveSets();
         }
         pSettings->load();
+        // run the parser benchmark without the gui and quit
+        int benchmarkIndex = app.arguments().indexOf(PARSER_BENCHMARK_OPTION);
+        if (benchmarkIndex>=0) {
+            tempFile.remove();
+            QString outputFile = app.arguments().value(benchmarkIndex+1);
+            // no output file is given if it's followed by another option
+            if (outputFile.startsWith('-'))
+                outputFile.clear();
+            return runParserBenchmark(outputFile);
+        }
         if (firstRun) {
             //set theme
             ChooseThemeDialog themeDialog;
@@ -4529,8 +4529,8 @@ void MainWindow::onEditorContextMenu(const QPoint& pos)
 
         //these actions needs parser
         if (editor->parser() && editor->parser()->enabled()) {
-            ui->actionGoto_Declaration->setEnabled(!editor->parser()->parsing());
-            ui->actionGoto_Definition->setEnabled(!editor->parser()->parsing());
+            ui->actionGoto_Declaration->setEnabled(true);
+            ui->actionGoto_Definition->setEnabled(true);
             ui->actionFind_references->setEnabled(!editor->parser()->parsing());
         }
     } else {
@@ -20,26 +20,330 @@
 #include "qsynedit/highlighter/cpp.h"
 
 #include <QApplication>
+#include <QCryptographicHash>
+#include <QDataStream>
 #include <QDate>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
 #include <QHash>
 #include <QQueue>
+#include <QRunnable>
+#include <QSaveFile>
 #include <QThread>
+#include <QThreadPool>
 #include <QTime>
+#include <QWaitCondition>
 
 static QAtomicInt cppParserCount(0);
-CppParser::CppParser(QObject *parent) : QObject(parent),
+
+#define SYSTEM_HEADER_CACHE_MAGIC 0x52504843
+#define SYSTEM_HEADER_CACHE_VERSION 2
+// files each parse worker may preprocess ahead of the parse thread
+#define PARSE_WORKER_FILES_AHEAD 2
+
+static QMutex systemHeaderSnapshotsMutex;
+static QHash<QString,std::weak_ptr<const SystemHeaderSnapshot>> systemHeaderSnapshots;
+
+static bool isSystemHeaderSnapshotUpToDate(const PSystemHeaderSnapshot& snapshot)
+{
+    for (auto it=snapshot->modifiedTimes.begin();it!=snapshot->modifiedTimes.end();++it) {
+        QFileInfo info(it.key());
+        if (!info.exists() || info.lastModified().toMSecsSinceEpoch()!=it.value())
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief State shared by the parse thread and its worker threads
+ *
+ * The file stream callback reads the opened editors, so only the parse thread calls it:
+ * workers queue their requests here and wait until the parse thread serves them.
+ * Workers also wake the parse thread here when they finish a file.
+ */
+class CppParseWorkers {
+public:
+    explicit CppParseWorkers(const GetFileStreamCallBack& onGetFileStream):
+        mOnGetFileStream(onGetFileStream),
+        mPendingRequests(0),
+        mRunningWorkers(0) {
+    }
+
+    QMutex& mutex() {
+        return mMutex;
+    }
+    // the caller must hold mutex()
+    void wakeAll() {
+        mChanged.wakeAll();
+    }
+    // the caller must hold mutex()
+    void wait() {
+        mChanged.wait(&mMutex);
+    }
+
+    // called by the workers
+    bool getFileStream(const QString& fileName, QStringList& buffer) {
+        if (!mOnGetFileStream)
+            return false;
+        FileStreamRequest request;
+        request.fileName = fileName;
+        request.found = false;
+        request.served = false;
+        QMutexLocker locker(&mMutex);
+        mRequests.enqueue(&request);
+        mPendingRequests.ref();
+        mChanged.wakeAll();
+        while (!request.served)
+            mChanged.wait(&mMutex);
+        buffer = request.buffer;
+        return request.found;
+    }
+
+    // called by the parse thread
+    void serveFileStreamRequests() {
+        if (mPendingRequests.loadAcquire()==0)
+            return;
+        QMutexLocker locker(&mMutex);
+        serveFileStreamRequests(locker);
+    }
+
+    // called by the parse thread, serves the workers until isDone() (called with mutex() held) is true
+    template<typename Predicate>
+    void waitUntil(Predicate isDone) {
+        QMutexLocker locker(&mMutex);
+        while (true) {
+            serveFileStreamRequests(locker);
+            if (isDone())
+                return;
+            mChanged.wait(&mMutex);
+        }
+    }
+
+    // called by the parse thread before it starts a worker
+    void addWorker() {
+        QMutexLocker locker(&mMutex);
+        mRunningWorkers++;
+    }
+    // called by the workers when they end
+    void workerFinished() {
+        QMutexLocker locker(&mMutex);
+        mRunningWorkers--;
+        mChanged.wakeAll();
+    }
+    // called by the parse thread, workers may wait for their file streams until they end
+    void waitForWorkers() {
+        waitUntil([this]{
+            return mRunningWorkers==0;
+        });
+    }
+private:
+    struct FileStreamRequest {
+        QString fileName;
+        QStringList buffer;
+        bool found;
+        bool served;
+    };
+
+    template<typename Locker>
+    void serveFileStreamRequests(Locker& locker) {
+        if (mRequests.isEmpty())
+            return;
+        while (!mRequests.isEmpty()) {
+            FileStreamRequest* request = mRequests.dequeue();
+            mPendingRequests.deref();
+            // the worker doesn't touch the request until it's served
+            locker.unlock();
+            request->found = mOnGetFileStream(request->fileName, request->buffer);
+            locker.relock();
+            request->served = true;
+        }
+        mChanged.wakeAll();
+    }
+
+    GetFileStreamCallBack mOnGetFileStream;
+    QMutex mMutex;
+    QWaitCondition mChanged;
+    QQueue<FileStreamRequest*> mRequests;
+    QAtomicInt mPendingRequests;
+    int mRunningWorkers;
+};
+
+/**
+ * @brief Preprocesses project files on a worker thread to find their include relations
+ *
+ * Each worker owns its own preprocessor and takes the next unscanned file
+ * from the shared index, so files are distributed evenly among workers.
+ */
+class CppIncludeRelationScanner : public QRunnable {
+public:
+    CppIncludeRelationScanner(CppParseWorkers& workers,
+                              const CppPreprocessor& options,
+                              const QStringList& files,
+                              QVector<QSet<QString>>& results,
+                              QVector<bool>& scanned,
+                              int& nextIndex):
+        mWorkers(workers),
+        mFiles(files),
+        mResults(results),
+        mScanned(scanned),
+        mNextIndex(nextIndex) {
+        mPreprocessor.copyOptionsFrom(options);
+        CppParseWorkers* pWorkers = &workers;
+        mPreprocessor.setOnGetFileStream([pWorkers](const QString& fileName, QStringList& buffer) {
+            return pWorkers->getFileStream(fileName, buffer);
+        });
+    }
+
+    void run() override {
+        while (true) {
+            int index;
+            {
+                QMutexLocker locker(&mWorkers.mutex());
+                if (mNextIndex>=mFiles.count())
+                    break;
+                index = mNextIndex++;
+            }
+            const QString& file = mFiles[index];
+            if (!mPreprocessor.scannedFiles().contains(file)) {
+                QStringList buffer;
+                mWorkers.getFileStream(file,buffer);
+                mPreprocessor.preprocess(file,buffer);
+                mPreprocessor.clearTempResults();
+            }
+            QSet<QString> includes;
+            PFileIncludes fileIncludes = mPreprocessor.includesList().value(file);
+            if (fileIncludes) {
+                foreach(const QString& inc,fileIncludes->includeFiles.keys()) {
+                    includes.insert(inc);
+                }
+            }
+            QMutexLocker locker(&mWorkers.mutex());
+            mResults[index] = includes;
+            mScanned[index] = true;
+            mWorkers.wakeAll();
+        }
+    }
+private:
+    CppParseWorkers& mWorkers;
+    CppPreprocessor mPreprocessor;
+    const QStringList& mFiles;
+    QVector<QSet<QString>>& mResults;
+    QVector<bool>& mScanned;
+    int& mNextIndex;
+};
+
+/**
+ * @brief A file preprocessed and tokenized on a worker thread
+ */
+struct CppPreprocessedFile {
+    bool preprocessed; // false if the worker has scanned it as a header of another file
+    CppTokenizer tokenizer;
+    // include records and defines of the files scanned by the preprocess
+    QHash<QString,PFileIncludes> includes;
+    QHash<QString,PDefineMap> fileDefines;
+};
+using PCppPreprocessedFile = std::shared_ptr<CppPreprocessedFile>;
+
+/**
+ * @brief Preprocesses and tokenizes the files of a file list on a worker thread
+ *
+ * Each worker owns a preprocessor copied from the parser's, and keeps the headers it
+ * has scanned, so they are not preprocessed again for each file. Workers take files
+ * in list order, and stop when they are maxAhead files ahead of the parse thread,
+ * which adds the statements of the files one by one.
+ */
+class CppFilePreprocessor : public QRunnable {
+public:
+    CppFilePreprocessor(CppParseWorkers& workers,
+                        const CppPreprocessor& preprocessor,
+                        const QStringList& files,
+                        QVector<PCppPreprocessedFile>& results,
+                        int& nextIndex,
+                        const int& mergedCount,
+                        int maxAhead):
+        mWorkers(workers),
+        mFiles(files),
+        mResults(results),
+        mNextIndex(nextIndex),
+        mMergedCount(mergedCount),
+        mMaxAhead(maxAhead) {
+        mPreprocessor.copyOptionsFrom(preprocessor);
+        mPreprocessor.copyResultsFrom(preprocessor);
+        CppParseWorkers* pWorkers = &workers;
+        mPreprocessor.setOnGetFileStream([pWorkers](const QString& fileName, QStringList& buffer) {
+            return pWorkers->getFileStream(fileName, buffer);
+        });
+    }
+
+    void run() override {
+        while (true) {
+            int index;
+            {
+                QMutexLocker locker(&mWorkers.mutex());
+                while (mNextIndex<mFiles.count() && mNextIndex-mMergedCount>=mMaxAhead)
+                    mWorkers.wait();
+                if (mNextIndex>=mFiles.count())
+                    break;
+                index = mNextIndex++;
+            }
+            const QString& file = mFiles[index];
+            PCppPreprocessedFile result = std::make_shared<CppPreprocessedFile>();
+            result->preprocessed = !mPreprocessor.scannedFiles().contains(file);
+            if (result->preprocessed) {
+                QSet<QString> scannedFiles = mPreprocessor.scannedFiles();
+                QStringList buffer;
+                mWorkers.getFileStream(file,buffer);
+                mPreprocessor.preprocess(file,buffer);
+                result->tokenizer.tokenize(mPreprocessor.result());
+                //reduce memory usage
+                mPreprocessor.clearTempResults();
+                foreach (const QString& scannedFile, mPreprocessor.scannedFiles()) {
+                    if (scannedFiles.contains(scannedFile))
+                        continue;
+                    result->includes.insert(scannedFile,mPreprocessor.includesList().value(scannedFile));
+                    PDefineMap defines = mPreprocessor.fileDefines().value(scannedFile);
+                    if (defines)
+                        result->fileDefines.insert(scannedFile,defines);
+                }
+            }
+            QMutexLocker locker(&mWorkers.mutex());
+            mResults[index] = result;
+            mWorkers.wakeAll();
+        }
+        mWorkers.workerFinished();
+    }
+private:
+    CppParseWorkers& mWorkers;
+    CppPreprocessor mPreprocessor;
+    const QStringList& mFiles;
+    QVector<PCppPreprocessedFile>& mResults;
+    int& mNextIndex;
+    const int& mMergedCount;
+    int mMaxAhead;
+};
+
+CppParser::CppParser(QObject *parent) : CppParser(parent, false)
+{
+}
+
+CppParser::CppParser(QObject *parent, bool isSnapshot) : QObject(parent),
 #if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
     mMutex()
 #else
     mMutex(QMutex::Recursive)
 #endif
 {
-    mParserId = cppParserCount.fetchAndAddRelaxed(1);
+    // snapshots take the id of their parser
+    mParserId = isSnapshot ? -1 : cppParserCount.fetchAndAddRelaxed(1);
     mLanguage = ParserLanguage::CPlusPlus;
     mSerialCount = 0;
     updateSerialId();
     mUniqId = 0;
     mParsing = false;
+    mParseThread = nullptr;
+    mDatabaseChanged = false;
+    mPrefetchingHeaders = false;
     //mStatementList ; // owns the objects
     //mFilesToScan;
     //mIncludePaths;
@@ -50,7 +354,15 @@ CppParser::CppParser(QObject *parent) : QObject(parent),
     //mSkipList;
     mParseLocalHeaders = true;
     mParseGlobalHeaders = true;
-    mLockCount = 0;
+    mParseWorkerCount = 0;
+    mSystemHeaderCacheChecked = false;
+    mSystemHeaderCacheFileCount = 0;
+    mFreezeCount = 0;
+    mResetRequests = 0;
+    mResetsDone = 0;
+    mHardDefinesPending = false;
+    mReparsedBodyStartLine = 0;
+    mReparsedBodyEndLine = 0;
     mIsSystemHeader = false;
     mIsHeader = false;
     mIsProjectFile = false;
@@ -65,23 +377,13 @@ CppParser::CppParser(QObject *parent) : QObject(parent),
     //mBlockBeginSkips;
     //mBlockEndSkips;
     //mInlineNamespaceEndSkips;
+    if (!isSnapshot)
+        mSnapshot = createSnapshot();
 }
 
 CppParser::~CppParser()
 {
-    while (true) {
-        //wait for all methods finishes running
-        {
-            QMutexLocker locker(&mMutex);
-            if (!mParsing && (mLockCount == 0)) {
-              mParsing = true;
-              break;
-            }
-        }
-        QThread::msleep(50);
-        QCoreApplication* app = QApplication::instance();
-        app->processEvents();
-    }
+    // parser threads keep the parser alive, so it can't be parsing here
     //qDebug()<<"-------- parser deleted ------------";
 }
 
@@ -135,10 +437,11 @@ void CppParser::clearProjectFiles()
 
 QList<PStatement> CppParser::getListOfFunctions(const QString &fileName, const QString &phrase, int line)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->getListOfFunctions(fileName,phrase,line);
     QMutexLocker locker(&mMutex);
     QList<PStatement> result;
-    if (mParsing)
-        return result;
 
     PStatement statement = findStatementOf(fileName,phrase, line);
     if (!statement)
@@ -165,10 +468,10 @@ QList<PStatement> CppParser::getListOfFunctions(const QString &fileName, const Q
 
 PStatement CppParser::findScopeStatement(const QString &filename, int line)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->findScopeStatement(filename,line);
     QMutexLocker locker(&mMutex);
-    if (mParsing) {
-        return PStatement();
-    }
     PFileIncludes fileIncludes = mPreprocessor.includesList().value(filename);
     if (!fileIncludes)
         return PStatement();
@@ -176,24 +479,68 @@ PStatement CppParser::findScopeStatement(const QString &filename, int line)
     return fileIncludes->scopes.findScopeAtLine(line);
 }
 
+QList<PStatement> CppParser::listVisibleScopeMembers(const QString &filename, int line)
+{
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->listVisibleScopeMembers(filename,line);
+    QMutexLocker locker(&mMutex);
+    QList<PStatement> result;
+    PFileIncludes fileIncludes = mPreprocessor.includesList().value(filename);
+    if (!fileIncludes)
+        return result;
+    QSet<QString> addedNames;
+    PStatement scopeStatement = fileIncludes->scopes.findScopeAtLine(line);
+    // repeat until reach global
+    while (scopeStatement) {
+        // class members can be used before they are declared
+        if (scopeStatement->kind == StatementKind::skClass)
+            addVisibleScopeMembers(result, addedNames, scopeStatement, filename, -1);
+        else
+            addVisibleScopeMembers(result, addedNames, scopeStatement, filename, line);
+        foreach (const QString& namespaceName, scopeStatement->usingList) {
+            PStatementList namespaceStatementsList = findNamespace(namespaceName);
+            if (!namespaceStatementsList)
+                continue;
+            foreach (const PStatement& namespaceStatement, *namespaceStatementsList) {
+                if (namespaceStatement->fileName!=filename
+                        && !fileIncludes->includeFiles.contains(namespaceStatement->fileName)
+                        && namespaceStatement->definitionFileName!=filename
+                        && !fileIncludes->includeFiles.contains(namespaceStatement->definitionFileName))
+                    continue;
+                addVisibleScopeMembers(result, addedNames, namespaceStatement, filename, line);
+            }
+        }
+        scopeStatement=scopeStatement->parentScope.lock();
+    }
+    return result;
+}
+
 PFileIncludes CppParser::findFileIncludes(const QString &filename, bool deleteIt)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->findFileIncludes(filename);
     QMutexLocker locker(&mMutex);
     PFileIncludes fileIncludes = mPreprocessor.includesList().value(filename,PFileIncludes());
     if (deleteIt && fileIncludes)
-        mPreprocessor.includesList().remove(filename);
+        mPreprocessor.removeFileIncludes(filename);
     return fileIncludes;
 }
 QString CppParser::findFirstTemplateParamOf(const QString &fileName, const QString &phrase, const PStatement& currentScope)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->findFirstTemplateParamOf(fileName,phrase,currentScope);
     QMutexLocker locker(&mMutex);
-    if (mParsing)
-        return "";
     return doFindFirstTemplateParamOf(fileName,phrase,currentScope);
 }
 
 PStatement CppParser::findFunctionAt(const QString &fileName, int line)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->findFunctionAt(fileName,line);
     QMutexLocker locker(&mMutex);
     PFileIncludes fileIncludes = mPreprocessor.includesList().value(fileName);
     if (!fileIncludes)
@@ -230,12 +577,18 @@ int CppParser::findLastOperator(const QString &phrase) const
 
 PStatementList CppParser::findNamespace(const QString &name)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->findNamespace(name);
     QMutexLocker locker(&mMutex);
     return mNamespaces.value(name,PStatementList());
 }
 
 PStatement CppParser::findStatement(const QString &fullname)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->findStatement(fullname);
     QMutexLocker locker(&mMutex);
     if (fullname.isEmpty())
         return PStatement();
@@ -264,23 +617,24 @@ PStatement CppParser::findStatement(const QString &fullname)
 
 PStatement CppParser::findStatementOf(const QString &fileName, const QString &phrase, int line)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->findStatementOf(fileName,phrase,line);
     QMutexLocker locker(&mMutex);
-    if (mParsing)
-        return PStatement();
     return findStatementOf(fileName,phrase,findScopeStatement(fileName,line));
 }
 
 PStatement CppParser::findStatementOf(const QString &fileName,
                                       const QString &phrase,
                                       const PStatement& currentScope,
-                                      PStatement &parentScopeType,
-                                      bool force)
+                                      PStatement &parentScopeType)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->findStatementOf(fileName,phrase,currentScope,parentScopeType);
     QMutexLocker locker(&mMutex);
     PStatement result;
     parentScopeType = currentScope;
-    if (mParsing && !force)
-        return PStatement();
 
     //find the start scope statement
     QString namespaceName, remainder;
@@ -414,35 +768,65 @@ PStatement CppParser::findStatementOf(const QString &fileName,
     return statement;
 }
 
+static QString evalCacheKey(const QString& fileName, const PStatement& scope, const QString& phrase)
+{
+    // statements are only freed while parsing, and the memos are cleared after that
+    return fileName+'\n'+QString::number((quintptr)scope.get())+'\n'+phrase;
+}
+
+static PEvalStatement copyEvalStatement(const PEvalStatement& statement)
+{
+    // callers may modify the result
+    if (!statement)
+        return PEvalStatement();
+    return std::make_shared<EvalStatement>(*statement);
+}
+
 PEvalStatement CppParser::evalExpression(
         const QString &fileName,
         const QStringList &phraseExpression,
         const PStatement &currentScope)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->evalExpression(fileName,phraseExpression,currentScope);
     QMutexLocker locker(&mMutex);
-    if (mParsing)
-        return PEvalStatement();
 //    qDebug()<<phraseExpression;
+    bool useCache = prepareEvalCache();
+    QString key;
+    if (useCache) {
+        key = evalCacheKey(fileName,currentScope,phraseExpression.join('\n'));
+        auto iter = mEvalExpressionCache.constFind(key);
+        if (iter!=mEvalExpressionCache.constEnd())
+            return copyEvalStatement(iter.value());
+    }
     int pos = 0;
-    return doEvalExpression(fileName,
+    PEvalStatement result = doEvalExpression(fileName,
                             phraseExpression,
                             pos,
                             currentScope,
                             PEvalStatement(),
                             true);
+    if (useCache)
+        mEvalExpressionCache.insert(key,copyEvalStatement(result));
+    return result;
 }
 
-PStatement CppParser::findStatementOf(const QString &fileName, const QString &phrase, const PStatement& currentClass, bool force)
+PStatement CppParser::findStatementOf(const QString &fileName, const QString &phrase, const PStatement& currentClass)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->findStatementOf(fileName,phrase,currentClass);
     PStatement statementParentType;
-    return findStatementOf(fileName,phrase,currentClass,statementParentType,force);
+    return findStatementOf(fileName,phrase,currentClass,statementParentType);
 }
 
 PStatement CppParser::findStatementOf(const QString &fileName, const QStringList &expression, const PStatement &currentScope)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->findStatementOf(fileName,expression,currentScope);
     QMutexLocker locker(&mMutex);
-    if (mParsing)
-        return PStatement();
     QString memberOperator;
     QStringList memberExpression;
     QStringList ownerExpression = getOwnerExpressionAndMember(expression,memberOperator,memberExpression);
@@ -482,19 +866,35 @@ PStatement CppParser::findStatementOf(const QString &fileName, const QStringList
 
 PStatement CppParser::findStatementOf(const QString &fileName, const QStringList &expression, int line)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->findStatementOf(fileName,expression,line);
     QMutexLocker locker(&mMutex);
-    if (mParsing)
-        return PStatement();
     return findStatementOf(fileName,expression,findScopeStatement(fileName,line));
 }
 
 PStatement CppParser::findAliasedStatement(const PStatement &statement)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->findAliasedStatement(statement);
     QMutexLocker locker(&mMutex);
-    if (mParsing)
-        return PStatement();
     if (!statement)
         return PStatement();
+    bool useCache = prepareEvalCache();
+    if (useCache) {
+        auto iter = mAliasedStatementCache.constFind(statement.get());
+        if (iter!=mAliasedStatementCache.constEnd())
+            return iter.value();
+    }
+    PStatement result = doFindAliasedStatement(statement);
+    if (useCache)
+        mAliasedStatementCache.insert(statement.get(),result);
+    return result;
+}
+
+PStatement CppParser::doFindAliasedStatement(const PStatement &statement)
+{
     QString alias = statement->type;
     int pos = statement->type.lastIndexOf("::");
     if (pos<0)
@@ -553,10 +953,18 @@ PStatement CppParser::findStatementStartingFrom(const QString &fileName, const Q
 
 PStatement CppParser::findTypeDefinitionOf(const QString &fileName, const QString &aType, const PStatement& currentClass)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->findTypeDefinitionOf(fileName,aType,currentClass);
     QMutexLocker locker(&mMutex);
-
-    if (mParsing)
-        return PStatement();
+    bool useCache = prepareEvalCache();
+    QString key;
+    if (useCache) {
+        key = evalCacheKey(fileName,currentClass,aType);
+        auto iter = mTypeDefinitionCache.constFind(key);
+        if (iter!=mTypeDefinitionCache.constEnd())
+            return iter.value();
+    }
 
     // Remove pointer stuff from type
     QString s = aType; // 'Type' is a keyword
@@ -583,40 +991,62 @@ PStatement CppParser::findTypeDefinitionOf(const QString &fileName, const QStrin
     PStatement scopeStatement = currentClass;
 
     PStatement statement = findStatementOf(fileName,s,currentClass);
-    return getTypeDef(statement,fileName,aType);
+    PStatement result = getTypeDef(statement,fileName,aType);
+    if (useCache)
+        mTypeDefinitionCache.insert(key,result);
+    return result;
+}
+
+bool CppParser::prepareEvalCache()
+{
+    // the statement database changes between parse steps without a new serial id
+    QMutexLocker locker(&mStateMutex);
+    if (mParsing)
+        return false;
+    if (mEvalCacheSerialId!=mSerialId) {
+        mEvalExpressionCache.clear();
+        mTypeDefinitionCache.clear();
+        mAliasedStatementCache.clear();
+        mEvalCacheSerialId = mSerialId;
+    }
+    return true;
 }
 
 PStatement CppParser::findTypeDef(const PStatement &statement, const QString &fileName)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->findTypeDef(statement,fileName);
     QMutexLocker locker(&mMutex);
-
-    if (mParsing)
-        return PStatement();
     return getTypeDef(statement, fileName, "");
 }
 
 bool CppParser::freeze()
 {
-    QMutexLocker locker(&mMutex);
-    if (mParsing)
-        return false;
-    mLockCount++;
+    QMutexLocker locker(&mStateMutex);
+    if (mFreezeCount==0)
+        mFrozenSnapshot = mSnapshot;
+    mFreezeCount++;
     return true;
 }
 
 bool CppParser::freeze(const QString &serialId)
 {
-    QMutexLocker locker(&mMutex);
-    if (mParsing)
-        return false;
-    if (mSerialId!=serialId)
+    QMutexLocker locker(&mStateMutex);
+    const PCppParser& snapshot = (mFreezeCount>0)?mFrozenSnapshot:mSnapshot;
+    if (snapshot->mSerialId!=serialId)
         return false;
-    mLockCount++;
+    if (mFreezeCount==0)
+        mFrozenSnapshot = mSnapshot;
+    mFreezeCount++;
     return true;
 }
 
 QStringList CppParser::getClassesList()
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->getClassesList();
     QMutexLocker locker(&mMutex);
 
     QStringList list;
@@ -626,11 +1056,11 @@ QStringList CppParser::getClassesList()
     queue.enqueue(PStatement());
     while (!queue.isEmpty()) {
         PStatement statement = queue.dequeue();
-        StatementMap statementMap = mStatementList.childrenStatements(statement);
-        for (PStatement& child:statementMap) {
+        const StatementMap& statementMap = mStatementList.childrenStatements(statement);
+        for (const PStatement& child:statementMap) {
             if (child->kind == StatementKind::skClass)
                 list.append(child->command);
-            if (!child->children.isEmpty())
+            if (!mStatementList.childrenStatements(child).isEmpty())
                 queue.enqueue(child);
         }
     }
@@ -639,9 +1069,10 @@ QStringList CppParser::getClassesList()
 
 QStringList CppParser::getFileDirectIncludes(const QString &filename)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->getFileDirectIncludes(filename);
     QMutexLocker locker(&mMutex);
-    if (mParsing)
-        return QStringList();
     if (filename.isEmpty())
         return QStringList();
     PFileIncludes fileIncludes = mPreprocessor.includesList().value(filename,PFileIncludes());
@@ -655,10 +1086,11 @@ QStringList CppParser::getFileDirectIncludes(const QString &filename)
 
 QSet<QString> CppParser::getFileIncludes(const QString &filename)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->getFileIncludes(filename);
     QMutexLocker locker(&mMutex);
     QSet<QString> list;
-    if (mParsing)
-        return list;
     if (filename.isEmpty())
         return list;
     list.insert(filename);
@@ -674,12 +1106,13 @@ QSet<QString> CppParser::getFileIncludes(const QString &filename)
 
 QSet<QString> CppParser::getFileUsings(const QString &filename)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->getFileUsings(filename);
     QMutexLocker locker(&mMutex);
     QSet<QString> result;
     if (filename.isEmpty())
         return result;
-    if (mParsing)
-        return result;
     PFileIncludes fileIncludes= mPreprocessor.includesList().value(filename,PFileIncludes());
     if (fileIncludes) {
         foreach (const QString& usingName, fileIncludes->usings) {
@@ -734,16 +1167,17 @@ void CppParser::invalidateFile(const QString &fileName)
 {
     if (!mEnabled)
         return;
+    if (!startParsing())
+        return;
     {
-        QMutexLocker locker(&mMutex);
-        if (mParsing || mLockCount>0)
-            return;
-        updateSerialId();
-        mParsing = true;
+        auto action = finally([this]{
+            endParsing();
+        });
+        QSet<QString> files = calculateFilesToBeReparsed(fileName);
+        lockForParsing();
+        internalInvalidateFiles(files);
+        unlockForParsing();
     }
-    QSet<QString> files = calculateFilesToBeReparsed(fileName);
-    internalInvalidateFiles(files);
-    mParsing = false;
 }
 
 bool CppParser::isIncludeLine(const QString &line)
@@ -784,53 +1218,74 @@ void CppParser::parseFile(const QString &fileName, bool inProject, bool onlyIfNo
 {
     if (!mEnabled)
         return;
-    {
-        QMutexLocker locker(&mMutex);
-        if (mParsing || mLockCount>0)
-            return;
-        updateSerialId();
-        mParsing = true;
-        if (updateView)
-            emit onBusy();
-        emit onStartParsing();
-    }
+    if (!startParsing())
+        return;
+    if (updateView)
+        emit onBusy();
+    emit onStartParsing();
     {
         auto action = finally([&,this]{
-            mParsing = false;
+            endParsing();
 
             if (updateView)
                 emit onEndParsing(mFilesScannedCount,1);
             else
                 emit onEndParsing(mFilesScannedCount,0);
         });
+        checkSystemHeaderCache();
         QString fName = fileName;
         if (onlyIfNotParsed && mPreprocessor.scannedFiles().contains(fName))
             return;
+        // system headers in the shared snapshot are not reparsed
+        if (isSharedFile(fName))
+            return;
 
-        if (inProject) {
+        QStringList buffer;
+        if (mOnGetFileStream)
+            mOnGetFileStream(fileName,buffer);
+        QVector<uint> lineHashes = bufferLineHashes(buffer);
+        int bodyStartLine, bodyEndLine;
+        lockForParsing();
+        bool bodyReparsed = reparseFunctionBody(fileName,buffer,lineHashes,bodyStartLine,bodyEndLine);
+        unlockForParsing();
+        if (bodyReparsed) {
+            // only local statements in a function body are changed,
+            // so files including it don't need to be reparsed
+            {
+                QMutexLocker locker(&mStateMutex);
+                mReparsedBodyFile = fileName;
+                mReparsedBodyStartLine = bodyStartLine;
+                mReparsedBodyEndLine = bodyEndLine;
+            }
+            mFilesToScanCount = 1;
+            mFilesScannedCount = 1;
+            emit onProgress(fileName,mFilesToScanCount,mFilesScannedCount);
+        } else if (inProject) {
             QSet<QString> filesToReparsed = calculateFilesToBeReparsed(fileName);
             QStringList files = sortFilesByIncludeRelations(filesToReparsed);
+            lockForParsing();
             internalInvalidateFiles(filesToReparsed);
+            unlockForParsing();
 
             mFilesToScanCount = files.count();
             mFilesScannedCount = 0;
-
-            foreach (const QString& file,files) {
-                mFilesScannedCount++;
-                emit onProgress(file,mFilesToScanCount,mFilesScannedCount);
-                if (!mPreprocessor.scannedFiles().contains(file)) {
-                    internalParse(file);
-                }
-            }
+            parseFiles(files);
         } else {
+            lockForParsing();
             internalInvalidateFile(fileName);
+            unlockForParsing();
             mFilesToScanCount = 1;
             mFilesScannedCount = 0;
 
             mFilesScannedCount++;
             emit onProgress(fileName,mFilesToScanCount,mFilesScannedCount);
-            internalParse(fileName);
+            internalParse(fileName, buffer);
         }
+        if (!buffer.isEmpty() && mPreprocessor.scannedFiles().contains(fileName))
+            mParsedLineHashes.insert(fileName,lineHashes);
+        else
+            mParsedLineHashes.remove(fileName);
+        updateSystemHeaderCache();
 
 //        if (inProject)
 //            mProjectFiles.insert(fileName);
@@ -847,137 +1302,149 @@ void CppParser::parseFileList(bool updateView)
 {
     if (!mEnabled)
         return;
-    {
-        QMutexLocker locker(&mMutex);
-        if (mParsing || mLockCount>0)
-            return;
-        updateSerialId();
-        mParsing = true;
-        if (updateView)
-            emit onBusy();
-        emit onStartParsing();
-    }
+    if (!startParsing())
+        return;
+    if (updateView)
+        emit onBusy();
+    emit onStartParsing();
     {
         auto action = finally([&,this]{
-            mParsing = false;
+            endParsing();
             if (updateView)
                 emit onEndParsing(mFilesScannedCount,1);
             else
                 emit onEndParsing(mFilesScannedCount,0);
         });
+        checkSystemHeaderCache();
+        // resetParser() and addProjectFile() may change it during the parse
+        QSet<QString> filesToScan;
+        {
+            QMutexLocker locker(&mMutex);
+            filesToScan = mFilesToScan;
+        }
         // Support stopping of parsing when files closes unexpectedly
         mFilesScannedCount = 0;
-        mFilesToScanCount = mFilesToScan.count();
+        mFilesToScanCount = filesToScan.count();
 
-        QStringList files = sortFilesByIncludeRelations(mFilesToScan);
+        QStringList files = sortFilesByIncludeRelations(filesToScan);
         // parse header files in the first parse
-        foreach (const QString& file, files) {
-            mFilesScannedCount++;
-            emit onProgress(mCurrentFile,mFilesToScanCount,mFilesScannedCount);
-            if (!mPreprocessor.scannedFiles().contains(file)) {
-                internalParse(file);
-            }
+        parseFiles(files);
+        if (!resetPending()) {
+            QMutexLocker locker(&mMutex);
+            mFilesToScan.subtract(filesToScan);
         }
-        mFilesToScan.clear();
+        updateSystemHeaderCache();
     }
 }
 
-void CppParser::parseHardDefines()
+void CppParser::prefetchHeaders(const QStringList &headers)
 {
-    QMutexLocker locker(&mMutex);
-    if (mParsing)
+    if (!mEnabled)
         return;
-    int oldIsSystemHeader = mIsSystemHeader;
-    mIsSystemHeader = true;
-    mParsing=true;
+    if (!startParsing(true))
+        return;
+    emit onStartParsing();
     {
-        auto action = finally([&,this]{
-            mParsing = false;
-            mIsSystemHeader=oldIsSystemHeader;
+        auto action = finally([this]{
+            endParsing();
+            emit onEndParsing(mFilesScannedCount,0);
         });
-        for (const PDefine& define:mPreprocessor.hardDefines()) {
-            addStatement(
-                        PStatement(), // defines don't belong to any scope
-                        "",
-                        "", // define has no type
-                        define->name,
-                        define->args,
-                        "",
-                        define->value,
-                        -1,
-                        StatementKind::skPreprocessor,
-                        StatementScope::Global,
-                        StatementClassScope::None,
-                        StatementProperty::spHasDefinition);
+        checkSystemHeaderCache();
+        mFilesToScanCount = headers.count();
+        mFilesScannedCount = 0;
+        foreach (const QString& header, headers) {
+            if (resetPending())
+                break;
+            mFilesScannedCount++;
+            if (mPreprocessor.scannedFiles().contains(header))
+                continue;
+            // system headers in the shared snapshot are not reparsed
+            if (isSharedFile(header))
+                continue;
+            emit onProgress(header,mFilesToScanCount,mFilesScannedCount);
+            internalParse(header);
         }
+        updateSystemHeaderCache();
+    }
+}
+
+void CppParser::parseHardDefines()
+{
+    while (!startParsing()) {
+        // the parse stopped by resetParser() adds them after the reset
+        QMutexLocker locker(&mStateMutex);
+        if (mParsing) {
+            if (mResetRequests!=mResetsDone)
+                mHardDefinesPending = true;
+            return;
+        }
+    }
+    {
+        auto action = finally([this]{
+            endParsing();
+        });
+        QMutexLocker locker(&mMutex);
+        addHardDefines();
     }
 }
 
 bool CppParser::parsing() const
 {
+    QMutexLocker locker(&mStateMutex);
     return mParsing;
 }
 
+bool CppParser::prefetchingHeaders() const
+{
+    QMutexLocker locker(&mStateMutex);
+    return mPrefetchingHeaders;
+}
+
 void CppParser::resetParser()
 {
-    while (true) {
-        {
-            QMutexLocker locker(&mMutex);
-            if (!mParsing && mLockCount ==0) {
-                mParsing = true;
-                break;
-            }
-        }
-        QThread::msleep(50);
-        QCoreApplication* app = QApplication::instance();
-        app->processEvents();
-    }
     {
-        auto action = finally([this]{
-            mParsing = false;
-        });
-        emit  onBusy();
-        mUniqId = 0;
-
+        QMutexLocker locker(&mMutex);
         mParseLocalHeaders = true;
         mParseGlobalHeaders = true;
-        mIsSystemHeader = false;
-        mIsHeader = false;
-        mIsProjectFile = false;
-        mFilesScannedCount=0;
-        mFilesToScanCount = 0;
-
-        mCurrentScope.clear();
-        mCurrentClassScope.clear();
-        mStatementList.clear();
-
         mProjectFiles.clear();
-        mBlockBeginSkips.clear(); //list of for/catch block begin token index;
-        mBlockEndSkips.clear(); //list of for/catch block end token index;
-        mInlineNamespaceEndSkips.clear(); // list for inline namespace end token index;
         mFilesToScan.clear(); // list of base files to scan
-        mNamespaces.clear();  // namespace and the statements in its scope
-        mInlineNamespaces.clear();
-
-        mPreprocessor.clear();
-        mTokenizer.clear();
-
+        mPreprocessor.clearOptions();
+    }
+    {
+        QMutexLocker locker(&mStateMutex);
+        mResetRequests++;
     }
+    // the running parse stops, and resets the database when it ends
+    if (startParsing())
+        endParsing();
 }
 
 void CppParser::unFreeze()
 {
-    QMutexLocker locker(&mMutex);
-    mLockCount--;
+    PCppParser snapshot;
+    {
+        QMutexLocker locker(&mStateMutex);
+        mFreezeCount--;
+        if (mFreezeCount>0)
+            return;
+        snapshot = std::move(mFrozenSnapshot);
+    }
+    releaseSnapshot(snapshot);
 }
 
 QSet<QString> CppParser::scannedFiles()
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->scannedFiles();
     return mPreprocessor.scannedFiles();
 }
 
 bool CppParser::isFileParsed(const QString &filename)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->isFileParsed(filename);
     return mPreprocessor.scannedFiles().contains(filename);
 }
 
@@ -996,6 +1463,9 @@ QString CppParser::getScopePrefix(const PStatement& statement){
 
 QString CppParser::prettyPrintStatement(const PStatement& statement, const QString& filename, int line)
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->prettyPrintStatement(statement,filename,line);
     QString result;
     switch(statement->kind) {
     case StatementKind::skPreprocessor:
@@ -1204,7 +1674,9 @@ PStatement CppParser::addStatement(const PStatement& parent,
         //find
         if (properties.testFlag(StatementProperty::spHasDefinition)) {
             PStatement oldStatement = findStatementInScope(newCommand,noNameArgs,kind,parent);
-            if (oldStatement  && !oldStatement->hasDefinition()) {
+            // statements shared with other parsers can't be changed
+            if (oldStatement  && !oldStatement->hasDefinition()
+                    && !isSharedStatement(oldStatement)) {
                 oldStatement->setHasDefinition(true);
                 if (oldStatement->fileName!=fileName) {
                     PFileIncludes fileIncludes=mPreprocessor.includesList().value(fileName);
@@ -1443,133 +1915,965 @@ void CppParser::addSoloScopeLevel(PStatement& statement, int line, bool shouldRe
         fileIncludes->scopes.addScope(line,statement);
     }
 
-    // Set new scope
-    if (!statement)
-        mClassScope = StatementClassScope::None; // {}, namespace or class that doesn't exist
-    else if (statement->kind == StatementKind::skNamespace)
-        mClassScope = StatementClassScope::None;
-    else if (statement->type == "class")
-        mClassScope = StatementClassScope::Private; // classes are private by default
-    else
-        mClassScope = StatementClassScope::Public; // structs are public by default
-    mCurrentClassScope.append(mClassScope);
-#ifdef QT_DEBUG
-//    if (mCurrentClassScope.count()==1)
-//        qDebug()<<"++add scope"<<mCurrentFile<<line<<mCurrentClassScope.count();
-#endif
+    // Set new scope
+    if (!statement)
+        mClassScope = StatementClassScope::None; // {}, namespace or class that doesn't exist
+    else if (statement->kind == StatementKind::skNamespace)
+        mClassScope = StatementClassScope::None;
+    else if (statement->type == "class")
+        mClassScope = StatementClassScope::Private; // classes are private by default
+    else
+        mClassScope = StatementClassScope::Public; // structs are public by default
+    mCurrentClassScope.append(mClassScope);
+#ifdef QT_DEBUG
+//    if (mCurrentClassScope.count()==1)
+//        qDebug()<<"++add scope"<<mCurrentFile<<line<<mCurrentClassScope.count();
+#endif
+}
+
+void CppParser::removeScopeLevel(int line)
+{
+    // Remove class list
+    if (mCurrentScope.isEmpty())
+        return; // TODO: should be an exception
+#ifdef QT_DEBUG
+//    if (mCurrentClassScope.count()==1)
+//        qDebug()<<"--remove scope"<<mCurrentFile<<line<<mCurrentClassScope.count();
+#endif
+    PStatement currentScope = getCurrentScope();
+    PFileIncludes fileIncludes = mPreprocessor.includesList().value(mCurrentFile);
+    if (currentScope) {
+        if (currentScope->kind == StatementKind::skBlock) {
+            if (mStatementList.childrenStatements(currentScope).isEmpty()) {
+                // remove no children block
+                if (fileIncludes) {
+                    fileIncludes->scopes.removeLastScope();
+                }
+                mStatementList.deleteStatement(currentScope);
+            } else {
+                fileIncludes->statements.insert(currentScope->fullName,currentScope);
+            }
+        } else if (currentScope->kind == StatementKind::skClass) {
+            mIndex=indexOfNextSemicolon(mIndex);
+        }
+    }
+    mCurrentScope.pop_back();
+    mCurrentClassScope.pop_back();
+
+    // Set new scope
+    currentScope = getCurrentScope();
+  //  fileIncludes:=FindFileIncludes(fCurrentFile);
+    if (fileIncludes && fileIncludes->scopes.lastScope()!=currentScope) {
+        fileIncludes->scopes.addScope(line,currentScope);
+    }
+
+    if (!currentScope) {
+        mClassScope = StatementClassScope::None;
+    } else {
+        mClassScope = mCurrentClassScope.back();
+    }
+}
+
+void CppParser::internalClear()
+{
+    mCurrentScope.clear();
+    mCurrentClassScope.clear();
+    mIndex = 0;
+    mClassScope = StatementClassScope::None;
+    mBlockBeginSkips.clear();
+    mBlockEndSkips.clear();
+    mInlineNamespaceEndSkips.clear();
+}
+
+bool CppParser::startParsing(bool prefetchingHeaders)
+{
+    {
+        QMutexLocker locker(&mStateMutex);
+        // prefetched headers would be parsed by this parse anyway, and a parse stopped by
+        // resetParser() ends soon, so parser threads wait for them.
+        // the gui thread must not freeze, it fails as if another parse is running
+        if (QThread::currentThread() != qApp->thread()) {
+            while (mParsing && ((!prefetchingHeaders && mPrefetchingHeaders)
+                                || mResetRequests!=mResetsDone))
+                mStateChanged.wait(&mStateMutex);
+        }
+        if (mParsing)
+            return false;
+        mParsing = true;
+        mParseThread = QThread::currentThread();
+        mPrefetchingHeaders = prefetchingHeaders;
+        mReparsedBodyFile.clear();
+        mReparsedBodyFromSerialId = mSnapshot->mSerialId;
+    }
+    QMutexLocker locker(&mMutex);
+    updateSerialId();
+    return true;
+}
+
+void CppParser::endParsing()
+{
+    QMutexLocker locker(&mMutex);
+    while (true) {
+        int resetRequests;
+        bool addingHardDefines;
+        {
+            QMutexLocker stateLocker(&mStateMutex);
+            resetRequests = mResetRequests;
+            addingHardDefines = mHardDefinesPending;
+            mHardDefinesPending = false;
+        }
+        if (resetRequests!=mResetsDone)
+            resetDatabase();
+        if (addingHardDefines)
+            addHardDefines();
+        PCppParser snapshot;
+        if (mDatabaseChanged) {
+            // statements found during the parse are from a half-done database
+            updateSerialId();
+            snapshot = createSnapshot();
+            mDatabaseChanged = false;
+        }
+        PCppParser oldSnapshot;
+        {
+            QMutexLocker stateLocker(&mStateMutex);
+            mResetsDone = resetRequests;
+            // called again while the snapshot is created
+            if (mResetRequests!=mResetsDone || mHardDefinesPending)
+                continue;
+            if (snapshot) {
+                oldSnapshot = mSnapshot;
+                mSnapshot = snapshot;
+            }
+            mParsing = false;
+            mParseThread = nullptr;
+            mPrefetchingHeaders = false;
+            mReparsedBodyToSerialId = mSnapshot->mSerialId;
+            mStateChanged.wakeAll();
+        }
+        releaseSnapshot(oldSnapshot);
+        return;
+    }
+}
+
+void CppParser::lockForParsing()
+{
+    // lookups read the published snapshot, only changes of the options wait for the parse step
+    mMutex.lock();
+    mDatabaseChanged = true;
+}
+
+void CppParser::unlockForParsing()
+{
+    mMutex.unlock();
+}
+
+bool CppParser::resetPending() const
+{
+    QMutexLocker locker(&mStateMutex);
+    return mResetRequests!=mResetsDone;
+}
+
+void CppParser::resetDatabase()
+{
+    emit  onBusy();
+    mDatabaseChanged = true;
+    mUniqId = 0;
+
+    mIsSystemHeader = false;
+    mIsHeader = false;
+    mIsProjectFile = false;
+    mFilesScannedCount=0;
+    mFilesToScanCount = 0;
+
+    mCurrentScope.clear();
+    mCurrentClassScope.clear();
+    mStatementList.clear();
+    mEvalExpressionCache.clear();
+    mTypeDefinitionCache.clear();
+    mAliasedStatementCache.clear();
+
+    mBlockBeginSkips.clear(); //list of for/catch block begin token index;
+    mBlockEndSkips.clear(); //list of for/catch block end token index;
+    mInlineNamespaceEndSkips.clear(); // list for inline namespace end token index;
+    mNamespaces.clear();  // namespace and the statements in its scope
+    mInlineNamespaces.clear();
+    mParsedLineHashes.clear();
+    mSystemHeaderSnapshot.reset();
+
+    mPreprocessor.clearTempResults();
+    mPreprocessor.clearResults();
+    mTokenizer.clear();
+
+    mSystemHeaderCacheChecked = false;
+    mSystemHeaderCacheFileCount = 0;
+    mSystemHeaderCacheKey.clear();
+
+    QMutexLocker locker(&mStateMutex);
+    mReparsedBodyFile.clear();
+}
+
+void CppParser::addHardDefines()
+{
+    mDatabaseChanged = true;
+    int oldIsSystemHeader = mIsSystemHeader;
+    mIsSystemHeader = true;
+    auto action = finally([&,this]{
+        mIsSystemHeader=oldIsSystemHeader;
+    });
+    for (const PDefine& define:mPreprocessor.hardDefines()) {
+        addStatement(
+                    PStatement(), // defines don't belong to any scope
+                    "",
+                    "", // define has no type
+                    define->name,
+                    define->args,
+                    "",
+                    define->value,
+                    -1,
+                    StatementKind::skPreprocessor,
+                    StatementScope::Global,
+                    StatementClassScope::None,
+                    StatementProperty::spHasDefinition);
+    }
+}
+
+PCppParser CppParser::createSnapshot()
+{
+    PCppParser snapshot(new CppParser(nullptr, true));
+    snapshot->mParserId = mParserId;
+    {
+        QMutexLocker locker(&mStateMutex);
+        snapshot->mSerialId = mSerialId;
+    }
+    snapshot->mLanguage = mLanguage;
+    snapshot->mEnabled = mEnabled;
+    snapshot->mParseLocalHeaders = mParseLocalHeaders;
+    snapshot->mParseGlobalHeaders = mParseGlobalHeaders;
+    snapshot->mProjectFiles = mProjectFiles;
+    snapshot->mInlineNamespaces = mInlineNamespaces;
+    snapshot->mSystemHeaderSnapshot = mSystemHeaderSnapshot;
+
+    QHash<const Statement*,PStatement> copies;
+    snapshot->mStatementList.copyFrom(mStatementList, copies);
+    auto copyOf = [&copies](const PStatement& statement) {
+        PStatement copy = copies.value(statement.get());
+        return copy?copy:statement;
+    };
+
+    snapshot->mPreprocessor.copyOptionsFrom(mPreprocessor);
+    snapshot->mPreprocessor.copyResultsFrom(mPreprocessor);
+    QHash<QString,PFileIncludes>& includesList = snapshot->mPreprocessor.includesList();
+    for (auto it=includesList.begin();it!=includesList.end();++it) {
+        // files in the shared system header snapshot are never changed
+        if (isSharedFile(it.key()))
+            continue;
+        PFileIncludes fileIncludes = std::make_shared<FileIncludes>(*it.value());
+        for (auto sit=fileIncludes->statements.begin();sit!=fileIncludes->statements.end();++sit)
+            sit.value() = copyOf(sit.value());
+        for (auto sit=fileIncludes->declaredStatements.begin();sit!=fileIncludes->declaredStatements.end();++sit)
+            sit.value() = copyOf(sit.value());
+        // scopes are moved in place when a function body is reparsed
+        QVector<PCppScope> scopes;
+        foreach (const PCppScope& scope, it.value()->scopes.scopes()) {
+            PCppScope scopeCopy = std::make_shared<CppScope>();
+            scopeCopy->startLine = scope->startLine;
+            scopeCopy->statement = copyOf(scope->statement);
+            scopes.append(scopeCopy);
+        }
+        fileIncludes->scopes.clear();
+        fileIncludes->scopes.replaceScopes(0,0,scopes,0);
+        it.value() = fileIncludes;
+    }
+
+    for (auto it=mNamespaces.begin();it!=mNamespaces.end();++it) {
+        PStatementList namespaceStatements = std::make_shared<StatementList>();
+        foreach (const PStatement& statement, *it.value())
+            namespaceStatements->append(copyOf(statement));
+        snapshot->mNamespaces.insert(it.key(),namespaceStatements);
+    }
+    snapshot->moveToThread(thread());
+    return snapshot;
+}
+
+PCppParser CppParser::readSnapshot() const
+{
+    QMutexLocker locker(&mStateMutex);
+    // the parse reads its own database
+    if (mParseThread == QThread::currentThread())
+        return PCppParser();
+    if (mFreezeCount>0)
+        return mFrozenSnapshot;
+    return mSnapshot;
+}
+
+void CppParser::releaseSnapshot(const PCppParser &snapshot)
+{
+    // the gui thread is not in the middle of an event if it's the caller
+    if (!snapshot || QThread::currentThread()==thread())
+        return;
+    QMetaObject::invokeMethod(this, [snapshot]{}, Qt::QueuedConnection);
+}
+
+// hash of the modification times of the directories under the include paths.
+// A new header may shadow a cached one, and adding it changes the time of its directory.
+// Only directories are listed, the files in them are not.
+static QString includePathsListingHash(const QList<QString>& paths)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    foreach (const QString& path, paths) {
+        QDir dir(path);
+        QStringList dirs;
+        dirs.append(QString(".%1").arg(QFileInfo(path).lastModified().toMSecsSinceEpoch()));
+        QDirIterator it(path, QDir::Dirs | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System,
+                        QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            it.next();
+            dirs.append(QString("%1 %2").arg(dir.relativeFilePath(it.filePath()))
+                        .arg(it.fileInfo().lastModified().toMSecsSinceEpoch()));
+        }
+        dirs.sort();
+        hash.addData((path + '\n').toUtf8());
+        foreach (const QString& d, dirs)
+            hash.addData((d + '\n').toUtf8());
+    }
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+QString CppParser::systemHeaderCacheKey()
+{
+    // only headers in the include paths are cached, project include paths are not part of the key
+    QList<QString> includePaths;
+    DefineMap hardDefines;
+    {
+        QMutexLocker locker(&mMutex);
+        includePaths = mPreprocessor.includePathList();
+        hardDefines = mPreprocessor.hardDefines();
+    }
+    QString key = QString("%1\n%2\n")
+            .arg(mLanguage==ParserLanguage::C?"C":"C++",mCompilerSetId);
+    foreach (const QString& path, includePaths)
+        key += "I " + path + '\n';
+    key += "L " + includePathsListingHash(includePaths) + '\n';
+    QStringList defines;
+    foreach (const PDefine& define, hardDefines) {
+        defines.append(QString("D %1%2 %3").arg(define->name,define->args,define->value));
+    }
+    defines.sort();
+    key += defines.join('\n');
+    return key;
+}
+
+QString CppParser::systemHeaderCacheFileName(const QString &key)
+{
+    QByteArray hash = QCryptographicHash::hash(key.toUtf8(),QCryptographicHash::Sha1);
+    return includeTrailingPathDelimiter(mSystemHeaderCacheFolder)
+            + QString::fromLatin1(hash.toHex()) + ".cache";
+}
+
+QSet<QString> CppParser::systemHeadersToCache()
+{
+    QList<QString> includePaths;
+    {
+        QMutexLocker locker(&mMutex);
+        includePaths = mPreprocessor.includePathList();
+    }
+    QSet<QString> headers;
+    foreach (const QString& file, mPreprocessor.scannedFiles()) {
+        if (!mPreprocessor.includesList().contains(file))
+            continue;
+        foreach (const QString& path, includePaths) {
+            // "/usr/include2/a.h" is not in "/usr/include"
+            if (file.startsWith(includeTrailingPathDelimiter(path))) {
+                headers.insert(file);
+                break;
+            }
+        }
+    }
+    // a cached header can only include cached headers,
+    // or the preprocessor can't find the defines/includes of its include files
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        foreach (const QString& file, headers) {
+            PFileIncludes fileIncludes = mPreprocessor.includesList().value(file);
+            foreach (const QString& inc, fileIncludes->includeFiles.keys()) {
+                if (!headers.contains(inc)) {
+                    headers.remove(file);
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+    return headers;
+}
+
+static void collectCachedStatements(const StatementModel& statementList,
+                                    const PStatement& parent,
+                                    const QHash<QString,int>& fileIds,
+                                    QList<PStatement>& statements,
+                                    QHash<Statement*,int>& statementIds)
+{
+    const StatementMap& children = statementList.childrenStatements(parent);
+    foreach (const PStatement& statement, children) {
+        if (!fileIds.contains(statement->fileName))
+            continue;
+        statementIds.insert(statement.get(),statements.count());
+        statements.append(statement);
+        collectCachedStatements(statementList,statement,fileIds,statements,statementIds);
+    }
+}
+
+PSystemHeaderSnapshot CppParser::loadSystemHeaderSnapshot(const QString& key)
+{
+    QFile file(systemHeaderCacheFileName(key));
+    if (!file.open(QFile::ReadOnly))
+        return PSystemHeaderSnapshot();
+    QByteArray bytes;
+    uchar* data = file.map(0,file.size());
+    if (data)
+        bytes = QByteArray::fromRawData((const char*)data,file.size());
+    else
+        bytes = file.readAll();
+    QDataStream in(bytes);
+    in.setVersion(QDataStream::Qt_5_6);
+
+    quint32 magic;
+    qint32 version;
+    QString savedKey;
+    in>>magic>>version>>savedKey;
+    if (magic!=SYSTEM_HEADER_CACHE_MAGIC
+            || version!=SYSTEM_HEADER_CACHE_VERSION
+            || savedKey!=key)
+        return PSystemHeaderSnapshot();
+
+    // the cache is invalid if any header is changed
+    qint32 headerCount;
+    in>>headerCount;
+    if (in.status()!=QDataStream::Ok || headerCount<=0)
+        return PSystemHeaderSnapshot();
+    QStringList headers;
+    QList<qint64> modifiedTimes;
+    for (int i=0;i<headerCount;i++) {
+        QString header;
+        qint64 lastModified;
+        in>>header>>lastModified;
+        if (in.status()!=QDataStream::Ok)
+            return PSystemHeaderSnapshot();
+        QFileInfo info(header);
+        if (!info.exists() || info.lastModified().toMSecsSinceEpoch()!=lastModified)
+            return PSystemHeaderSnapshot();
+        headers.append(header);
+        modifiedTimes.append(lastModified);
+    }
+    qint32 uniqId;
+    in>>uniqId;
+
+    qint32 statementCount;
+    in>>statementCount;
+    if (in.status()!=QDataStream::Ok || statementCount<0)
+        return PSystemHeaderSnapshot();
+    QVector<PStatement> statements;
+    for (int i=0;i<statementCount;i++) {
+        PStatement statement = std::make_shared<Statement>();
+        qint32 parentId, kind, scope, classScope, fileId, line, definitionFileId, definitionLine, properties;
+        in>>parentId
+          >>statement->type>>statement->command>>statement->args>>statement->value
+          >>statement->noNameArgs>>statement->fullName
+          >>kind>>scope>>classScope
+          >>fileId>>line>>definitionFileId>>definitionLine>>properties
+          >>statement->friends>>statement->usingList;
+        if (in.status()!=QDataStream::Ok
+                || parentId>=statements.count()
+                || fileId<0 || fileId>=headers.count()
+                || definitionFileId<0 || definitionFileId>=headers.count())
+            return PSystemHeaderSnapshot();
+        if (parentId>=0)
+            statement->parentScope = statements[parentId];
+        statement->kind = static_cast<StatementKind>(kind);
+        statement->scope = static_cast<StatementScope>(scope);
+        statement->classScope = static_cast<StatementClassScope>(classScope);
+        statement->fileName = headers[fileId];
+        statement->line = line;
+        statement->definitionFileName = headers[definitionFileId];
+        statement->definitionLine = definitionLine;
+        statement->properties = StatementProperties(QFlag(properties));
+        statement->usageCount = -1;
+        statements.append(statement);
+    }
+
+    QVector<PFileIncludes> fileIncludesList;
+    for (int i=0;i<headerCount;i++) {
+        PFileIncludes fileIncludes = std::make_shared<FileIncludes>();
+        fileIncludes->baseFile = headers[i];
+        QList<QString> statementKeys;
+        QList<qint32> statementRefs;
+        QList<qint32> scopeLines;
+        QList<qint32> scopeRefs;
+        in>>fileIncludes->includeFiles>>fileIncludes->directIncludes>>fileIncludes->usings
+          >>statementKeys>>statementRefs>>scopeLines>>scopeRefs;
+        if (in.status()!=QDataStream::Ok
+                || statementKeys.count()!=statementRefs.count()
+                || scopeLines.count()!=scopeRefs.count())
+            return PSystemHeaderSnapshot();
+        for (int j=0;j<statementKeys.count();j++) {
+            int id = statementRefs[j];
+            if (id<0 || id>=statements.count())
+                return PSystemHeaderSnapshot();
+            fileIncludes->statements.insert(statementKeys[j],statements[id]);
+        }
+        for (int j=0;j<scopeLines.count();j++) {
+            int id = scopeRefs[j];
+            if (id>=statements.count())
+                return PSystemHeaderSnapshot();
+            fileIncludes->scopes.addScope(scopeLines[j], (id>=0)?statements[id]:PStatement());
+        }
+        fileIncludesList.append(fileIncludes);
+    }
+
+    QVector<PDefineMap> defineMaps;
+    for (int i=0;i<headerCount;i++) {
+        qint32 defineCount;
+        in>>defineCount;
+        if (in.status()!=QDataStream::Ok || defineCount<0)
+            return PSystemHeaderSnapshot();
+        PDefineMap defineMap = std::make_shared<DefineMap>();
+        for (int j=0;j<defineCount;j++) {
+            PDefine define = std::make_shared<Define>();
+            in>>define->name>>define->args>>define->value>>define->filename
+              >>define->hardCoded;
+            define->variadic = false;
+            if (!define->args.isEmpty())
+                mPreprocessor.parseArgs(define);
+            defineMap->insert(define->name,define);
+        }
+        defineMaps.append(defineMap);
+    }
+    QSet<QString> inlineNamespaces;
+    in>>inlineNamespaces;
+    if (in.status()!=QDataStream::Ok)
+        return PSystemHeaderSnapshot();
+
+    // everything is read, build the snapshot
+    std::shared_ptr<SystemHeaderSnapshot> snapshot = std::make_shared<SystemHeaderSnapshot>();
+    snapshot->key = key;
+    foreach (const PStatement& statement, statements) {
+        mStatementList.internStrings(statement);
+        PStatement parent = statement->parentScope.lock();
+        if (parent)
+            parent->children.insert(statement->command,statement);
+        else
+            snapshot->globalStatements.insert(statement->command,statement);
+        if (statement->kind == StatementKind::skNamespace) {
+            PStatementList namespaceList = snapshot->namespaces.value(statement->fullName,PStatementList());
+            if (!namespaceList) {
+                namespaceList=std::make_shared<StatementList>();
+                snapshot->namespaces.insert(statement->fullName,namespaceList);
+            }
+            namespaceList->append(statement);
+        }
+    }
+    snapshot->statementCount = statements.count();
+    for (int i=0;i<headerCount;i++) {
+        snapshot->includesList.insert(headers[i],fileIncludesList[i]);
+        snapshot->modifiedTimes.insert(headers[i],modifiedTimes[i]);
+        if (!defineMaps[i]->isEmpty())
+            snapshot->fileDefines.insert(headers[i],defineMaps[i]);
+    }
+    snapshot->inlineNamespaces = inlineNamespaces;
+    snapshot->uniqId = uniqId;
+    return snapshot;
+}
+
+void CppParser::installSystemHeaderSnapshot(const PSystemHeaderSnapshot &snapshot)
+{
+    mSystemHeaderSnapshot = snapshot;
+    mStatementList.addSharedStatements(snapshot->globalStatements,snapshot->statementCount);
+    // namespace lists are changed when parsing, so don't share them
+    for (auto it=snapshot->namespaces.begin();it!=snapshot->namespaces.end();++it) {
+        PStatementList namespaceList = mNamespaces.value(it.key(),PStatementList());
+        if (!namespaceList) {
+            namespaceList=std::make_shared<StatementList>();
+            mNamespaces.insert(it.key(),namespaceList);
+        }
+        namespaceList->append(*(it.value()));
+    }
+    foreach (const PFileIncludes& fileIncludes, snapshot->includesList) {
+        mPreprocessor.addFileIncludes(fileIncludes);
+        mPreprocessor.scannedFiles().insert(fileIncludes->baseFile);
+    }
+    for (auto it=snapshot->fileDefines.begin();it!=snapshot->fileDefines.end();++it) {
+        mPreprocessor.fileDefines().insert(it.key(),it.value());
+    }
+    mInlineNamespaces.unite(snapshot->inlineNamespaces);
+    mUniqId = std::max(mUniqId, snapshot->uniqId);
+    mSystemHeaderCacheFileCount = snapshot->includesList.count();
+}
+
+bool CppParser::isSharedStatement(const PStatement &statement) const
+{
+    return mSystemHeaderSnapshot
+            && mSystemHeaderSnapshot->includesList.contains(statement->fileName);
+}
+
+bool CppParser::isSharedFile(const QString &fileName) const
+{
+    return mSystemHeaderSnapshot
+            && mSystemHeaderSnapshot->includesList.contains(fileName);
 }
 
-void CppParser::removeScopeLevel(int line)
+void CppParser::saveSystemHeaderCache(const QSet<QString> &headers)
 {
-    // Remove class list
-    if (mCurrentScope.isEmpty())
-        return; // TODO: should be an exception
-#ifdef QT_DEBUG
-//    if (mCurrentClassScope.count()==1)
-//        qDebug()<<"--remove scope"<<mCurrentFile<<line<<mCurrentClassScope.count();
-#endif
-    PStatement currentScope = getCurrentScope();
-    PFileIncludes fileIncludes = mPreprocessor.includesList().value(mCurrentFile);
-    if (currentScope) {
-        if (currentScope->kind == StatementKind::skBlock) {
-            if (currentScope->children.isEmpty()) {
-                // remove no children block
-                if (fileIncludes) {
-                    fileIncludes->scopes.removeLastScope();
-                }
-                mStatementList.deleteStatement(currentScope);
-            } else {
-                fileIncludes->statements.insert(currentScope->fullName,currentScope);
+    QDir dir(mSystemHeaderCacheFolder);
+    if (!dir.exists() && !dir.mkpath(mSystemHeaderCacheFolder))
+        return;
+    // listing the include paths is slow, the key is computed once
+    if (mSystemHeaderCacheKey.isEmpty())
+        mSystemHeaderCacheKey = systemHeaderCacheKey();
+    const QString& key = mSystemHeaderCacheKey;
+    QSaveFile file(systemHeaderCacheFileName(key));
+    if (!file.open(QFile::WriteOnly | QFile::Truncate))
+        return;
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_6);
+    out<<(quint32)SYSTEM_HEADER_CACHE_MAGIC<<(qint32)SYSTEM_HEADER_CACHE_VERSION<<key;
+
+    // header list with modification times, statements refer to it by index
+    QStringList headerList = headers.values();
+    headerList.sort();
+    QHash<QString,int> fileIds;
+    out<<(qint32)headerList.count();
+    for (int i=0;i<headerList.count();i++) {
+        const QString& header = headerList[i];
+        fileIds.insert(header,i);
+        out<<header<<QFileInfo(header).lastModified().toMSecsSinceEpoch();
+    }
+    out<<(qint32)mUniqId;
+
+    // statements are saved in pre-order, so parents are always loaded before their children
+    QList<PStatement> statements;
+    QHash<Statement*,int> statementIds;
+    collectCachedStatements(mStatementList,PStatement(),fileIds,statements,statementIds);
+    out<<(qint32)statements.count();
+    foreach (const PStatement& statement, statements) {
+        PStatement parent = statement->parentScope.lock();
+        int fileId = fileIds.value(statement->fileName);
+        int definitionFileId = fileIds.value(statement->definitionFileName,-1);
+        int definitionLine = statement->definitionLine;
+        StatementProperties properties = statement->properties;
+        if (definitionFileId<0) {
+            // defined in a file that is not cached
+            definitionFileId = fileId;
+            definitionLine = statement->line;
+            properties.setFlag(StatementProperty::spHasDefinition,false);
+        }
+        out<<(qint32)(parent?statementIds.value(parent.get(),-1):-1)
+           <<statement->type<<statement->command<<statement->args<<statement->value
+           <<statement->noNameArgs<<statement->fullName
+           <<(qint32)statement->kind<<(qint32)statement->scope<<(qint32)statement->classScope
+           <<(qint32)fileId<<(qint32)statement->line
+           <<(qint32)definitionFileId<<(qint32)definitionLine<<(qint32)properties
+           <<statement->friends<<statement->usingList;
+    }
+
+    foreach (const QString& header, headerList) {
+        PFileIncludes fileIncludes = mPreprocessor.includesList().value(header);
+        QList<QString> statementKeys;
+        QList<qint32> statementRefs;
+        for (auto it=fileIncludes->statements.begin();it!=fileIncludes->statements.end();++it) {
+            int id = statementIds.value(it.value().get(),-1);
+            if (id>=0) {
+                statementKeys.append(it.key());
+                statementRefs.append(id);
             }
-        } else if (currentScope->kind == StatementKind::skClass) {
-            mIndex=indexOfNextSemicolon(mIndex);
         }
+        QList<qint32> scopeLines;
+        QList<qint32> scopeRefs;
+        foreach (const PCppScope& scope, fileIncludes->scopes.scopes()) {
+            scopeLines.append(scope->startLine);
+            scopeRefs.append(scope->statement?statementIds.value(scope->statement.get(),-1):-1);
+        }
+        out<<fileIncludes->includeFiles<<fileIncludes->directIncludes<<fileIncludes->usings
+           <<statementKeys<<statementRefs<<scopeLines<<scopeRefs;
     }
-    mCurrentScope.pop_back();
-    mCurrentClassScope.pop_back();
 
-    // Set new scope
-    currentScope = getCurrentScope();
-  //  fileIncludes:=FindFileIncludes(fCurrentFile);
-    if (fileIncludes && fileIncludes->scopes.lastScope()!=currentScope) {
-        fileIncludes->scopes.addScope(line,currentScope);
+    foreach (const QString& header, headerList) {
+        PDefineMap defineMap = mPreprocessor.fileDefines().value(header);
+        if (!defineMap) {
+            out<<(qint32)0;
+            continue;
+        }
+        out<<(qint32)defineMap->count();
+        foreach (const PDefine& define, *defineMap) {
+            out<<define->name<<define->args<<define->value<<define->filename
+               <<define->hardCoded;
+        }
     }
+    out<<mInlineNamespaces;
+    if (out.status()==QDataStream::Ok)
+        file.commit();
+}
 
-    if (!currentScope) {
-        mClassScope = StatementClassScope::None;
-    } else {
-        mClassScope = mCurrentClassScope.back();
+void CppParser::checkSystemHeaderCache()
+{
+    if (mSystemHeaderCacheChecked)
+        return;
+    mSystemHeaderCacheChecked = true;
+    if (mSystemHeaderCacheFolder.isEmpty() || !mParseGlobalHeaders)
+        return;
+    // only a fresh parser can take the cache
+    if (!mPreprocessor.scannedFiles().isEmpty())
+        return;
+    mSystemHeaderCacheKey = systemHeaderCacheKey();
+    const QString& key = mSystemHeaderCacheKey;
+    PSystemHeaderSnapshot snapshot;
+    {
+        // share the snapshot with other parsers using the same compiler settings
+        QMutexLocker locker(&systemHeaderSnapshotsMutex);
+        snapshot = systemHeaderSnapshots.value(key).lock();
+        if (snapshot && !isSystemHeaderSnapshotUpToDate(snapshot))
+            snapshot.reset();
+        if (!snapshot) {
+            snapshot = loadSystemHeaderSnapshot(key);
+            if (snapshot)
+                systemHeaderSnapshots.insert(key,snapshot);
+            else
+                systemHeaderSnapshots.remove(key);
+        }
+    }
+    if (snapshot) {
+        lockForParsing();
+        installSystemHeaderSnapshot(snapshot);
+        unlockForParsing();
     }
 }
 
-void CppParser::internalClear()
+void CppParser::updateSystemHeaderCache()
 {
-    mCurrentScope.clear();
-    mCurrentClassScope.clear();
-    mIndex = 0;
-    mClassScope = StatementClassScope::None;
-    mBlockBeginSkips.clear();
-    mBlockEndSkips.clear();
-    mInlineNamespaceEndSkips.clear();
+    if (mSystemHeaderCacheFolder.isEmpty() || !mParseGlobalHeaders)
+        return;
+    // the parse is stopped by resetParser(), headers may be partly parsed
+    if (resetPending())
+        return;
+    QSet<QString> headers = systemHeadersToCache();
+    // only save when new system headers are parsed
+    if (headers.count()<=mSystemHeaderCacheFileCount)
+        return;
+    saveSystemHeaderCache(headers);
+    mSystemHeaderCacheFileCount = headers.count();
 }
 
 QStringList CppParser::sortFilesByIncludeRelations(const QSet<QString> &files)
 {
     QStringList result;
-    QSet<QString> saveScannedFiles;
-
-    saveScannedFiles=mPreprocessor.scannedFiles();
+    QHash<QString,QSet<QString>> includeRelations;
+    QStringList filesToScan;
 
-    //rebuild file include relations
     foreach(const QString& file, files) {
-        if (mPreprocessor.scannedFiles().contains(file))
-            continue;
-        //already removed in interalInvalidateFiles
-        //mPreprocessor.removeScannedFile(file);
-        QStringList buffer;
-        if (mOnGetFileStream) {
-            mOnGetFileStream(file,buffer);
+        if (mPreprocessor.scannedFiles().contains(file)) {
+            includeRelations.insert(file,fileIncludeSet(file));
+        } else {
+            filesToScan.append(file);
         }
-        //we only use local include relations
-        mPreprocessor.setScanOptions(false, true);
-        mPreprocessor.preprocess(file,buffer);
-        mPreprocessor.clearTempResults();
     }
 
-    QSet<QString> fileSet=files;
-    while (!fileSet.isEmpty()) {
-        bool found=false;
-        foreach (const QString& file,fileSet) {
-            PFileIncludes fileIncludes = mPreprocessor.includesList().value(file);
-            bool hasInclude=false;
-            foreach(const QString& inc,fileIncludes->includeFiles.keys()) {
-                if (fileSet.contains(inc)) {
-                    hasInclude=true;
-                    break;
-                }
-            }
-            if (!hasInclude) {
-                result.push_front(file);
-                fileSet.remove(file);
-                found=true;
-                break;
+    //rebuild file include relations
+    if (!filesToScan.isEmpty())
+        scanIncludeRelations(filesToScan, workerCountFor(filesToScan.count()), includeRelations);
+
+    // files that include other files in the set are put before them
+    QHash<QString,int> includeCounts; // count of included files in the set
+    QHash<QString,QStringList> includedBy;
+    foreach (const QString& file, files) {
+        int count = 0;
+        foreach (const QString& inc, includeRelations.value(file)) {
+            if (files.contains(inc)) {
+                count++;
+                includedBy[inc].append(file);
             }
         }
-        if (!found) {
+        includeCounts.insert(file,count);
+    }
+    QQueue<QString> queue;
+    foreach (const QString& file, files) {
+        if (includeCounts.value(file)==0)
+            queue.enqueue(file);
+    }
+    QSet<QString> fileSet=files;
+    while (!fileSet.isEmpty()) {
+        if (queue.isEmpty()) {
+            // files including each other
             foreach (const QString& file,fileSet) {
                 result.push_front(file);
-                fileSet.remove(file);
             }
+            break;
+        }
+        QString file = queue.dequeue();
+        result.push_front(file);
+        fileSet.remove(file);
+        foreach (const QString& includer, includedBy.value(file)) {
+            if (--includeCounts[includer]==0)
+                queue.enqueue(includer);
         }
     }
-    QSet<QString> newScannedFiles = mPreprocessor.scannedFiles();
-    foreach(const QString& file, newScannedFiles) {
-        if (!saveScannedFiles.contains(file))
-            mPreprocessor.removeScannedFile(file);
+    return result;
+}
+
+QSet<QString> CppParser::fileIncludeSet(const QString &fileName)
+{
+    QSet<QString> result;
+    PFileIncludes fileIncludes = mPreprocessor.includesList().value(fileName);
+    if (fileIncludes) {
+        foreach(const QString& inc,fileIncludes->includeFiles.keys()) {
+            result.insert(inc);
+        }
     }
     return result;
 }
 
+void CppParser::scanIncludeRelations(const QStringList &files, int workerCount,
+                                     QHash<QString, QSet<QString> > &includeRelations)
+{
+    // Workers only share the options, never the parse results of mPreprocessor
+    CppPreprocessor options;
+    {
+        QMutexLocker locker(&mMutex);
+        options.copyOptionsFrom(mPreprocessor);
+    }
+    //we only use local include relations
+    options.setScanOptions(false, true);
+
+    CppParseWorkers workers(mOnGetFileStream);
+    QVector<QSet<QString>> results(files.count());
+    QVector<bool> scanned(files.count(),false);
+    int nextIndex = 0;
+    QThreadPool pool;
+    pool.setMaxThreadCount(workerCount);
+    for (int i=0;i<workerCount;i++) {
+        pool.start(new CppIncludeRelationScanner(
+                       workers,options,files,
+                       results,scanned,nextIndex));
+    }
+    // progress is reported here in the order of the file list
+    for (int i=0;i<files.count();i++) {
+        workers.waitUntil([&scanned,i]{
+            return scanned.at(i);
+        });
+        emit onProgress(files[i],files.count(),i+1);
+    }
+    pool.waitForDone();
+    // merge in the (sorted) order of the file list, so the result doesn't depend on scheduling
+    for (int i=0;i<files.count();i++) {
+        includeRelations.insert(files[i],results[i]);
+    }
+}
+
+int CppParser::workerCountFor(int fileCount) const
+{
+    int workerCount = (mParseWorkerCount>0)?mParseWorkerCount:QThread::idealThreadCount();
+    return std::max(1, std::min(workerCount, fileCount));
+}
+
+void CppParser::parseFiles(const QStringList &files)
+{
+    int workerCount = workerCountFor(files.count());
+    if (workerCount>1) {
+        parseFilesInParallel(files, workerCount);
+        return;
+    }
+    foreach (const QString& file, files) {
+        if (resetPending())
+            return;
+        mFilesScannedCount++;
+        emit onProgress(file,mFilesToScanCount,mFilesScannedCount);
+        if (!mPreprocessor.scannedFiles().contains(file)) {
+            internalParse(file);
+        }
+    }
+}
+
+void CppParser::parseFilesInParallel(const QStringList &files, int workerCount)
+{
+    CppPreprocessor preprocessor;
+    {
+        QMutexLocker locker(&mMutex);
+        preprocessor.copyOptionsFrom(mPreprocessor);
+        preprocessor.copyResultsFrom(mPreprocessor);
+    }
+    preprocessor.setScanOptions(mParseGlobalHeaders, mParseLocalHeaders);
+
+    CppParseWorkers workers(mOnGetFileStream);
+    QVector<PCppPreprocessedFile> results(files.count());
+    int nextIndex = 0;
+    int mergedCount = 0;
+    QThreadPool pool;
+    pool.setMaxThreadCount(workerCount);
+    for (int i=0;i<workerCount;i++) {
+        workers.addWorker();
+        pool.start(new CppFilePreprocessor(
+                       workers,preprocessor,files,
+                       results,nextIndex,mergedCount,
+                       PARSE_WORKER_FILES_AHEAD*workerCount));
+    }
+    // statements are added in the order of the file list, so they don't depend on scheduling
+    for (int i=0;i<files.count();i++) {
+        if (resetPending())
+            break;
+        const QString& file = files[i];
+        workers.waitUntil([&results,i]{
+            return results.at(i)!=nullptr;
+        });
+        PCppPreprocessedFile result;
+        {
+            QMutexLocker locker(&workers.mutex());
+            result = results.at(i);
+            results[i].reset();
+            mergedCount = i+1;
+            workers.wakeAll();
+        }
+        mFilesScannedCount++;
+        emit onProgress(file,mFilesToScanCount,mFilesScannedCount);
+        if (mPreprocessor.scannedFiles().contains(file))
+            continue;
+        // headers scanned by the files before it are already parsed
+        QSet<QString> parsedHeaders;
+        foreach (const QString& scannedFile, result->includes.keys()) {
+            if (mPreprocessor.scannedFiles().contains(scannedFile))
+                parsedHeaders.insert(scannedFile);
+        }
+        if (!result->preprocessed || !result->tokenizer.removeTokensOfFiles(parsedHeaders)) {
+            // the worker has scanned it as a header, or its tokens can't be split by files
+            internalParse(file);
+            continue;
+        }
+        lockForParsing();
+        for (auto it=result->includes.begin();it!=result->includes.end();++it) {
+            if (parsedHeaders.contains(it.key()))
+                continue;
+            mPreprocessor.addFileIncludes(it.value());
+            PDefineMap defines = result->fileDefines.value(it.key());
+            if (defines)
+                mPreprocessor.fileDefines().insert(it.key(),defines);
+            else
+                mPreprocessor.fileDefines().remove(it.key());
+            mPreprocessor.scannedFiles().insert(it.key());
+        }
+        unlockForParsing();
+        mTokenizer = std::move(result->tokenizer);
+        result.reset();
+        handleStatements([&workers]{
+            workers.serveFileStreamRequests();
+        });
+    }
+    {
+        // workers don't take more files if the parse is stopped
+        QMutexLocker locker(&workers.mutex());
+        nextIndex = files.count();
+        workers.wakeAll();
+    }
+    workers.waitForWorkers();
+}
+
 bool CppParser::checkForKeyword(KeywordType& keywordType)
 {
     keywordType = mCppKeywords.value(mTokenizer[mIndex]->text,KeywordType::NotKeyword);
@@ -2130,7 +3434,7 @@ PStatement CppParser::getIncompleteClass(const QString &command, const PStatemen
     if (p>=0) {
         s.truncate(p);
     }
-    PStatement result = findStatementOf(mCurrentFile,s,parentScope,true);
+    PStatement result = findStatementOf(mCurrentFile,s,parentScope);
     if (result && result->kind!=StatementKind::skClass)
         return PStatement();
     return result;
@@ -3791,7 +5095,7 @@ void CppParser::handleVar(const QString& typePrefix,bool isExtern,bool isStatic)
     mIndex++;
 }
 
-void CppParser::internalParse(const QString &fileName)
+void CppParser::internalParse(const QString &fileName, QStringList buffer)
 {
     // Perform some validation before we start
     if (!mEnabled)
@@ -3799,58 +5103,242 @@ void CppParser::internalParse(const QString &fileName)
 //    if (!isCfile(fileName) && !isHfile(fileName))  // support only known C/C++ files
 //        return;
 
-    QStringList buffer;
-    if (mOnGetFileStream) {
+    if (buffer.isEmpty() && mOnGetFileStream) {
         mOnGetFileStream(fileName,buffer);
     }
 
     // Preprocess the file...
     {
-        auto action = finally([this]{
-            mTokenizer.clear();
-        });
         // Let the preprocessor augment the include records
 //        mPreprocessor.setIncludesList(mIncludesList);
 //        mPreprocessor.setScannedFileList(mScannedFiles);
 //        mPreprocessor.setIncludePaths(mIncludePaths);
 //        mPreprocessor.setProjectIncludePaths(mProjectIncludePaths);
-        mPreprocessor.setScanOptions(mParseGlobalHeaders, mParseLocalHeaders);
-        mPreprocessor.preprocess(fileName, buffer);
+        // preprocess in a copy, options may be changed while it's running
+        CppPreprocessor preprocessor;
+        {
+            QMutexLocker locker(&mMutex);
+            preprocessor.copyOptionsFrom(mPreprocessor);
+            preprocessor.copyResultsFrom(mPreprocessor);
+        }
+        preprocessor.setScanOptions(mParseGlobalHeaders, mParseLocalHeaders);
+        preprocessor.preprocess(fileName, buffer);
 
-        QStringList preprocessResult = mPreprocessor.result();
+        QStringList preprocessResult = preprocessor.result();
 #ifdef QT_DEBUG
-//        stringsToFile(mPreprocessor.result(),QString("r:\\preprocess-%1.txt").arg(extractFileName(fileName)));
-//        mPreprocessor.dumpDefinesTo("r:\\defines.txt");
-//        mPreprocessor.dumpIncludesListTo("r:\\includes.txt");
+//        stringsToFile(preprocessor.result(),QString("r:\\preprocess-%1.txt").arg(extractFileName(fileName)));
+//        preprocessor.dumpDefinesTo("r:\\defines.txt");
+//        preprocessor.dumpIncludesListTo("r:\\includes.txt");
 #endif
         //reduce memory usage
-        mPreprocessor.clearTempResults();
+        preprocessor.clearTempResults();
+        lockForParsing();
+        mPreprocessor.copyResultsFrom(preprocessor);
+        unlockForParsing();
 
         // Tokenize the preprocessed buffer file
         mTokenizer.tokenize(preprocessResult);
         //reduce memory usage
         preprocessResult.clear();
-        if (mTokenizer.tokenCount() == 0)
-            return;
 #ifdef QT_DEBUG
 //        mTokenizer.dumpTokens(QString("r:\\tokens-%1.txt").arg(extractFileName(fileName)));
 #endif
-#ifdef QT_DEBUG
-        lastIndex = -1;
-#endif
-        // Process the token list
-        while(true) {
-            if (!handleStatement())
-                break;
-        }
+        handleStatements();
 #ifdef QT_DEBUG
 //        mStatementList.dumpAll(QString("r:\\all-stats-%1.txt").arg(extractFileName(fileName)));
 //        mStatementList.dump(QString("r:\\stats-%1.txt").arg(extractFileName(fileName)));
 #endif
-        //reduce memory usage
+    }
+}
+
+void CppParser::handleStatements(const std::function<void ()> &onStatementHandled)
+{
+    auto action = finally([this]{
+        mTokenizer.clear();
+    });
+    if (mTokenizer.tokenCount() == 0)
+        return;
+#ifdef QT_DEBUG
+    lastIndex = -1;
+#endif
+    // Process the token list
+    while(true) {
+        // resetParser() drops the statements anyway
+        if (resetPending())
+            break;
+        lockForParsing();
+        bool finished = !handleStatement();
+        unlockForParsing();
+        if (finished)
+            break;
+        if (onStatementHandled)
+            onStatementHandled();
+    }
+    //reduce memory usage
+    internalClear();
+}
+
+static void collectChildStatements(const StatementModel& statementList,
+                                   const PStatement& statement, QSet<Statement*>& statements)
+{
+    foreach (const PStatement& child, statementList.childrenStatements(statement)) {
+        statements.insert(child.get());
+        collectChildStatements(statementList, child, statements);
+    }
+}
+
+QVector<uint> CppParser::bufferLineHashes(const QStringList &buffer)
+{
+    QVector<uint> hashes;
+    hashes.reserve(buffer.count());
+    foreach (const QString& line, buffer)
+        hashes.append(qHash(line));
+    return hashes;
+}
+
+bool CppParser::reparseFunctionBody(const QString &fileName, const QStringList &buffer,
+                                    const QVector<uint> &lineHashes,
+                                    int &reparsedStartLine, int &reparsedEndLine)
+{
+    QVector<uint> oldHashes = mParsedLineHashes.value(fileName);
+    if (buffer.isEmpty() || oldHashes.isEmpty())
+        return false;
+    PFileIncludes fileIncludes = mPreprocessor.includesList().value(fileName);
+    if (!fileIncludes || !mPreprocessor.scannedFiles().contains(fileName))
+        return false;
+
+    // find the changed lines (1-based, in the old buffer)
+    int minCount = std::min(oldHashes.count(),lineHashes.count());
+    int prefix = 0;
+    while (prefix<minCount && oldHashes[prefix]==lineHashes[prefix])
+        prefix++;
+    // nothing changed, the caller wants a full reparse
+    if (prefix == oldHashes.count() && prefix == lineHashes.count())
+        return false;
+    int suffix = 0;
+    while (suffix<minCount-prefix
+           && oldHashes[oldHashes.count()-1-suffix]==lineHashes[lineHashes.count()-1-suffix])
+        suffix++;
+    int firstLine = prefix+1;
+    int lastLine = oldHashes.count()-suffix; // less than firstLine if lines are only inserted
+    int lineDelta = lineHashes.count() - oldHashes.count();
+
+    // the changed lines must be in the body of a function
+    PStatement functionStatement = fileIncludes->scopes.findScopeAtLine(firstLine);
+    while (functionStatement && functionStatement->kind == StatementKind::skBlock)
+        functionStatement = functionStatement->parentScope.lock();
+    if (!functionStatement)
+        return false;
+    if (functionStatement->kind != StatementKind::skFunction
+            && functionStatement->kind != StatementKind::skConstructor
+            && functionStatement->kind != StatementKind::skDestructor)
+        return false;
+    const QVector<PCppScope>& scopes = fileIncludes->scopes.scopes();
+    int startIndex = -1;
+    int endIndex = -1;
+    for (int i=0;i<scopes.count();i++) {
+        PStatement statement = scopes[i]->statement;
+        while (statement && statement->kind == StatementKind::skBlock)
+            statement = statement->parentScope.lock();
+        if (statement == functionStatement) {
+            if (startIndex<0)
+                startIndex = i;
+        } else if (startIndex>=0) {
+            endIndex = i;
+            break;
+        }
+    }
+    if (startIndex<0 || endIndex<0)
+        return false;
+    int startLine = scopes[startIndex]->startLine;
+    int endLine = scopes[endIndex]->startLine; // line of the closing '}'
+    if (startLine >= firstLine || lastLine >= endLine)
+        return false;
+    if (endLine + lineDelta > buffer.count())
+        return false;
+
+    auto action = finally([this]{
+        mTokenizer.clear();
         internalClear();
+    });
+    mPreprocessor.setScanOptions(mParseGlobalHeaders, mParseLocalHeaders);
+    bool preprocessed = mPreprocessor.preprocessLines(fileName, buffer, startLine, endLine + lineDelta);
+    QStringList preprocessResult = mPreprocessor.result();
+    mPreprocessor.clearTempResults();
+    if (!preprocessed)
+        return false;
+    mTokenizer.tokenize(preprocessResult);
+    preprocessResult.clear();
+
+    // the function's body must end at the last token, and its '{' must not be changed
+    int bodyEnd = mTokenizer.tokenCount()-1;
+    if (bodyEnd < 1 || mTokenizer[bodyEnd]->text != "}")
+        return false;
+    int bodyStart = mTokenizer[bodyEnd]->matchIndex;
+    if (bodyStart < 1 || mTokenizer[bodyStart]->line >= firstLine)
+        return false;
+    // unmatched '{' are closed by the tokenizer at the end
+    if (mTokenizer[bodyEnd-1]->text == "}"
+            && mTokenizer[bodyEnd-1]->line == mTokenizer[bodyEnd]->line)
+        return false;
+
+    // remove old local statements, but keep parameters
+    QSet<Statement*> removedStatements;
+    foreach (const PStatement& child, mStatementList.childrenStatements(functionStatement).values()) {
+        if (child->kind == StatementKind::skParameter
+                || child->command == "this"
+                || child->command == "__func__")
+            continue;
+        removedStatements.insert(child.get());
+        collectChildStatements(mStatementList, child, removedStatements);
+        mStatementList.deleteStatement(child);
+    }
+    functionStatement->usingList.clear();
+    QSet<Statement*> movedStatements;
+    for (auto it = fileIncludes->statements.begin(); it!=fileIncludes->statements.end();) {
+        Statement* statement = it.value().get();
+        if (removedStatements.contains(statement)) {
+            it = fileIncludes->statements.erase(it);
+            continue;
+        }
+        // move statements after the function
+        if (!movedStatements.contains(statement)) {
+            movedStatements.insert(statement);
+            if (statement->fileName == fileName && statement->line >= endLine)
+                statement->line += lineDelta;
+            if (statement->definitionFileName == fileName && statement->definitionLine >= endLine)
+                statement->definitionLine += lineDelta;
+        }
+        ++it;
+    }
 
+    // handle tokens in the body
+    CppScopes oldScopes = fileIncludes->scopes;
+    fileIncludes->scopes.clear();
+    mCurrentFile = fileName;
+    mIsSystemHeader = isSystemHeaderFile(mCurrentFile) || isProjectHeaderFile(mCurrentFile);
+    mIsProjectFile = mProjectFiles.contains(mCurrentFile);
+    mIsHeader = isHFile(mCurrentFile);
+    addSoloScopeLevel(functionStatement, startLine);
+#ifdef QT_DEBUG
+    lastIndex = -1;
+#endif
+    mIndex = bodyStart+1;
+    while (mIndex < bodyEnd) {
+        if (!handleStatement())
+            break;
     }
+    CppScopes bodyScopes = fileIncludes->scopes;
+    fileIncludes->scopes = oldScopes;
+    // statements in the file are changed, it should be fully reparsed
+    if (mIndex != bodyEnd || mCurrentScope.count()!=1)
+        return false;
+
+    fileIncludes->scopes.replaceScopes(startIndex+1, endIndex,
+                                       bodyScopes.scopes().mid(1), lineDelta);
+    reparsedStartLine = startLine;
+    reparsedEndLine = endLine + lineDelta;
+    return true;
 }
 
 void CppParser::inheritClassStatement(const PStatement& derived, bool isStruct,
@@ -3863,7 +5351,7 @@ void CppParser::inheritClassStatement(const PStatement& derived, bool isStruct,
         else
             access = StatementClassScope::Private;
     }
-    foreach (const PStatement& statement, base->children) {
+    foreach (const PStatement& statement, mStatementList.childrenStatements(base)) {
         if (statement->classScope == StatementClassScope::Private
                 || statement->kind == StatementKind::skConstructor
                 || statement->kind == StatementKind::skDestructor)
@@ -3891,7 +5379,7 @@ void CppParser::fillListOfFunctions(const QString& fileName, int line,
                                     const PStatement& statement,
                                     const PStatement& scopeStatement, QStringList &list)
 {
-    StatementMap children = mStatementList.childrenStatements(scopeStatement);
+    const StatementMap& children = mStatementList.childrenStatements(scopeStatement);
     for (const PStatement& child:children) {
         if ((statement->command == child->command)
 #ifdef Q_OS_WIN
@@ -3909,7 +5397,7 @@ void CppParser::fillListOfFunctions(const QString& fileName, int line,
 QList<PStatement> CppParser::getListOfFunctions(const QString &fileName, int line, const PStatement &statement, const PStatement &scopeStatement)
 {
     QList<PStatement> result;
-    StatementMap children = mStatementList.childrenStatements(scopeStatement);
+    const StatementMap& children = mStatementList.childrenStatements(scopeStatement);
     for (const PStatement& child:children) {
         if (( (statement->command == child->command)
 #ifdef Q_OS_WIN
@@ -3950,6 +5438,25 @@ PStatement CppParser::findMemberOfStatement(const QString &phrase,
     return statementMap.value(s,PStatement());
 }
 
+void CppParser::addVisibleScopeMembers(QList<PStatement> &list, QSet<QString> &addedNames, const PStatement &scopeStatement, const QString &fileName, int line)
+{
+    const StatementMap& children = mStatementList.childrenStatements(scopeStatement);
+    for (const PStatement& child:children) {
+        // they are not completed by name, so they shouldn't hide outer statements
+        if (child->kind == StatementKind::skBlock
+                || child->kind == StatementKind::skConstructor
+                || child->kind == StatementKind::skDestructor)
+            continue;
+        if (addedNames.contains(child->command))
+            continue;
+        // not declared yet
+        if (line!=-1 && line < child->line && child->fileName == fileName)
+            continue;
+        addedNames.insert(child->command);
+        list.append(child);
+    }
+}
+
 QList<PStatement> CppParser::findMembersOfStatement(const QString &phrase, const PStatement &scopeStatement)
 {
     const StatementMap& statementMap =mStatementList.childrenStatements(scopeStatement);
@@ -4819,7 +6326,7 @@ PStatement CppParser::doParseEvalTypeInfo(
         }
         position--;
     }
-    typeStatement = findStatementOf(fileName,baseType,scope,true);
+    typeStatement = findStatementOf(fileName,baseType,scope);
     return getTypeDef(typeStatement,fileName,baseType);
 }
 
@@ -4861,6 +6368,8 @@ void CppParser::internalInvalidateFile(const QString &fileName)
 {
     if (fileName.isEmpty())
         return;
+    if (isSharedFile(fileName))
+        return;
 
     // remove its include files list
     PFileIncludes p = findFileIncludes(fileName, true);
@@ -4897,6 +6406,7 @@ void CppParser::internalInvalidateFile(const QString &fileName)
 
     // delete it from scannedfiles
     mPreprocessor.removeScannedFile(fileName);
+    mParsedLineHashes.remove(fileName);
 }
 
 void CppParser::internalInvalidateFiles(const QSet<QString> &files)
@@ -4911,11 +6421,9 @@ QSet<QString> CppParser::calculateFilesToBeReparsed(const QString &fileName)
         return QSet<QString>();
     QSet<QString> result;
     result.insert(fileName);
-    foreach (const QString& file, mProjectFiles) {
-        PFileIncludes fileIncludes = mPreprocessor.includesList().value(file,PFileIncludes());
-        if (fileIncludes && fileIncludes->includeFiles.contains(fileName)) {
+    foreach (const QString& file, mPreprocessor.includedBy(fileName)) {
+        if (mProjectFiles.contains(file))
             result.insert(file);
-        }
     }
     return result;
 }
@@ -4979,7 +6487,7 @@ void CppParser::scanMethodArgs(const PStatement& functionStatement, int argStart
                 if (!cmd.startsWith('*')
                         && !cmd.startsWith('&')
                         && !cmd.endsWith(']')) {
-                    PStatement statement=findStatementOf(mCurrentFile,cmd,functionStatement,true);
+                    PStatement statement=findStatementOf(mCurrentFile,cmd,functionStatement);
                     noCmd = (statement && isTypeStatement(statement->kind));
                     if (!noCmd) {
                         QString args,suffix;
@@ -5188,7 +6696,7 @@ bool CppParser::isNotFuncArgs(int startIndex)
                 if (isCppKeyword(currentText))
                     return false;
 
-                PStatement statement =findStatementOf(mCurrentFile,word,getCurrentScope(),true);
+                PStatement statement =findStatementOf(mCurrentFile,word,getCurrentScope());
                 if (statement && isTypeStatement(statement->kind))
                     return false;
             } else {
@@ -5230,6 +6738,9 @@ bool CppParser::isTypeStatement(StatementKind kind) const
 
 void CppParser::updateSerialId()
 {
+    // serialId() is read by the gui thread without locking mMutex
+    QMutexLocker locker(&mStateMutex);
+    mSerialCount++;
     mSerialId = QString("%1 %2").arg(mParserId).arg(mSerialCount);
 }
 
@@ -5531,6 +7042,9 @@ const QSet<QString> &CppParser::projectFiles() const
 
 QList<QString> CppParser::namespaces()
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->namespaces();
     QMutexLocker locker(&mMutex);
     return mNamespaces.keys();
 }
@@ -5549,6 +7063,10 @@ void CppParser::setLanguage(ParserLanguage newLanguage)
 
 const StatementModel &CppParser::statementList() const
 {
+    // old snapshots are released in the gui thread's event loop, see endParsing()
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->mStatementList;
     return mStatementList;
 }
 
@@ -5582,11 +7100,29 @@ void CppParser::setParseLocalHeaders(bool newParseLocalHeaders)
     mParseLocalHeaders = newParseLocalHeaders;
 }
 
-const QString &CppParser::serialId() const
+QString CppParser::serialId() const
 {
+    PCppParser snapshot = readSnapshot();
+    if (snapshot)
+        return snapshot->mSerialId;
+    QMutexLocker locker(&mStateMutex);
     return mSerialId;
 }
 
+bool CppParser::findReparsedBody(const QString &fromSerialId, const QString &toSerialId,
+                                 QString &fileName, int &startLine, int &endLine) const
+{
+    QMutexLocker locker(&mStateMutex);
+    if (mReparsedBodyFile.isEmpty()
+            || fromSerialId != mReparsedBodyFromSerialId
+            || toSerialId != mReparsedBodyToSerialId)
+        return false;
+    fileName = mReparsedBodyFile;
+    startLine = mReparsedBodyStartLine;
+    endLine = mReparsedBodyEndLine;
+    return true;
+}
+
 int CppParser::parserId() const
 {
     return mParserId;
@@ -5608,6 +7144,26 @@ void CppParser::setFilesToScan(const QSet<QString> &newFilesToScan)
     mFilesToScan = newFilesToScan;
 }
 
+int CppParser::parseWorkerCount() const
+{
+    return mParseWorkerCount;
+}
+
+void CppParser::setParseWorkerCount(int newWorkerCount)
+{
+    mParseWorkerCount = newWorkerCount;
+}
+
+void CppParser::setSystemHeaderCache(const QString &cacheFolder, const QString &compilerSetId)
+{
+    QMutexLocker locker(&mMutex);
+    mSystemHeaderCacheFolder = cacheFolder;
+    mCompilerSetId = compilerSetId;
+    mSystemHeaderCacheChecked = false;
+    mSystemHeaderCacheFileCount = 0;
+    mSystemHeaderCacheKey.clear();
+}
+
 bool CppParser::enabled() const
 {
     return mEnabled;
@@ -5642,7 +7198,8 @@ CppFileParserThread::CppFileParserThread(
 
 void CppFileParserThread::run()
 {
-    if (mParser && !mParser->parsing()) {
+    // the parser decides whether to wait for the running parse
+    if (mParser) {
         mParser->parseFile(mFileName,mInProject,mOnlyIfNotParsed,mUpdateView);
     }
 }
@@ -5659,11 +7216,29 @@ CppFileListParserThread::CppFileListParserThread(PCppParser parser,
 
 void CppFileListParserThread::run()
 {
-    if (mParser && !mParser->parsing()) {
+    // the parser decides whether to wait for the running parse
+    if (mParser) {
         mParser->parseFileList(mUpdateView);
     }
 }
 
+CppHeadersPrefetchThread::CppHeadersPrefetchThread(PCppParser parser,
+                                                   const QStringList &headers, QObject *parent):
+    QThread(parent),
+    mParser(parser),
+    mHeaders(headers)
+{
+    connect(this,&QThread::finished,
+            this,&QObject::deleteLater);
+}
+
+void CppHeadersPrefetchThread::run()
+{
+    if (mParser) {
+        mParser->prefetchHeaders(mHeaders);
+    }
+}
+
 void parseFile(PCppParser parser, const QString& fileName, bool inProject, bool onlyIfNotParsed, bool updateView)
 {
     if (!parser)
@@ -5679,6 +7254,17 @@ void parseFile(PCppParser parser, const QString& fileName, bool inProject, bool
     thread->start();
 }
 
+void prefetchHeaders(PCppParser parser, const QStringList &headers)
+{
+    if (!parser)
+        return;
+    if (!parser->enabled())
+        return;
+    //delete when finished
+    CppHeadersPrefetchThread *thread = new CppHeadersPrefetchThread(parser,headers);
+    thread->start();
+}
+
 void parseFileList(PCppParser parser, bool updateView)
 {
     if (!parser)
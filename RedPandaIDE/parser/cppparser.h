@@ -21,10 +21,30 @@
 #include <QObject>
 #include <QThread>
 #include <QVector>
+#include <QWaitCondition>
 #include "statementmodel.h"
 #include "cpptokenizer.h"
 #include "cpppreprocessor.h"
 
+/**
+ * @brief Parse results of system headers loaded from the cache
+ *
+ * It's shared by all parsers using the same compiler settings, and must not be
+ * changed after it's created. Parsers add their own statements on top of it.
+ */
+struct SystemHeaderSnapshot {
+    QString key;
+    StatementMap globalStatements;
+    int statementCount;
+    QHash<QString,PFileIncludes> includesList;
+    QHash<QString,qint64> modifiedTimes; // last modified times of the headers
+    QHash<QString,PDefineMap> fileDefines;
+    QHash<QString,PStatementList> namespaces;
+    QSet<QString> inlineNamespaces;
+    int uniqId;
+};
+using PSystemHeaderSnapshot = std::shared_ptr<const SystemHeaderSnapshot>;
+
 class CppParser : public QObject
 {
     Q_OBJECT
@@ -45,6 +65,15 @@ public:
                              const QString& phrase,
                              int line);
     PStatement findScopeStatement(const QString& filename, int line);
+    /**
+     * @brief list the statements visible at the line by their names, inner scopes first
+     *
+     * Members of the scopes enclosing the line and of the namespaces used in those
+     * scopes are listed; a member hides the ones with the same name in outer scopes.
+     * Global statements and members of the namespaces used by the file are not listed,
+     * use StatementModel::findNames() and getFileUsings() for them.
+     */
+    QList<PStatement> listVisibleScopeMembers(const QString& filename, int line);
     PFileIncludes findFileIncludes(const QString &filename, bool deleteIt = false);
     QString findFirstTemplateParamOf(const QString& fileName,
                                      const QString& phrase,
@@ -60,12 +89,10 @@ public:
     PStatement findStatementOf(const QString& fileName,
                                const QString& phrase,
                                const PStatement& currentScope,
-                               PStatement& parentScopeType,
-                               bool force = false);
+                               PStatement& parentScopeType);
     PStatement findStatementOf(const QString& fileName,
                                const QString& phrase,
-                               const PStatement& currentClass,
-                               bool force = false);
+                               const PStatement& currentClass);
 
     PStatement findStatementOf(const QString& fileName,
                                const QStringList& expression,
@@ -90,8 +117,16 @@ public:
                                     const PStatement& currentClass);
     PStatement findTypeDef(const PStatement& statement,
                           const QString& fileName);
-    bool freeze();  // Freeze/Lock (stop reparse while searching)
-    bool freeze(const QString& serialId);  // Freeze/Lock (stop reparse while searching)
+    /**
+     * @brief keep reading the current snapshot until unFreeze(), so lookups in a batch see the same database
+     *
+     * Parses are not paused, lookups see their results after all freezes end.
+     */
+    bool freeze();
+    /**
+     * @brief freeze if the current snapshot has the serial id
+     */
+    bool freeze(const QString& serialId);
     QStringList getClassesList();
     QStringList getFileDirectIncludes(const QString& filename);
     QSet<QString> getFileIncludes(const QString& filename);
@@ -107,10 +142,23 @@ public:
     void parseFile(const QString& fileName, bool inProject,
                    bool onlyIfNotParsed = false, bool updateView = true);
     void parseFileList(bool updateView = true);
+    /**
+     * @brief parse the headers that are not parsed yet, without reparsing the files including them
+     *
+     * Used to parse the headers of newly typed #include lines before the including file is reparsed.
+     * Parses started while the headers are parsed wait for them instead of being dropped.
+     */
+    void prefetchHeaders(const QStringList& headers);
     void parseHardDefines();
     bool parsing() const;
+    bool prefetchingHeaders() const;
+    /**
+     * @brief clear the options now, and the statement database when the running parse ends
+     *
+     * Doesn't wait for the running parse, it stops at the next statement.
+     */
     void resetParser();
-    void unFreeze(); // UnFree/UnLock (reparse while searching)
+    void unFreeze();
     QSet<QString> scannedFiles();
 
     bool isFileParsed(const QString& filename);
@@ -127,7 +175,19 @@ public:
 
     int parserId() const;
 
-    const QString &serialId() const;
+    /**
+     * @brief serial id of the snapshot lookups read
+     */
+    QString serialId() const;
+    /**
+     * @brief find the function body reparsed by the parse between the two databases
+     *
+     * Only local statements of the body are changed by such a parse,
+     * so kinds found outside it are still valid.
+     * @return false if the databases are changed in other ways
+     */
+    bool findReparsedBody(const QString& fromSerialId, const QString& toSerialId,
+                          QString& fileName, int& startLine, int& endLine) const;
 
     bool parseLocalHeaders() const;
     void setParseLocalHeaders(bool newParseLocalHeaders);
@@ -135,6 +195,23 @@ public:
     bool parseGlobalHeaders() const;
     void setParseGlobalHeaders(bool newParseGlobalHeaders);
 
+    /**
+     * @brief number of threads used to parse file lists
+     *
+     * Files are preprocessed and tokenized on worker threads, and their statements
+     * are added one file at a time in include order, so they don't depend on scheduling.
+     * 0 means QThread::idealThreadCount(), 1 parses the files in the parser's thread only.
+     */
+    int parseWorkerCount() const;
+    void setParseWorkerCount(int newWorkerCount);
+
+    /**
+     * @brief cache parse results of system headers on disk
+     * @param cacheFolder folder to save the cache files, empty to disable the cache
+     * @param compilerSetId identity of the compiler set the include paths and defines come from
+     */
+    void setSystemHeaderCache(const QString& cacheFolder, const QString& compilerSetId);
+
     const QSet<QString>& includePaths();
     const QSet<QString>& projectIncludePaths();
 
@@ -153,6 +230,8 @@ signals:
     void onStartParsing();
     void onEndParsing(int total, int updateView);
 private:
+    CppParser(QObject *parent, bool isSnapshot);
+
     PStatement addInheritedStatement(
             const PStatement& derived,
             const PStatement& inherit,
@@ -209,7 +288,54 @@ private:
 
     void internalClear();
 
+    bool startParsing(bool prefetchingHeaders = false);
+    void endParsing();
+    void lockForParsing();
+    void unlockForParsing();
+    /**
+     * @brief true if resetParser() is called after the running parse started, the parse should stop
+     */
+    bool resetPending() const;
+    void resetDatabase();
+    void addHardDefines();
+    /**
+     * @brief copy the statement database into a new parser, that is never changed
+     *
+     * Statements of the shared system header snapshot are not copied.
+     */
+    std::shared_ptr<CppParser> createSnapshot();
+    /**
+     * @brief the snapshot lookups of the current thread read, null in the parse thread
+     */
+    std::shared_ptr<CppParser> readSnapshot() const;
+    /**
+     * @brief release the snapshot in the gui thread's event loop, if called by another thread
+     *
+     * The gui thread may still use the statement model of the snapshot in the current event.
+     */
+    void releaseSnapshot(const std::shared_ptr<CppParser>& snapshot);
+
+    QString systemHeaderCacheKey();
+    QString systemHeaderCacheFileName(const QString& key);
+    QSet<QString> systemHeadersToCache();
+    PSystemHeaderSnapshot loadSystemHeaderSnapshot(const QString& key);
+    void installSystemHeaderSnapshot(const PSystemHeaderSnapshot& snapshot);
+    bool isSharedStatement(const PStatement& statement) const;
+    bool isSharedFile(const QString& fileName) const;
+    void saveSystemHeaderCache(const QSet<QString>& headers);
+    void checkSystemHeaderCache();
+    void updateSystemHeaderCache();
+
     QStringList sortFilesByIncludeRelations(const QSet<QString> &files);
+    QSet<QString> fileIncludeSet(const QString& fileName);
+    void scanIncludeRelations(const QStringList& files, int workerCount,
+                              QHash<QString,QSet<QString>>& includeRelations);
+    int workerCountFor(int fileCount) const;
+    /**
+     * @brief parse the files in the order of the list, and report the progress
+     */
+    void parseFiles(const QStringList& files);
+    void parseFilesInParallel(const QStringList& files, int workerCount);
 
     bool checkForKeyword(KeywordType &keywordType);
     bool checkForMethod(QString &sType, QString &sName, int &argStartIndex,
@@ -244,6 +370,11 @@ private:
             const PStatement& scopeStatement);
     QList<PStatement> findMembersOfStatement(const QString& phrase,
                                              const PStatement& scopeStatement);
+    void addVisibleScopeMembers(QList<PStatement>& list,
+                                QSet<QString>& addedNames,
+                                const PStatement& scopeStatement,
+                                const QString& fileName,
+                                int line);
     PStatement findStatementInScope(
             const QString& name,
             const QString& noNameArgs,
@@ -256,6 +387,13 @@ private:
             const QString& name,
             const QString& namespaceName);
 
+    PStatement doFindAliasedStatement(const PStatement& statement);
+    /**
+     * @brief clear the evaluation memos if they are from an older serial id
+     * @return false if the memos can't be used because the parser is running
+     */
+    bool prepareEvalCache();
+
     //{Find statement starting from startScope}
     PStatement findStatementStartingFrom(const QString& fileName,
                                          const QString& phrase,
@@ -452,7 +590,28 @@ private:
     void handleStructs(bool isTypedef = false);
     void handleUsing();
     void handleVar(const QString& typePrefix,bool isExtern,bool isStatic);
-    void internalParse(const QString& fileName);
+    void internalParse(const QString& fileName, QStringList buffer = QStringList());
+    /**
+     * @brief add the statements in mTokenizer, and clear it
+     * @param onStatementHandled called after each statement, without the parser locked
+     */
+    void handleStatements(const std::function<void()>& onStatementHandled = std::function<void()>());
+    /**
+     * @brief Reparse only the function body that contains all the changed lines of the file
+     *
+     * Changed lines are found by comparing hashes of the lines with the ones saved in the last parse.
+     * Local statements of the function are replaced, and other statements of the file are kept.
+     * @param fileName
+     * @param buffer current contents of the file
+     * @param lineHashes hashes of the lines of the buffer, see bufferLineHashes()
+     * @param reparsedStartLine first line of the reparsed body in the buffer
+     * @param reparsedEndLine last line of the reparsed body in the buffer
+     * @return false if the file must be fully reparsed, or nothing is changed
+     */
+    bool reparseFunctionBody(const QString& fileName, const QStringList& buffer,
+                             const QVector<uint>& lineHashes,
+                             int& reparsedStartLine, int& reparsedEndLine);
+    static QVector<uint> bufferLineHashes(const QStringList& buffer);
 //    function FindMacroDefine(const Command: AnsiString): PStatement;
     void inheritClassStatement(
             const PStatement& derived,
@@ -649,11 +808,42 @@ private:
     int mFilesToScanCount; // count of files and files included in files that have to be scanned
     bool mParseLocalHeaders;
     bool mParseGlobalHeaders;
+    int mParseWorkerCount;
+    QString mSystemHeaderCacheFolder;
+    QString mCompilerSetId;
+    bool mSystemHeaderCacheChecked;
+    int mSystemHeaderCacheFileCount; // count of headers in the loaded/saved cache
+    QString mSystemHeaderCacheKey; // includes a hash of the include paths' listing, empty if not computed
+    PSystemHeaderSnapshot mSystemHeaderSnapshot;
     bool mIsProjectFile;
-    int mLockCount; // lock(don't reparse) when we need to find statements in a batch
     bool mParsing;
+    QThread* mParseThread; // thread running the parse, null if not parsing
+    bool mDatabaseChanged; // the parse has changed the statement database, guarded by mMutex
+    bool mPrefetchingHeaders; // the running parse is prefetchHeaders()
+    // the function body reparsed by the last parse, guarded by mStateMutex
+    QString mReparsedBodyFile; // empty if the last parse is not a function body reparse
+    int mReparsedBodyStartLine;
+    int mReparsedBodyEndLine;
+    QString mReparsedBodyFromSerialId; // serial id of the database before the parse
+    QString mReparsedBodyToSerialId; // serial id of the database after the parse
+    // lookups read the last published snapshot, the parse never waits for them.
+    // guarded by mStateMutex
+    std::shared_ptr<CppParser> mSnapshot;
+    std::shared_ptr<CppParser> mFrozenSnapshot; // read until unFreeze()
+    int mFreezeCount;
+    int mResetRequests; // count of resetParser() calls
+    int mResetsDone; // count of the calls handled by resetting the database
+    bool mHardDefinesPending; // parseHardDefines() is called while a reset is pending
+    mutable QMutex mStateMutex; // guards mParsing, mParseThread, mPrefetchingHeaders, mSerialId and the snapshots
+    QWaitCondition mStateChanged;
     QHash<QString,PStatementList> mNamespaces;  // namespace and the statements in its scope
     QSet<QString> mInlineNamespaces;
+    QHash<QString,QVector<uint>> mParsedLineHashes; // hashes of the lines of files when they are parsed by parseFile()
+    // memos of evalExpression(), findTypeDefinitionOf() and findAliasedStatement()
+    QString mEvalCacheSerialId; // serial id of the statement database the memos are from
+    QHash<QString,PEvalStatement> mEvalExpressionCache;
+    QHash<QString,PStatement> mTypeDefinitionCache;
+    QHash<const Statement*,PStatement> mAliasedStatementCache;
 
 #if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
     QRecursiveMutex mMutex;
@@ -690,6 +880,21 @@ protected:
 };
 using PCppParserThread = std::shared_ptr<CppFileParserThread>;
 
+class CppHeadersPrefetchThread: public QThread {
+    Q_OBJECT
+public:
+    explicit CppHeadersPrefetchThread(
+            PCppParser parser,
+            const QStringList& headers,
+            QObject *parent = nullptr);
+private:
+    PCppParser mParser;
+    QStringList mHeaders;
+    // QThread interface
+protected:
+    void run() override;
+};
+
 class CppFileListParserThread: public QThread {
     Q_OBJECT
 public:
@@ -716,5 +921,9 @@ void parseFileList(
         PCppParser parser,
         bool updateView = true);
 
+void prefetchHeaders(
+        PCppParser parser,
+        const QStringList& headers);
+
 
 #endif // CPPPARSER_H
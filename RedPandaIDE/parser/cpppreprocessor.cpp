@@ -18,25 +18,55 @@
 #include "../utils.h"
 
 #include <QFile>
+#include <QFileInfo>
 #include <QTextCodec>
 #include <QDebug>
 #include <QMessageBox>
+#include <QCache>
+#include <QDateTime>
+#include <QMutex>
+
+struct HeaderText {
+    QDateTime modified;
+    qint64 size;
+    int generation; // cachedFileGeneration() when it's read, -1 if its directory is not watched
+    QStringList lines; // comments removed
+};
+
+// headers read from disk, shared by all preprocessors
+static QMutex headerTextCacheMutex;
+static QCache<QString,HeaderText> headerTextCache(MAX_HEADER_TEXT_CACHE_SIZE);
 
 CppPreprocessor::CppPreprocessor()
 {
+    mParseSystem = true;
+    mParseLocal = true;
+    mHeaderFileNamesGeneration = cachedFileGeneration();
+    mDefineLookups = nullptr;
+    mIfUsesFileSystem = false;
 }
 
 void CppPreprocessor::clear()
 {
     //don't use reset(), it will reset(add) defines.
     clearTempResults();
+    clearResults();
+    clearOptions();
+}
 
+void CppPreprocessor::clearResults()
+{
     //Result across processings.
     //used by parser even preprocess finished
     mIncludesList.clear();
+    mIncludedBy.clear();
     mFileDefines.clear(); //dictionary to save defines for each headerfile;
     mScannedFiles.clear();
+    mIfResults.clear();
+}
 
+void CppPreprocessor::clearOptions()
+{
     //option data for the parser
     //{ List of current project's include path }
     mHardDefines.clear(); // set by "cpp -dM -E -xc NUL"
@@ -46,6 +76,7 @@ void CppPreprocessor::clear()
     mProjectIncludePathList.clear();
     //{ List of current compiler set's include path}
     mIncludePaths.clear();
+    mHeaderFileNames.clear();
 }
 
 void CppPreprocessor::clearTempResults()
@@ -70,7 +101,7 @@ void CppPreprocessor::addDefineByParts(const QString &name, const QString &args,
     define->value = value;
     define->filename = mFileName;
     //define->argList;
-    define->formatValue = value;
+    define->variadic = false;
     define->hardCoded = hardCoded;
     if (!args.isEmpty())
         parseArgs(define);
@@ -151,7 +182,10 @@ void CppPreprocessor::addDefineByLine(const QString &line, bool hardCoded)
 
 PDefine CppPreprocessor::getDefine(const QString &name)
 {
-    return mDefines.value(name,PDefine());
+    PDefine define = mDefines.value(name,PDefine());
+    if (mDefineLookups)
+        mDefineLookups->append(qMakePair(name,define));
+    return define;
 }
 
 PDefine CppPreprocessor::getHardDefine(const QString &name)
@@ -177,6 +211,38 @@ void CppPreprocessor::preprocess(const QString &fileName, QStringList buffer)
     //    StringsToFile(mResult,"f:\\log.txt");
 }
 
+bool CppPreprocessor::preprocessLines(const QString &fileName, const QStringList &buffer, int startLine, int endLine)
+{
+    clearTempResults();
+    // comments may span lines, so remove them in the whole file
+    QStringList lines = removeComments(buffer).mid(startLine-1,endLine-startLine+1);
+    foreach (const QString& line, lines) {
+        if (line.startsWith('#'))
+            return false;
+    }
+    mFileName = fileName;
+    mDefines = mHardDefines;
+    if (mIncludesList.contains(fileName))
+        addDefinesInFile(fileName);
+
+    PParsedFile parsedFile = std::make_shared<ParsedFile>();
+    parsedFile->index = 0;
+    parsedFile->fileName = fileName;
+    parsedFile->branches = 0;
+    parsedFile->buffer = lines;
+    // use a dummy include record
+    parsedFile->fileIncludes = std::make_shared<FileIncludes>();
+    parsedFile->fileIncludes->baseFile = fileName;
+    mCurrentIncludes = parsedFile->fileIncludes;
+    mIncludes.append(parsedFile);
+
+    mIndex = 0;
+    mBuffer = parsedFile->buffer;
+    mResult.append(QString("#include %1:%2").arg(fileName).arg(startLine));
+    preprocessBuffer();
+    return true;
+}
+
 void CppPreprocessor::invalidDefinesInFile(const QString &fileName)
 {
     PDefineMap defineMap = mFileDefines.value(fileName,PDefineMap());
@@ -199,7 +265,7 @@ void CppPreprocessor::dumpDefinesTo(const QString &fileName) const
         for (const PDefine& define:mDefines) {
             stream<<QString("%1 %2 %3 %4 %5\n")
                     .arg(define->name,define->args,define->value)
-                    .arg(define->hardCoded).arg(define->formatValue)
+                    .arg(define->hardCoded).arg(define->argList.join(','))
 #if QT_VERSION >= QT_VERSION_CHECK(5,15,0)
                  <<Qt::endl;
 #else
@@ -287,6 +353,8 @@ void CppPreprocessor::addIncludePath(const QString &fileName)
     if (!mIncludePaths.contains(fileName)) {
         mIncludePaths.insert(fileName);
         mIncludePathList.append(fileName);
+        mHeaderFileNames.clear();
+        watchIncludeDirectory(fileName);
     }
 }
 
@@ -295,6 +363,8 @@ void CppPreprocessor::addProjectIncludePath(const QString &fileName)
     if (!mProjectIncludePaths.contains(fileName)) {
         mProjectIncludePaths.insert(fileName);
         mProjectIncludePathList.append(fileName);
+        mHeaderFileNames.clear();
+        watchIncludeDirectory(fileName);
     }
 }
 
@@ -302,21 +372,53 @@ void CppPreprocessor::clearIncludePaths()
 {
     mIncludePaths.clear();
     mIncludePathList.clear();
+    mHeaderFileNames.clear();
 }
 
 void CppPreprocessor::clearProjectIncludePaths()
 {
     mProjectIncludePaths.clear();
     mProjectIncludePathList.clear();
+    mHeaderFileNames.clear();
 }
 
 void CppPreprocessor::removeScannedFile(const QString &filename)
 {
     mScannedFiles.remove(filename);
-    mIncludesList.remove(filename);
+    removeFileIncludes(filename);
     mFileDefines.remove(filename);
 }
 
+void CppPreprocessor::addFileIncludes(const PFileIncludes &fileIncludes)
+{
+    removeFileIncludes(fileIncludes->baseFile);
+    mIncludesList.insert(fileIncludes->baseFile,fileIncludes);
+    foreach (const QString& file, fileIncludes->includeFiles.keys()) {
+        mIncludedBy[file].insert(fileIncludes->baseFile);
+    }
+}
+
+void CppPreprocessor::removeFileIncludes(const QString &fileName)
+{
+    PFileIncludes fileIncludes = mIncludesList.value(fileName);
+    if (!fileIncludes)
+        return;
+    foreach (const QString& file, fileIncludes->includeFiles.keys()) {
+        auto it = mIncludedBy.find(file);
+        if (it!=mIncludedBy.end()) {
+            it->remove(fileName);
+            if (it->isEmpty())
+                mIncludedBy.erase(it);
+        }
+    }
+    mIncludesList.remove(fileName);
+}
+
+QSet<QString> CppPreprocessor::includedBy(const QString &fileName) const
+{
+    return mIncludedBy.value(fileName);
+}
+
 QString CppPreprocessor::getNextPreprocessor()
 {
     skipToPreprocessor(); // skip until # at start of line
@@ -359,7 +461,7 @@ void CppPreprocessor::handleBranch(const QString &line)
         } else {
             constexpr int IFDEF_LEN = 5; //length of ifdef;
             QString name = line.mid(IFDEF_LEN).trimmed();
-            setCurrentBranch( getDefine(name)!=nullptr );
+            setCurrentBranch( getDefine(name)!=nullptr || isHasIncludeOperator(name) );
 
         }
     } else if (line.startsWith("ifndef")) {
@@ -375,7 +477,7 @@ void CppPreprocessor::handleBranch(const QString &line)
         } else {
             constexpr int IFNDEF_LEN = 6; //length of ifndef;
             QString name = line.mid(IFNDEF_LEN).trimmed();
-            setCurrentBranch( getDefine(name)==nullptr );
+            setCurrentBranch( getDefine(name)==nullptr && !isHasIncludeOperator(name) );
         }
     } else if (line.startsWith("if")) {
         //        // if a branch that is not at our level is false, current branch is false too;
@@ -427,10 +529,45 @@ void CppPreprocessor::handleInclude(const QString &line, bool fromNext)
     if (!getCurrentBranch()) // we're skipping due to a branch failure
         return;
 
-    PParsedFile file = mIncludes.back();
-    QString fileName;
     // Get full header file name
+    QString fileName = resolveHeaderFileName(line, fromNext);
+    if (fileName.isEmpty())
+        return;
+
+    PFileIncludes oldCurrentIncludes = mCurrentIncludes;
+    QStringList buffer;
+    // contents of scanned files are not used
+    if (mOnGetFileStream && !mScannedFiles.contains(fileName)) {
+        mOnGetFileStream(fileName,buffer);
+    }
+    openInclude(fileName, buffer);
+}
+
+QString CppPreprocessor::resolveHeaderFileName(const QString &line, bool fromNext)
+{
+    PParsedFile file = mIncludes.back();
     QString currentDir = includeTrailingPathDelimiter(extractFileDir(file->fileName));
+    if (mHeaderFileNamesGeneration != cachedFileGeneration()) {
+        // some include dirs are changed
+        mHeaderFileNames.clear();
+        mHeaderFileNamesGeneration = cachedFileGeneration();
+    }
+    // only lookups from watched directories are remembered,
+    // nothing tells when files in other directories are created
+    if (!isWatchedDirectory(currentDir))
+        return findHeaderFileName(file->fileName, currentDir, line, fromNext);
+    QString key = QString("%1|%2|%3").arg(currentDir, fromNext?"1":"0", line);
+    QHash<QString,QString>::const_iterator it = mHeaderFileNames.constFind(key);
+    if (it != mHeaderFileNames.constEnd())
+        return it.value();
+    QString fileName = findHeaderFileName(file->fileName, currentDir, line, fromNext);
+    mHeaderFileNames.insert(key, fileName);
+    return fileName;
+}
+
+QString CppPreprocessor::findHeaderFileName(const QString &relativeTo, const QString &currentDir,
+                                            const QString &line, bool fromNext)
+{
     QStringList includes;
     QStringList projectIncludes;
     bool found=false;
@@ -456,21 +593,11 @@ void CppPreprocessor::handleInclude(const QString &line, bool fromNext)
         includes = mIncludePathList;
         projectIncludes = mProjectIncludePathList;
     }
-    fileName = getHeaderFilename(
-                file->fileName,
+    return getHeaderFilename(
+                relativeTo,
                 line,
                 includes,
                 projectIncludes);
-
-    if (fileName.isEmpty())
-        return;
-
-    PFileIncludes oldCurrentIncludes = mCurrentIncludes;
-    QStringList buffer;
-    if (mOnGetFileStream) {
-        mOnGetFileStream(fileName,buffer);
-    }
-    openInclude(fileName, buffer);
 }
 
 void CppPreprocessor::handlePreprocessor(const QString &value)
@@ -522,36 +649,41 @@ void CppPreprocessor::handleUndefine(const QString &line)
 }
 
 QString CppPreprocessor::expandMacros(const QString &line, int depth)
+{
+    QSet<QString> usedMacros;
+    return expandMacros(line,depth,usedMacros);
+}
+
+QString CppPreprocessor::expandMacros(const QString &line, int depth, QSet<QString> &usedMacros)
 {
     //prevent infinit recursion
     if (depth > MAX_DEFINE_EXPAND_DEPTH)
         return line;
-    QString word;
     QString newLine;
+    newLine.reserve(line.length());
     int lenLine = line.length();
     int i=0;
     while (i< lenLine) {
         QChar ch=line[i];
         if (isWordChar(ch)) {
-            word += ch;
-        } else {
-            if (!word.isEmpty()) {
-                expandMacro(line,newLine,word,i,depth);
-            }
-            word = "";
-            if (i< lenLine) {
-                newLine += line[i];
+            int wordStart = i;
+            while (i<lenLine && isWordChar(line[i]))
+                i++;
+            if (isDigit(ch)) {
+                // numbers are not macros
+                newLine += line.midRef(wordStart,i-wordStart);
+            } else {
+                expandMacro(line,newLine,line.mid(wordStart,i-wordStart),i,depth,usedMacros);
             }
+        } else {
+            newLine += ch;
+            i++;
         }
-        i++;
-    }
-    if (!word.isEmpty()) {
-        expandMacro(line,newLine,word,i,depth);
     }
     return newLine;
 }
 
-void CppPreprocessor::expandMacro(const QString &line, QString &newLine, QString &word, int &i, int depth)
+void CppPreprocessor::expandMacro(const QString &line, QString &newLine, const QString &word, int &i, int depth, QSet<QString> &usedMacros)
 {
     int lenLine = line.length();
     if (word.startsWith("__")
@@ -576,46 +708,52 @@ void CppPreprocessor::expandMacro(const QString &line, QString &newLine, QString
                     break;
             }
         }
-    } else {
-        PDefine define = getDefine(word);
-        if (define && define->args=="" ) {
-            //newLine:=newLine+RemoveGCCAttributes(define^.Value);
-            if (define->value != word )
-              newLine += expandMacros(define->value,depth+1);
-            else
-              newLine += word;
-
-        } else if (define && (define->args!="")) {
-            while ((i<lenLine) && (line[i] == ' ' || line[i]=='\t'))
-                i++;
-            int argStart=-1;
-            int argEnd=-1;
-            if ((i<lenLine) && (line[i]=='(')) {
-                argStart =i+1;
-                int level=0;
-                while (i<lenLine) {
-                    switch(line[i].unicode()) {
-                        case '(':
-                            level++;
-                        break;
-                        case ')':
-                            level--;
-                        break;
-                    }
-                    i++;
-                    if (level==0)
-                        break;
-                }
-                if (level==0) {
-                    argEnd = i-2;
-                    QString args = line.mid(argStart,argEnd-argStart+1).trimmed();
-                    QString formattedValue = expandFunction(define,args);
-                    newLine += expandMacros(formattedValue,depth+1);
-                }
+        return;
+    }
+    PDefine define = getDefine(word);
+    // a macro is not expanded again in its own expansion
+    if (!define || usedMacros.contains(word)) {
+        newLine += word;
+        return;
+    }
+    if (define->args.isEmpty()) {
+        //newLine:=newLine+RemoveGCCAttributes(define^.Value);
+        usedMacros.insert(word);
+        newLine += expandMacros(define->value,depth+1,usedMacros);
+        usedMacros.remove(word);
+        return;
+    }
+    int wordEnd = i;
+    while ((i<lenLine) && (line[i] == ' ' || line[i]=='\t'))
+        i++;
+    if ((i<lenLine) && (line[i]=='(')) {
+        int argStart =i+1;
+        int level=0;
+        while (i<lenLine) {
+            switch(line[i].unicode()) {
+                case '(':
+                    level++;
+                break;
+                case ')':
+                    level--;
+                break;
             }
-        } else {
-            newLine += word;
+            i++;
+            if (level==0)
+                break;
+        }
+        if (level==0) {
+            int argEnd = i-2;
+            QString args = line.mid(argStart,argEnd-argStart+1).trimmed();
+            QString formattedValue = expandFunction(define,args,depth,usedMacros);
+            usedMacros.insert(word);
+            newLine += expandMacros(formattedValue,depth+1,usedMacros);
+            usedMacros.remove(word);
         }
+    } else {
+        // function-like macro's name without arguments is not expanded
+        i = wordEnd;
+        newLine += word;
     }
 }
 
@@ -683,14 +821,14 @@ void CppPreprocessor::openInclude(const QString &fileName, QStringList bufferedT
             return; //already included
         }
         for (PParsedFile& parsedFile:mIncludes) {
-            parsedFile->fileIncludes->includeFiles.insert(fileName,false);
+            addIncludeFile(parsedFile->fileIncludes,fileName,false);
         }
         // Backup old position if we're entering a new file
         PParsedFile innerMostFile = mIncludes.back();
         innerMostFile->index = mIndex;
         innerMostFile->branches = mBranchResults.count();
 
-        innerMostFile->fileIncludes->includeFiles.insert(fileName,true);
+        addIncludeFile(innerMostFile->fileIncludes,fileName,true);
         innerMostFile->fileIncludes->directIncludes.append(fileName);
     }
 
@@ -736,9 +874,9 @@ void CppPreprocessor::openInclude(const QString &fileName, QStringList bufferedT
         bool isSystemFile = isSystemHeaderFile(fileName, mIncludePaths) || isSystemHeaderFile(fileName, mProjectIncludePaths);
         if ((mParseSystem && isSystemFile) || (mParseLocal && !isSystemFile)) {
             if (!bufferedText.isEmpty()) {
-                parsedFile->buffer  = bufferedText;
+                parsedFile->buffer  = removeComments(bufferedText);
             } else {
-                parsedFile->buffer = readFileToLines(fileName);
+                parsedFile->buffer = readHeaderText(fileName);
             }
         }
     } else {
@@ -747,7 +885,7 @@ void CppPreprocessor::openInclude(const QString &fileName, QStringList bufferedT
         PFileIncludes fileIncludes = getFileIncludesEntry(fileName);
         for (PParsedFile& file:mIncludes) {
             foreach (const QString& incFile,fileIncludes->includeFiles.keys()) {
-                file->fileIncludes->includeFiles.insert(incFile,false);
+                addIncludeFile(file->fileIncludes,incFile,false);
             }
         }
     }
@@ -756,7 +894,6 @@ void CppPreprocessor::openInclude(const QString &fileName, QStringList bufferedT
     // Process it
     mIndex = parsedFile->index;
     mFileName = parsedFile->fileName;
-    parsedFile->buffer = removeComments(parsedFile->buffer);
     mBuffer = parsedFile->buffer;
 
 //    for (int i=0;i<mBuffer.count();i++) {
@@ -832,6 +969,12 @@ PFileIncludes CppPreprocessor::getFileIncludesEntry(const QString &fileName)
     return mIncludesList.value(fileName,PFileIncludes());
 }
 
+void CppPreprocessor::addIncludeFile(const PFileIncludes &fileIncludes, const QString &includeFile, bool isDirect)
+{
+    fileIncludes->includeFiles.insert(includeFile,isDirect);
+    mIncludedBy[includeFile].insert(fileIncludes->baseFile);
+}
+
 void CppPreprocessor::addDefinesInFile(const QString &fileName)
 {
     if (mProcessed.contains(fileName))
@@ -856,125 +999,185 @@ void CppPreprocessor::parseArgs(PDefine define)
 {
     QString args=define->args.mid(1,define->args.length()-2).trimmed(); // remove '(' ')'
 
-    if(args=="")
+    define->argList.clear();
+    define->variadic = false;
+    define->valueParts.clear();
+    if(args=="") {
+        define->valueParts.append(DefineValuePart{define->value,-1,false,false});
         return ;
+    }
     define->argList = args.split(',');
     for (int i=0;i<define->argList.size();i++) {
         define->argList[i]=define->argList[i].trimmed();
-        define->argUsed.append(false);
     }
-    QList<PDefineArgToken> tokens = tokenizeValue(define->value);
+    QString& lastArg = define->argList.last();
+    if (lastArg == "...") {
+        lastArg = "__VA_ARGS__";
+        define->variadic = true;
+    } else if (lastArg.endsWith("...")) {
+        // gcc's named variadic argument
+        lastArg = lastArg.left(lastArg.length()-3).trimmed();
+        define->variadic = true;
+    }
+    QList<DefineArgToken> tokens = tokenizeValue(define->value);
 
-    QString formatStr = "";
+    // compile the value to text pieces and argument slots,
+    // so we don't need to scan it again when expanding
+    QString text;
     DefineArgTokenType lastTokenType=DefineArgTokenType::Other;
+    bool afterDSharp = false;
     int index;
-    foreach (const PDefineArgToken& token, tokens) {
-        switch(token->type) {
+    foreach (const DefineArgToken& token, tokens) {
+        switch(token.type) {
         case DefineArgTokenType::Identifier:
-            index = define->argList.indexOf(token->value);
+            index = define->argList.indexOf(token.value);
             if (index>=0) {
-                define->argUsed[index] = true;
-                if (lastTokenType == DefineArgTokenType::Sharp) {
-                    formatStr+= "\"%"+QString("%1").arg(index+1)+"\"";
-                    break;
-                } else {
-                    formatStr+= "%"+QString("%1").arg(index+1);
-                    break;
-                }
+                define->valueParts.append(DefineValuePart{
+                                              text,
+                                              index,
+                                              lastTokenType == DefineArgTokenType::Sharp,
+                                              afterDSharp});
+                text.clear();
+                afterDSharp = false;
+                break;
             }
-            formatStr += token->value;
+            text += token.value;
+            afterDSharp = false;
             break;
         case DefineArgTokenType::DSharp:
+            // token pasting
+            while (text.endsWith(' '))
+                text.chop(1);
+            if (text.isEmpty() && !define->valueParts.isEmpty()
+                    && define->valueParts.last().argIndex>=0)
+                define->valueParts.last().pasted = true;
+            afterDSharp = true;
+            break;
         case DefineArgTokenType::Sharp:
             break;
         case DefineArgTokenType::Space:
+            text+=token.value;
+            break;
         case DefineArgTokenType::Symbol:
-            formatStr+=token->value;
+            text+=token.value;
+            afterDSharp = false;
             break;
         default:
             break;
         }
-        lastTokenType = token->type;
+        lastTokenType = token.type;
     }
-    define->formatValue = formatStr;
+    if (!text.isEmpty() || define->valueParts.isEmpty())
+        define->valueParts.append(DefineValuePart{text,-1,false,false});
 }
 
-QList<PDefineArgToken> CppPreprocessor::tokenizeValue(const QString &value)
+QList<DefineArgToken> CppPreprocessor::tokenizeValue(const QString &value)
 {
     int i=0;
-    PDefineArgToken  token = std::make_shared<DefineArgToken>();
-    token->type = DefineArgTokenType::Other;
-    QList<PDefineArgToken> tokens;
+    DefineArgToken token;
+    token.type = DefineArgTokenType::Other;
+    QList<DefineArgToken> tokens;
     bool skipSpaces=false;
     while (i<value.length()) {
         QChar ch = value[i];
         if (isSpaceChar(ch)) {
-            if (token->type==DefineArgTokenType::Other) {
-                token->value = " ";
-                token->type = DefineArgTokenType::Space;
-            } else if (token->type!=DefineArgTokenType::Space) {
+            if (token.type==DefineArgTokenType::Other) {
+                token.value = " ";
+                token.type = DefineArgTokenType::Space;
+            } else if (token.type!=DefineArgTokenType::Space) {
                 tokens.append(token);
-                token = std::make_shared<DefineArgToken>();
-                token->value = " ";
-                token->type = DefineArgTokenType::Space;
+                token = DefineArgToken();
+                token.value = " ";
+                token.type = DefineArgTokenType::Space;
             }
             i++;
         } else if (ch=='#') {
-            if (token->type!=DefineArgTokenType::Other
-                    && token->type!=DefineArgTokenType::Space) {
+            if (token.type!=DefineArgTokenType::Other
+                    && token.type!=DefineArgTokenType::Space) {
                 tokens.append(token);
-                token = std::make_shared<DefineArgToken>();
+                token = DefineArgToken();
             }
             if ((i+1<value.length()) && (value[i+1]=='#')) {
                 i+=2;
-                token->value = "##";
-                token->type = DefineArgTokenType::DSharp;
+                token.value = "##";
+                token.type = DefineArgTokenType::DSharp;
             } else {
                 i++;
-                token->value = "#";
-                token->type = DefineArgTokenType::Sharp;
+                token.value = "#";
+                token.type = DefineArgTokenType::Sharp;
             }
             skipSpaces=true;
             tokens.append(token);
-            token = std::make_shared<DefineArgToken>();
-            token->value = "";
-            token->type = DefineArgTokenType::Other;
+            token = DefineArgToken();
+            token.value = "";
+            token.type = DefineArgTokenType::Other;
         } else if (isWordChar(ch)) {
-            if (token->type==DefineArgTokenType::Other) {
-                token->value = ch ;
-                token->type = DefineArgTokenType::Identifier;
-            } else if (token->type==DefineArgTokenType::Identifier) {
-                token->value+=ch;
-            } else if (skipSpaces && token->type==DefineArgTokenType::Space) {
+            if (token.type==DefineArgTokenType::Other) {
+                token.value = ch ;
+                token.type = DefineArgTokenType::Identifier;
+            } else if (token.type==DefineArgTokenType::Identifier) {
+                token.value+=ch;
+            } else if (skipSpaces && token.type==DefineArgTokenType::Space) {
                 //dont use space;
-                token->value = ch ;
-                token->type = DefineArgTokenType::Identifier;
+                token.value = ch ;
+                token.type = DefineArgTokenType::Identifier;
             } else {
                 tokens.append(token);
-                token = std::make_shared<DefineArgToken>();
-                token->value = ch ;
-                token->type = DefineArgTokenType::Identifier;
+                token = DefineArgToken();
+                token.value = ch ;
+                token.type = DefineArgTokenType::Identifier;
             }
             skipSpaces=false;
             i++;
         } else {
-            if (skipSpaces && token->type==DefineArgTokenType::Space) {
+            if (skipSpaces && token.type==DefineArgTokenType::Space) {
                 //dont use space;
-            } else if (token->type!=DefineArgTokenType::Other) {
+            } else if (token.type!=DefineArgTokenType::Other) {
                 tokens.append(token);
-                token = std::make_shared<DefineArgToken>();
+                token = DefineArgToken();
             }
             skipSpaces=false;
-            token->value = ch ;
-            token->type = DefineArgTokenType::Symbol;
+            token.value = ch ;
+            token.type = DefineArgTokenType::Symbol;
             i++;
         }
     }
-    if(token->type!=DefineArgTokenType::Other)
+    if(token.type!=DefineArgTokenType::Other)
         tokens.append(token);
     return tokens;
 }
 
+QStringList CppPreprocessor::readHeaderText(const QString &fileName)
+{
+    // headers may be rewritten in place (the editor does it when saving),
+    // so the modification time and size are always checked.
+    // A file replaced in a watched directory may keep them, the directory's change marks it stale.
+    int generation = isWatchedDirectory(extractFileDir(fileName))?cachedFileGeneration():-1;
+    QFileInfo info(fileName);
+    QDateTime modified = info.lastModified();
+    qint64 size = info.size();
+    {
+        QMutexLocker locker(&headerTextCacheMutex);
+        HeaderText* text = headerTextCache.object(fileName);
+        if (text && text->modified == modified && text->size == size
+                && text->generation == generation)
+            return text->lines;
+    }
+    HeaderText* text = new HeaderText();
+    text->modified = modified;
+    text->size = size;
+    text->generation = generation;
+    text->lines = removeComments(readFileToLines(fileName));
+    QStringList lines = text->lines;
+    int cost = 0;
+    foreach (const QString& line, lines)
+        cost += line.length()+1;
+    QMutexLocker locker(&headerTextCacheMutex);
+    // the cache takes ownership of text
+    headerTextCache.insert(fileName, text, cost);
+    return lines;
+}
+
 QStringList CppPreprocessor::removeComments(const QStringList &text)
 {
     QStringList result;
@@ -1228,14 +1431,47 @@ QString CppPreprocessor::lineBreak()
 
 bool CppPreprocessor::evaluateIf(const QString &line)
 {
+    QHash<QString,IfExpressionResult>::const_iterator it = mIfResults.constFind(line);
+    if (it != mIfResults.constEnd()) {
+        // reuse the result if all macros used by the expression are unchanged
+        const IfExpressionResult& cached = it.value();
+        bool changed = false;
+        foreach (const DefineLookup& lookup, cached.lookups) {
+            if (mDefines.value(lookup.first,PDefine()) != lookup.second) {
+                changed = true;
+                break;
+            }
+        }
+        if (!changed)
+            return cached.result;
+    }
+    IfExpressionResult ifResult;
+    mDefineLookups = &ifResult.lookups;
+    mIfUsesFileSystem = false;
     QString newLine = expandDefines(line); // replace FOO by numerical value of FOO
-    return  evaluateExpression(newLine);
+    mDefineLookups = nullptr;
+    ifResult.result = (evaluateExpression(newLine)!=0);
+    // results of __has_include depend on the including file
+    if (!mIfUsesFileSystem)
+        mIfResults.insert(line, ifResult);
+    return ifResult.result;
 }
 
 QString CppPreprocessor::expandDefines(QString line)
 {
     int searchPos = 0;
     while (searchPos < line.length()) {
+        if (line[searchPos] == '\'') {
+            // skip char literals, so they are not taken as identifiers
+            searchPos++;
+            while (searchPos < line.length() && line[searchPos]!='\'') {
+                if (line[searchPos] == '\\')
+                    searchPos++;
+                searchPos++;
+            }
+            searchPos++;
+            continue;
+        }
         // We have found an identifier. It is not a number suffix. Try to expand it
         if (isMacroIdentChar(line[searchPos]) && (
                     (searchPos == 0) || !isDigit(line[searchPos - 1]))) {
@@ -1243,10 +1479,16 @@ QString CppPreprocessor::expandDefines(QString line)
             int tail = searchPos;
 
             // Get identifier name (numbers are allowed, but not at the start
-            while ((tail < line.length()) && (isMacroIdentChar(line[tail]) || isDigit(line[head])))
+            while ((tail < line.length()) && (isMacroIdentChar(line[tail]) || isDigit(line[tail])))
                 tail++;
 //            qDebug()<<"1 "<<head<<tail<<line;
             QString name = line.mid(head,tail-head);
+            if ((tail < line.length()) && (line[tail] == '\'')
+                    && (name == "L" || name == "u" || name == "U" || name == "u8")) {
+                // prefix of a char literal
+                searchPos = tail;
+                continue;
+            }
             int nameStart = head;
             int nameEnd = tail;
 
@@ -1279,7 +1521,7 @@ QString CppPreprocessor::expandDefines(QString line)
                 name = line.mid(defineStart, tail - defineStart);
                 PDefine define = getDefine(name);
                 QString insertValue;
-                if (!define) {
+                if (!define && !isHasIncludeOperator(name)) {
                     insertValue = "0";
                 } else {
                     insertValue = "1";
@@ -1287,6 +1529,24 @@ QString CppPreprocessor::expandDefines(QString line)
                 // Insert found value at place
                 line.remove(searchPos, tail-searchPos+1);
                 line.insert(searchPos,insertValue);
+            } else if (isHasIncludeOperator(name)) {
+                while ((tail < line.length()) && isSpaceChar(line[tail]))
+                    tail++; // skip spaces
+                if ((tail >= line.length()) || (line[tail]!='(')) {
+                    line = ""; // broken line
+                    break;
+                }
+                int argStart = tail+1;
+                if (!skipBraces(line, tail)) {
+                    line = ""; // broken line
+                    break;
+                }
+                QString headerName = line.mid(argStart, tail-argStart).trimmed();
+                bool fromNext = name.startsWith("__has_include_next");
+                mIfUsesFileSystem = true;
+                QString insertValue = resolveHeaderFileName(headerName, fromNext).isEmpty()?"0":"1";
+                line.remove(searchPos, tail-searchPos+1);
+                line.insert(searchPos,insertValue);
             } else if ((name == "and") || (name == "or")) {
                 searchPos = tail; // Skip logical operators
             }  else {
@@ -1330,6 +1590,13 @@ QString CppPreprocessor::expandDefines(QString line)
     return line;
 }
 
+bool CppPreprocessor::isHasIncludeOperator(const QString &name)
+{
+    // gcc before 10 defines __has_include(STR) as __has_include__(STR)
+    return name == "__has_include" || name == "__has_include__"
+            || name == "__has_include_next" || name == "__has_include_next__";
+}
+
 bool CppPreprocessor::skipBraces(const QString &line, int &index, int step)
 {
     int level = 0;
@@ -1348,24 +1615,104 @@ bool CppPreprocessor::skipBraces(const QString &line, int &index, int step)
 
 QString CppPreprocessor::expandFunction(PDefine define, QString args)
 {
-    // Replace function by this string
-    QString result = define->formatValue;
+    QStringList argValues = splitFunctionArgs(define, args);
+    return substituteDefineArgs(define, argValues, argValues);
+}
+
+QString CppPreprocessor::expandFunction(PDefine define, QString args, int depth, QSet<QString> &usedMacros)
+{
+    QStringList argValues = splitFunctionArgs(define, args);
+    // arguments are fully macro-expanded before they are substituted,
+    // unless they are stringified or pasted (C99 6.10.3.1)
+    QStringList expandedValues = argValues;
+    QVector<bool> expanded(argValues.count(), false);
+    foreach (const DefineValuePart& part, define->valueParts) {
+        if (part.argIndex<0 || part.argIndex>=argValues.count()
+                || part.stringify || part.pasted || expanded[part.argIndex])
+            continue;
+        expandedValues[part.argIndex] = expandMacros(argValues[part.argIndex],depth+1,usedMacros);
+        expanded[part.argIndex] = true;
+    }
+    return substituteDefineArgs(define, argValues, expandedValues);
+}
+
+QStringList CppPreprocessor::splitFunctionArgs(PDefine define, QString args)
+{
     if (args.startsWith('(') && args.endsWith(')')) {
         args = args.mid(1,args.length()-2);
     }
 
-    QStringList argValues = args.split(",");
-    if (argValues.length() == define->argList.length()
-            && argValues.length()>0) {
-        for (int i=0;i<argValues.length();i++) {
-            if (define->argUsed[i]) {
-                QString argValue = argValues[i];
-                result=result.arg(argValue.trimmed());
-            }
+    QStringList argValues = splitDefineArgs(args);
+    int argCount = define->argList.count();
+    if (define->variadic && argValues.count()>argCount) {
+        // the extra arguments are passed to the variadic one
+        QStringList varArgs = argValues.mid(argCount-1);
+        argValues = argValues.mid(0,argCount-1);
+        argValues.append(varArgs.join(','));
+    }
+    return argValues;
+}
+
+QString CppPreprocessor::substituteDefineArgs(PDefine define, const QStringList &argValues, const QStringList &expandedValues)
+{
+    // Replace function by this string
+    QString result;
+    foreach (const DefineValuePart& part, define->valueParts) {
+        result += part.text;
+        if (part.argIndex<0)
+            continue;
+        if (part.stringify) {
+            result += '"';
+            result += argValues.value(part.argIndex);
+            result += '"';
+        } else if (part.pasted) {
+            result += argValues.value(part.argIndex);
+        } else {
+            result += expandedValues.value(part.argIndex);
         }
     }
-    result.replace("%%","%");
+    return result;
+}
 
+QStringList CppPreprocessor::splitDefineArgs(const QString &args)
+{
+    QStringList result;
+    int level = 0;
+    int start = 0;
+    QChar quote;
+    for (int i=0;i<args.length();i++) {
+        QChar ch = args[i];
+        if (!quote.isNull()) {
+            if (ch=='\\')
+                i++;
+            else if (ch==quote)
+                quote = QChar();
+            continue;
+        }
+        switch(ch.unicode()) {
+        case '"':
+        case '\'':
+            quote = ch;
+            break;
+        case '(':
+        case '[':
+        case '{':
+            level++;
+            break;
+        case ')':
+        case ']':
+        case '}':
+            level--;
+            break;
+        case ',':
+            if (level==0) {
+                result.append(args.mid(start,i-start).trimmed());
+                start = i+1;
+            }
+            break;
+        }
+    }
+    result.append(args.mid(start).trimmed());
     return result;
 }
 
@@ -1376,7 +1723,7 @@ bool CppPreprocessor::skipSpaces(const QString &expr, int &pos)
     return pos<expr.length();
 }
 
-bool CppPreprocessor::evalNumber(const QString &expr, int &result, int &pos)
+bool CppPreprocessor::evalNumber(const QString &expr, qint64 &result, int &pos)
 {
     if (!skipSpaces(expr,pos))
         return false;
@@ -1385,30 +1732,105 @@ bool CppPreprocessor::evalNumber(const QString &expr, int &result, int &pos)
         s+=expr[pos];
         pos++;
     }
+    // remove u/l/ll suffixes
+    int len = s.length();
+    while (len>0) {
+        QChar ch = s[len-1];
+        if (ch!='u' && ch!='U' && ch!='l' && ch!='L')
+            break;
+        len--;
+    }
+    s.truncate(len);
     bool ok;
-
-    if (s.endsWith("LL",Qt::CaseInsensitive)) {
-        s.remove(s.length()-2,2);
-        result = s.toLongLong(&ok);
-    } else if (s.endsWith("L",Qt::CaseInsensitive)) {
-        s.remove(s.length()-1,1);
-        result = s.toLong(&ok);
-    } else if (s.endsWith("ULL",Qt::CaseInsensitive)) {
-        s.remove(s.length()-3,3);
-        result = s.toULongLong(&ok);
-    } else if (s.endsWith("UL",Qt::CaseInsensitive)) {
-        s.remove(s.length()-2,2);
-        result = s.toULong(&ok);
-    } else if (s.endsWith("U",Qt::CaseInsensitive)) {
-        s.remove(s.length()-1,1);
-        result = s.toUInt(&ok);
+    quint64 value;
+    if (s.startsWith("0b",Qt::CaseInsensitive)) {
+        value = s.mid(2).toULongLong(&ok,2);
     } else {
-        result = s.toInt(&ok);
+        // base 0: 0x is hex, leading 0 is octal
+        value = s.toULongLong(&ok,0);
     }
+    // unsigned values are kept by their bit patterns
+    result = (qint64)value;
     return ok;
 }
 
-bool CppPreprocessor::evalTerm(const QString &expr, int &result, int &pos)
+bool CppPreprocessor::evalCharLiteral(const QString &expr, qint64 &result, int &pos)
+{
+    if (pos>=expr.length() || expr[pos]!='\'')
+        return false;
+    pos++;
+    quint64 value=0;
+    int count = 0;
+    while (pos<expr.length() && expr[pos]!='\'') {
+        uint ch = expr[pos].unicode();
+        pos++;
+        if (ch == '\\') {
+            if (pos>=expr.length())
+                return false;
+            ch = expr[pos].unicode();
+            pos++;
+            switch(ch) {
+            case 'a':
+                ch = '\a';
+                break;
+            case 'b':
+                ch = '\b';
+                break;
+            case 'f':
+                ch = '\f';
+                break;
+            case 'n':
+                ch = '\n';
+                break;
+            case 'r':
+                ch = '\r';
+                break;
+            case 't':
+                ch = '\t';
+                break;
+            case 'v':
+                ch = '\v';
+                break;
+            case 'x':
+                ch = 0;
+                while (pos<expr.length()) {
+                    uint digit = expr[pos].unicode();
+                    if (digit>='0' && digit<='9')
+                        digit -= '0';
+                    else if (digit>='a' && digit<='f')
+                        digit = digit - 'a' + 10;
+                    else if (digit>='A' && digit<='F')
+                        digit = digit - 'A' + 10;
+                    else
+                        break;
+                    ch = ch*16 + digit;
+                    pos++;
+                }
+                break;
+            default:
+                if (ch>='0' && ch<='7') {
+                    ch = ch - '0';
+                    for (int i=0;i<2 && pos<expr.length()
+                         && expr[pos]>='0' && expr[pos]<='7';i++) {
+                        ch = ch*8 + (expr[pos].unicode() - '0');
+                        pos++;
+                    }
+                }
+                // '\\', '\'', '"', '?' stand for themselves
+            }
+        }
+        // multi-char constants are packed like gcc does
+        value = (value << 8) | ch;
+        count++;
+    }
+    if (pos>=expr.length() || count==0)
+        return false;
+    pos++; //skip the closing '
+    result = (qint64)value;
+    return true;
+}
+
+bool CppPreprocessor::evalTerm(const QString &expr, qint64 &result, int &pos)
 {
     if (!skipSpaces(expr,pos))
         return false;
@@ -1422,6 +1844,16 @@ bool CppPreprocessor::evalTerm(const QString &expr, int &result, int &pos)
             return false;
         pos++;
         return true;
+    } else if (expr[pos]=='\'') {
+        return evalCharLiteral(expr,result,pos);
+    } else if ((expr[pos]=='L' || expr[pos]=='u' || expr[pos]=='U')
+               && pos+1<expr.length() && expr[pos+1]=='\'') {
+        // wide / unicode char literal
+        pos++;
+        return evalCharLiteral(expr,result,pos);
+    } else if (expr.midRef(pos,3)=="u8'") {
+        pos+=2;
+        return evalCharLiteral(expr,result,pos);
     } else {
         return evalNumber(expr,result,pos);
     }
@@ -1429,32 +1861,32 @@ bool CppPreprocessor::evalTerm(const QString &expr, int &result, int &pos)
 
 /*
  * unary_expr = term
-     | '+' term
-     | '-' term
-     | '!' term
-     | '~' term
+     | '+' unary_expr
+     | '-' unary_expr
+     | '!' unary_expr
+     | '~' unary_expr
  */
-bool CppPreprocessor::evalUnaryExpr(const QString &expr, int &result, int &pos)
+bool CppPreprocessor::evalUnaryExpr(const QString &expr, qint64 &result, int &pos)
 {
     if (!skipSpaces(expr,pos))
         return false;
     if (expr[pos]=='+') {
         pos++;
-        if (!evalTerm(expr,result,pos))
+        if (!evalUnaryExpr(expr,result,pos))
             return false;
     } else if (expr[pos]=='-') {
         pos++;
-        if (!evalTerm(expr,result,pos))
+        if (!evalUnaryExpr(expr,result,pos))
             return false;
-        result = -result;
+        result = (qint64)(0-(quint64)result);
     } else if (expr[pos]=='~') {
         pos++;
-        if (!evalTerm(expr,result,pos))
+        if (!evalUnaryExpr(expr,result,pos))
             return false;
         result = ~result;
     } else if (expr[pos]=='!') {
         pos++;
-        if (!evalTerm(expr,result,pos))
+        if (!evalUnaryExpr(expr,result,pos))
             return false;
         result = !result;
     } else {
@@ -1469,29 +1901,39 @@ bool CppPreprocessor::evalUnaryExpr(const QString &expr, int &result, int &pos)
      | mul_expr '/' unary_expr
      | mul_expr '%' unary_expr
  */
-bool CppPreprocessor::evalMulExpr(const QString &expr, int &result, int &pos)
+bool CppPreprocessor::evalMulExpr(const QString &expr, qint64 &result, int &pos)
 {
     if (!evalUnaryExpr(expr,result,pos))
         return false;
     while (true) {
         if (!skipSpaces(expr,pos))
             break;
-        int rightResult;
+        qint64 rightResult;
         if (expr[pos]=='*') {
             pos++;
             if (!evalUnaryExpr(expr,rightResult,pos))
                 return false;
-            result *= rightResult;
+            result = (qint64)((quint64)result * (quint64)rightResult);
         } else if (expr[pos]=='/') {
             pos++;
             if (!evalUnaryExpr(expr,rightResult,pos))
                 return false;
-            result /= rightResult;
+            // division by zero may be in an operand of && or || that is not used,
+            // so it's not an error
+            if (rightResult == 0)
+                result = 0;
+            else if (rightResult == -1)
+                result = (qint64)(0-(quint64)result);
+            else
+                result /= rightResult;
         } else if (expr[pos]=='%') {
             pos++;
             if (!evalUnaryExpr(expr,rightResult,pos))
                 return false;
-            result %= rightResult;
+            if (rightResult == 0 || rightResult == -1)
+                result = 0;
+            else
+                result %= rightResult;
         } else {
             break;
         }
@@ -1504,24 +1946,24 @@ bool CppPreprocessor::evalMulExpr(const QString &expr, int &result, int &pos)
      | add_expr '+' mul_expr
      | add_expr '-' mul_expr
  */
-bool CppPreprocessor::evalAddExpr(const QString &expr, int &result, int &pos)
+bool CppPreprocessor::evalAddExpr(const QString &expr, qint64 &result, int &pos)
 {
     if (!evalMulExpr(expr,result,pos))
         return false;
     while (true) {
         if (!skipSpaces(expr,pos))
             break;
-        int rightResult;
+        qint64 rightResult;
         if (expr[pos]=='+') {
             pos++;
             if (!evalMulExpr(expr,rightResult,pos))
                 return false;
-            result += rightResult;
+            result = (qint64)((quint64)result + (quint64)rightResult);
         } else if (expr[pos]=='-') {
             pos++;
             if (!evalMulExpr(expr,rightResult,pos))
                 return false;
-            result -= rightResult;
+            result = (qint64)((quint64)result - (quint64)rightResult);
         } else {
             break;
         }
@@ -1534,24 +1976,30 @@ bool CppPreprocessor::evalAddExpr(const QString &expr, int &result, int &pos)
      | shift_expr "<<" add_expr
      | shift_expr ">>" add_expr
  */
-bool CppPreprocessor::evalShiftExpr(const QString &expr, int &result, int &pos)
+bool CppPreprocessor::evalShiftExpr(const QString &expr, qint64 &result, int &pos)
 {
     if (!evalAddExpr(expr,result,pos))
         return false;
     while (true) {
         if (!skipSpaces(expr,pos))
             break;
-        int rightResult;
+        qint64 rightResult;
         if (pos+1<expr.length() && expr[pos] == '<' && expr[pos+1]=='<') {
             pos += 2;
             if (!evalAddExpr(expr,rightResult,pos))
                 return false;
-            result = (result << rightResult);
+            if (rightResult<0 || rightResult>=64)
+                result = 0;
+            else
+                result = (qint64)((quint64)result << rightResult);
         } else if (pos+1<expr.length() && expr[pos] == '>' && expr[pos+1]=='>') {
             pos += 2;
             if (!evalAddExpr(expr,rightResult,pos))
                 return false;
-            result = (result >> rightResult);
+            if (rightResult<0 || rightResult>=64)
+                result = (result<0)?-1:0;
+            else
+                result = (result >> rightResult);
         } else {
             break;
         }
@@ -1566,14 +2014,14 @@ bool CppPreprocessor::evalShiftExpr(const QString &expr, int &result, int &pos)
      | relation_expr "<=" shift_expr
      | relation_expr "<" shift_expr
  */
-bool CppPreprocessor::evalRelationExpr(const QString &expr, int &result, int &pos)
+bool CppPreprocessor::evalRelationExpr(const QString &expr, qint64 &result, int &pos)
 {
     if (!evalShiftExpr(expr,result,pos))
         return false;
     while (true) {
         if (!skipSpaces(expr,pos))
             break;
-        int rightResult;
+        qint64 rightResult;
         if (expr[pos]=='<') {
             if (pos+1<expr.length() && expr[pos+1]=='=') {
                 pos+=2;
@@ -1610,7 +2058,7 @@ bool CppPreprocessor::evalRelationExpr(const QString &expr, int &result, int &po
      | equal_expr "==" relation_expr
      | equal_expr "!=" relation_expr
  */
-bool CppPreprocessor::evalEqualExpr(const QString &expr, int &result, int &pos)
+bool CppPreprocessor::evalEqualExpr(const QString &expr, qint64 &result, int &pos)
 {
     if (!evalRelationExpr(expr,result,pos))
         return false;
@@ -1619,13 +2067,13 @@ bool CppPreprocessor::evalEqualExpr(const QString &expr, int &result, int &pos)
             break;
         if (pos+1<expr.length() && expr[pos]=='!' && expr[pos+1]=='=') {
             pos+=2;
-            int rightResult;
+            qint64 rightResult;
             if (!evalRelationExpr(expr,rightResult,pos))
                 return false;
             result = (result != rightResult);
         } else if (pos+1<expr.length() && expr[pos]=='=' && expr[pos+1]=='=') {
             pos+=2;
-            int rightResult;
+            qint64 rightResult;
             if (!evalRelationExpr(expr,rightResult,pos))
                 return false;
             result = (result == rightResult);
@@ -1640,7 +2088,7 @@ bool CppPreprocessor::evalEqualExpr(const QString &expr, int &result, int &pos)
  * bit_and_expr = equal_expr
      | bit_and_expr "&" equal_expr
  */
-bool CppPreprocessor::evalBitAndExpr(const QString &expr, int &result, int &pos)
+bool CppPreprocessor::evalBitAndExpr(const QString &expr, qint64 &result, int &pos)
 {
     if (!evalEqualExpr(expr,result,pos))
         return false;
@@ -1648,10 +2096,10 @@ bool CppPreprocessor::evalBitAndExpr(const QString &expr, int &result, int &pos)
         if (!skipSpaces(expr,pos))
             break;
         if (expr[pos]=='&'
-                && (pos == expr.length()
+                && (pos+1 == expr.length()
                 || expr[pos+1]!='&')) {
             pos++;
-            int rightResult;
+            qint64 rightResult;
             if (!evalEqualExpr(expr,rightResult,pos))
                 return false;
             result = result & rightResult;
@@ -1666,7 +2114,7 @@ bool CppPreprocessor::evalBitAndExpr(const QString &expr, int &result, int &pos)
  * bit_xor_expr = bit_and_expr
      | bit_xor_expr "^" bit_and_expr
  */
-bool CppPreprocessor::evalBitXorExpr(const QString &expr, int &result, int &pos)
+bool CppPreprocessor::evalBitXorExpr(const QString &expr, qint64 &result, int &pos)
 {
     if (!evalBitAndExpr(expr,result,pos))
         return false;
@@ -1675,7 +2123,7 @@ bool CppPreprocessor::evalBitXorExpr(const QString &expr, int &result, int &pos)
             break;
         if (expr[pos]=='^') {
             pos++;
-            int rightResult;
+            qint64 rightResult;
             if (!evalBitAndExpr(expr,rightResult,pos))
                 return false;
             result = result ^ rightResult;
@@ -1690,7 +2138,7 @@ bool CppPreprocessor::evalBitXorExpr(const QString &expr, int &result, int &pos)
  * bit_or_expr = bit_xor_expr
      | bit_or_expr "|" bit_xor_expr
  */
-bool CppPreprocessor::evalBitOrExpr(const QString &expr, int &result, int &pos)
+bool CppPreprocessor::evalBitOrExpr(const QString &expr, qint64 &result, int &pos)
 {
     if (!evalBitXorExpr(expr,result,pos))
         return false;
@@ -1698,10 +2146,10 @@ bool CppPreprocessor::evalBitOrExpr(const QString &expr, int &result, int &pos)
         if (!skipSpaces(expr,pos))
             break;
         if (expr[pos] == '|'
-                && (pos == expr.length()
+                && (pos+1 == expr.length()
                 || expr[pos+1]!='|')) {
             pos++;
-            int rightResult;
+            qint64 rightResult;
             if (!evalBitXorExpr(expr,rightResult,pos))
                 return false;
             result = result | rightResult;
@@ -1716,7 +2164,7 @@ bool CppPreprocessor::evalBitOrExpr(const QString &expr, int &result, int &pos)
  * logic_and_expr = bit_or_expr
     | logic_and_expr "&&" bit_or_expr
  */
-bool CppPreprocessor::evalLogicAndExpr(const QString &expr, int &result, int &pos)
+bool CppPreprocessor::evalLogicAndExpr(const QString &expr, qint64 &result, int &pos)
 {
     if (!evalBitOrExpr(expr,result,pos))
         return false;
@@ -1725,7 +2173,7 @@ bool CppPreprocessor::evalLogicAndExpr(const QString &expr, int &result, int &po
             break;
         if (pos+1<expr.length() && expr[pos]=='&' && expr[pos+1] =='&') {
             pos+=2;
-            int rightResult;
+            qint64 rightResult;
             if (!evalBitOrExpr(expr,rightResult,pos))
                 return false;
             result = result && rightResult;
@@ -1740,7 +2188,7 @@ bool CppPreprocessor::evalLogicAndExpr(const QString &expr, int &result, int &po
  * logic_or_expr = logic_and_expr
     | logic_or_expr "||" logic_and_expr
  */
-bool CppPreprocessor::evalLogicOrExpr(const QString &expr, int &result, int &pos)
+bool CppPreprocessor::evalLogicOrExpr(const QString &expr, qint64 &result, int &pos)
 {
     if (!evalLogicAndExpr(expr,result,pos))
         return false;
@@ -1749,7 +2197,7 @@ bool CppPreprocessor::evalLogicOrExpr(const QString &expr, int &result, int &pos
             break;
         if (pos+1<expr.length() && expr[pos]=='|' && expr[pos+1] =='|') {
             pos+=2;
-            int rightResult;
+            qint64 rightResult;
             if (!evalLogicAndExpr(expr,rightResult,pos))
                 return false;
             result = result || rightResult;
@@ -1760,19 +2208,44 @@ bool CppPreprocessor::evalLogicOrExpr(const QString &expr, int &result, int &pos
     return true;
 }
 
-bool CppPreprocessor::evalExpr(const QString &expr, int &result, int &pos)
+/*
+ * cond_expr = logic_or_expr
+    | logic_or_expr '?' expr ':' cond_expr
+ */
+bool CppPreprocessor::evalCondExpr(const QString &expr, qint64 &result, int &pos)
 {
-    return evalLogicOrExpr(expr,result,pos);
+    if (!evalLogicOrExpr(expr,result,pos))
+        return false;
+    if (!skipSpaces(expr,pos) || expr[pos]!='?')
+        return true;
+    pos++;
+    qint64 trueResult;
+    if (!evalExpr(expr,trueResult,pos))
+        return false;
+    if (!skipSpaces(expr,pos) || expr[pos]!=':')
+        return false;
+    pos++;
+    qint64 falseResult;
+    if (!evalCondExpr(expr,falseResult,pos))
+        return false;
+    result = result?trueResult:falseResult;
+    return true;
+}
+
+bool CppPreprocessor::evalExpr(const QString &expr, qint64 &result, int &pos)
+{
+    return evalCondExpr(expr,result,pos);
 }
 
 /* BNF for C constant expression evaluation
  * term = number
+     | char_literal
      | '(' expression ')'
 unary_expr = term
-     | '+' term
-     | '-' term
-     | '!' term
-     | '~' term
+     | '+' unary_expr
+     | '-' unary_expr
+     | '!' unary_expr
+     | '~' unary_expr
 mul_expr = term
      | mul_expr '*' term
      | mul_expr '/' term
@@ -1801,12 +2274,14 @@ logic_and_expr = bit_or_expr
     | logic_and_expr "&&" bit_or_expr
 logic_or_expr = logic_and_expr
     | logic_or_expr "||" logic_and_expr
+cond_expr = logic_or_expr
+    | logic_or_expr '?' expr ':' cond_expr
     */
 
-int CppPreprocessor::evaluateExpression(QString line)
+qint64 CppPreprocessor::evaluateExpression(QString line)
 {
     int pos = 0;
-    int result;
+    qint64 result;
     bool ok = evalExpr(line,result,pos);
     if (!ok)
         return -1;
@@ -1821,6 +2296,35 @@ void CppPreprocessor::setOnGetFileStream(const GetFileStreamCallBack &newOnGetFi
     mOnGetFileStream = newOnGetFileStream;
 }
 
+void CppPreprocessor::copyOptionsFrom(const CppPreprocessor &preprocessor)
+{
+    mHardDefines = preprocessor.mHardDefines;
+    mIncludePaths = preprocessor.mIncludePaths;
+    mIncludePathList = preprocessor.mIncludePathList;
+    mProjectIncludePaths = preprocessor.mProjectIncludePaths;
+    mProjectIncludePathList = preprocessor.mProjectIncludePathList;
+    mHeaderFileNames = preprocessor.mHeaderFileNames;
+    mHeaderFileNamesGeneration = preprocessor.mHeaderFileNamesGeneration;
+    mParseSystem = preprocessor.mParseSystem;
+    mParseLocal = preprocessor.mParseLocal;
+    mOnGetFileStream = preprocessor.mOnGetFileStream;
+}
+
+void CppPreprocessor::copyResultsFrom(const CppPreprocessor &preprocessor)
+{
+    mIncludesList = preprocessor.mIncludesList;
+    mIncludedBy = preprocessor.mIncludedBy;
+    mFileDefines = preprocessor.mFileDefines;
+    mScannedFiles = preprocessor.mScannedFiles;
+    mIfResults = preprocessor.mIfResults;
+    // resolved header names are only valid for the same include paths
+    if (mIncludePathList == preprocessor.mIncludePathList
+            && mProjectIncludePathList == preprocessor.mProjectIncludePathList) {
+        mHeaderFileNames = preprocessor.mHeaderFileNames;
+        mHeaderFileNamesGeneration = preprocessor.mHeaderFileNamesGeneration;
+    }
+}
+
 const QList<QString> &CppPreprocessor::projectIncludePathList() const
 {
     return mProjectIncludePathList;
@@ -1856,3 +2360,7 @@ QHash<QString, PFileIncludes> &CppPreprocessor::includesList()
     return mIncludesList;
 }
 
+QHash<QString, PDefineMap> &CppPreprocessor::fileDefines()
+{
+    return mFileDefines;
+}
@@ -22,6 +22,7 @@
 #include "parserutils.h"
 
 #define MAX_DEFINE_EXPAND_DEPTH 20
+#define MAX_HEADER_TEXT_CACHE_SIZE (32*1024*1024) // in chars
 enum class DefineArgTokenType{
     Symbol,
     Identifier,
@@ -34,7 +35,6 @@ struct DefineArgToken {
     QString value;
     DefineArgTokenType type;
 };
-using PDefineArgToken = std::shared_ptr<DefineArgToken>;
 
 struct ParsedFile {
     int index; // 0-based for programming convenience
@@ -45,6 +45,13 @@ struct ParsedFile {
 };
 using PParsedFile = std::shared_ptr<ParsedFile>;
 
+using DefineLookup = QPair<QString,PDefine>; // macro name and its define (null if not defined)
+
+struct IfExpressionResult {
+    QList<DefineLookup> lookups; // macros looked up when expanding the expression
+    bool result;
+};
+
 class CppPreprocessor
 {
     enum class ContentType {
@@ -62,12 +69,27 @@ public:
 
     explicit CppPreprocessor();
     void clear();
+    /**
+     * @brief clear include records, defines of files and scanned files
+     */
+    void clearResults();
+    /**
+     * @brief clear include paths and hard defines
+     */
+    void clearOptions();
 
     void clearTempResults();
     void getDefineParts(const QString& input, QString &name, QString &args, QString &value);
     void addHardDefineByLine(const QString& line);
     void setScanOptions(bool parseSystem, bool parseLocal);
     void preprocess(const QString& fileName, QStringList buffer = QStringList());
+    /**
+     * @brief preprocess lines [startLine, endLine] (1-based) of an already scanned file
+     *
+     * Defines of the file and its includes are used, and the include records are not touched.
+     * @return false if there are preprocessor directives in the lines
+     */
+    bool preprocessLines(const QString& fileName, const QStringList& buffer, int startLine, int endLine);
 
     void dumpDefinesTo(const QString& fileName) const;
     void dumpIncludesListTo(const QString& fileName) const;
@@ -76,11 +98,19 @@ public:
     void clearIncludePaths();
     void clearProjectIncludePaths();
     void removeScannedFile(const QString& filename);
+    void addFileIncludes(const PFileIncludes& fileIncludes);
+    void removeFileIncludes(const QString& fileName);
+    /**
+     * @brief files that include the file (directly or indirectly)
+     */
+    QSet<QString> includedBy(const QString& fileName) const;
 
     QStringList result() const;
 
     QHash<QString, PFileIncludes> &includesList();
 
+    QHash<QString, PDefineMap> &fileDefines();
+
     QSet<QString> &scannedFiles();
 
     const QSet<QString> &includePaths();
@@ -94,6 +124,25 @@ public:
     const QList<QString> &projectIncludePathList() const;
     void setOnGetFileStream(const GetFileStreamCallBack &newOnGetFileStream);
 
+    /**
+     * @brief copy include paths, hard defines and scan options from another preprocessor
+     *
+     * Used to set up worker preprocessors that don't share any parse results with the
+     * parser's own preprocessor, and the copy the parser preprocesses a file in.
+     */
+    void copyOptionsFrom(const CppPreprocessor& preprocessor);
+    /**
+     * @brief copy include records, defines of files and scanned files from another preprocessor
+     *
+     * The parser preprocesses a file in a copy, and publishes the results at once.
+     * Options are not copied, they may be changed while the copy is working.
+     */
+    void copyResultsFrom(const CppPreprocessor& preprocessor);
+    /**
+     * @brief parse the args of a function-like define and compile its value
+     */
+    void parseArgs(PDefine define);
+
 private:
     void preprocessBuffer();
     void skipToEndOfPreprocessor();
@@ -102,10 +151,23 @@ private:
     void handleBranch(const QString& line);
     void handleDefine(const QString& line);
     void handleInclude(const QString& line, bool fromNext=false);
+    /**
+     * @brief full name of the header in an include line, empty if not found
+     *
+     * results are memorized in mHeaderFileNames
+     */
+    QString resolveHeaderFileName(const QString& line, bool fromNext);
+    QString findHeaderFileName(const QString& relativeTo, const QString& currentDir,
+                               const QString& line, bool fromNext);
     void handlePreprocessor(const QString& value);
     void handleUndefine(const QString& line);
     QString expandMacros(const QString& line, int depth);
-    void expandMacro(const QString& line, QString& newLine, QString& word, int& i, int depth);
+    /**
+     * @brief expand macros in the line
+     * @param usedMacros macros being expanded, they are not expanded again (hide set)
+     */
+    QString expandMacros(const QString& line, int depth, QSet<QString>& usedMacros);
+    void expandMacro(const QString& line, QString& newLine, const QString& word, int& i, int depth, QSet<QString>& usedMacros);
     QString removeGCCAttributes(const QString& line);
     void removeGCCAttribute(const QString&line, QString& newLine, int &i, const QString& word);
     PDefine getDefine(const QString& name);
@@ -120,6 +182,7 @@ private:
     void removeCurrentBranch();
     // include stuff
     PFileIncludes getFileIncludesEntry(const QString& FileName);
+    void addIncludeFile(const PFileIncludes& fileIncludes, const QString& includeFile, bool isDirect);
     void addDefinesInFile(const QString& fileName);
     void addDefineByParts(const QString& name, const QString& args,
                           const QString& value, bool hardCoded);
@@ -127,9 +190,15 @@ private:
     PDefine getHardDefine(const QString& name);
     void invalidDefinesInFile(const QString& fileName);
 
-    void parseArgs(PDefine define);
-    QList<PDefineArgToken> tokenizeValue(const QString& value);
+    QList<DefineArgToken> tokenizeValue(const QString& value);
 
+    /**
+     * @brief read a header from disk and remove its comments
+     *
+     * Results are cached by file name and checked against the file's modified time,
+     * so headers included by many files or parsers are only read once.
+     */
+    QStringList readHeaderText(const QString& fileName);
     QStringList removeComments(const QStringList& text);
     /*
      * '_','a'..'z','A'..'Z','0'..'9'
@@ -169,27 +238,43 @@ private:
 
     QString lineBreak();
 
+    /**
+     * @brief evaluate the expression of #if / #elif
+     *
+     * Results are reused while the macros used by the expression are not changed.
+     */
     bool evaluateIf(const QString& line);
     QString expandDefines(QString line);
+    bool isHasIncludeOperator(const QString& name);
     bool skipBraces(const QString&line, int& index, int step = 1);
     QString expandFunction(PDefine define,QString args);
+    /**
+     * @brief expand a function-like macro, its arguments are macro-expanded before substitution
+     * @param usedMacros hide set of the enclosing expansion
+     */
+    QString expandFunction(PDefine define,QString args, int depth, QSet<QString>& usedMacros);
+    QStringList splitFunctionArgs(PDefine define, QString args);
+    QString substituteDefineArgs(PDefine define, const QStringList& argValues, const QStringList& expandedValues);
+    QStringList splitDefineArgs(const QString& args);
     bool skipSpaces(const QString &expr, int& pos);
-    bool evalNumber(const QString &expr, int& result, int& pos);
-    bool evalTerm(const QString &expr, int& result, int& pos);
-    bool evalUnaryExpr(const QString &expr, int& result, int& pos);
-    bool evalMulExpr(const QString &expr, int& result, int& pos);
-    bool evalAddExpr(const QString &expr, int& result, int& pos);
-    bool evalShiftExpr(const QString &expr, int& result, int& pos);
-    bool evalRelationExpr(const QString &expr, int& result, int& pos);
-    bool evalEqualExpr(const QString &expr, int& result, int& pos);
-    bool evalBitAndExpr(const QString &expr, int& result, int& pos);
-    bool evalBitXorExpr(const QString &expr, int& result, int& pos);
-    bool evalBitOrExpr(const QString &expr, int& result, int& pos);
-    bool evalLogicAndExpr(const QString &expr, int& result, int& pos);
-    bool evalLogicOrExpr(const QString &expr, int& result, int& pos);
-    bool evalExpr(const QString &expr, int& result, int& pos);
-
-    int evaluateExpression(QString line);
+    bool evalNumber(const QString &expr, qint64& result, int& pos);
+    bool evalCharLiteral(const QString &expr, qint64& result, int& pos);
+    bool evalTerm(const QString &expr, qint64& result, int& pos);
+    bool evalUnaryExpr(const QString &expr, qint64& result, int& pos);
+    bool evalMulExpr(const QString &expr, qint64& result, int& pos);
+    bool evalAddExpr(const QString &expr, qint64& result, int& pos);
+    bool evalShiftExpr(const QString &expr, qint64& result, int& pos);
+    bool evalRelationExpr(const QString &expr, qint64& result, int& pos);
+    bool evalEqualExpr(const QString &expr, qint64& result, int& pos);
+    bool evalBitAndExpr(const QString &expr, qint64& result, int& pos);
+    bool evalBitXorExpr(const QString &expr, qint64& result, int& pos);
+    bool evalBitOrExpr(const QString &expr, qint64& result, int& pos);
+    bool evalLogicAndExpr(const QString &expr, qint64& result, int& pos);
+    bool evalLogicOrExpr(const QString &expr, qint64& result, int& pos);
+    bool evalCondExpr(const QString &expr, qint64& result, int& pos);
+    bool evalExpr(const QString &expr, qint64& result, int& pos);
+
+    qint64 evaluateExpression(QString line);
 private:
 
     //temporary data when preprocessing single file
@@ -208,6 +293,7 @@ private:
     //Result across processings.
     //used by parser even preprocess finished
     QHash<QString,PFileIncludes> mIncludesList;
+    QHash<QString,QSet<QString>> mIncludedBy; // reverse index of includeFiles in mIncludesList
     QHash<QString, PDefineMap> mFileDefines; //dictionary to save defines for each headerfile;
     QSet<QString> mScannedFiles;
 
@@ -220,6 +306,13 @@ private:
     QList<QString> mProjectIncludePathList;
     //{ List of current compiler set's include path}
     QSet<QString> mIncludePaths;
+    // full names of resolved includes, by including dir, include_next and the include line
+    QHash<QString,QString> mHeaderFileNames;
+    int mHeaderFileNamesGeneration; // cachedFileGeneration() when mHeaderFileNames is filled
+    // results of #if / #elif expressions, by expression text
+    QHash<QString,IfExpressionResult> mIfResults;
+    QList<DefineLookup>* mDefineLookups; // if not null, getDefine() records lookups in it
+    bool mIfUsesFileSystem; // the expression being evaluated uses __has_include
 
     bool mParseSystem;
     bool mParseLocal;
@@ -28,6 +28,7 @@ CppTokenizer::CppTokenizer()
 void CppTokenizer::clear()
 {
     mTokenList.clear();
+    mTextPool.clear();
     mBuffer.clear();
     mBufferStr.clear();
     mLastToken.clear();
@@ -49,6 +50,8 @@ void CppTokenizer::tokenize(const QStringList &buffer)
         mBufferStr+='\n';
         mBufferStr+=mBuffer[i];
     }
+    // about one token every 4 chars in preprocessed c/c++ sources
+    mTokenList.reserve(mBufferStr.length()/4);
     mStart = mBufferStr.data();
     mCurrent = mStart;
     mLineCount = mStart;
@@ -82,8 +85,8 @@ void CppTokenizer::dumpTokens(const QString &fileName)
 
     if (file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
         QTextStream stream(&file);
-        foreach (const PToken& token,mTokenList) {
-            stream<<QString("%1,%2,%3").arg(token->line).arg(token->text).arg(token->matchIndex)
+        foreach (const Token& token,mTokenList) {
+            stream<<QString("%1,%2,%3").arg(token.line).arg(token.text).arg(token.matchIndex)
 #if QT_VERSION >= QT_VERSION_CHECK(5,15,0)
                  <<Qt::endl;
 #else
@@ -98,61 +101,57 @@ const CppTokenizer::TokenList &CppTokenizer::tokens()
     return mTokenList;
 }
 
-CppTokenizer::PToken CppTokenizer::operator[](int i)
+QString CppTokenizer::internText(const QString &text)
 {
-    return mTokenList[i];
-}
-
-int CppTokenizer::tokenCount()
-{
-    return mTokenList.count();
+    QSet<QString>::const_iterator it = mTextPool.constFind(text);
+    if (it == mTextPool.constEnd())
+        it = mTextPool.insert(text);
+    return *it;
 }
 
 void CppTokenizer::addToken(const QString &sText, int iLine, TokenType tokenType)
 {
-    PToken token = std::make_shared<Token>();
-    token->text = sText;
-    token->line = iLine;
-#ifdef Q_DEBUG
-    token->matchIndex = 1000000000;
-#endif
+    Token token;
+    token.text = internText(sText);
+    token.line = iLine;
+    token.matchIndex = 1000000000;
     switch(tokenType) {
     case TokenType::LeftBrace:
-        token->matchIndex=-1;
+        token.matchIndex=-1;
         mUnmatchedBraces.push_back(mTokenList.count());
         break;
     case TokenType::RightBrace:
         if (mUnmatchedBraces.isEmpty()) {
-            token->matchIndex=-1;
+            token.matchIndex=-1;
         } else {
-            token->matchIndex = mUnmatchedBraces.last();
-            mTokenList[token->matchIndex]->matchIndex=mTokenList.count();
+            token.matchIndex = mUnmatchedBraces.last();
+            mTokenList[token.matchIndex].matchIndex=mTokenList.count();
             mUnmatchedBraces.pop_back();
         }
         break;
     case TokenType::LeftBracket:
-        token->matchIndex=-1;
+        token.matchIndex=-1;
         mUnmatchedBrackets.push_back(mTokenList.count());
         break;
     case TokenType::RightBracket:
         if (mUnmatchedBrackets.isEmpty()) {
-            token->matchIndex=-1;
+            token.matchIndex=-1;
         } else {
-            token->matchIndex = mUnmatchedBrackets.last();
-            mTokenList[token->matchIndex]->matchIndex=mTokenList.count();
+            token.matchIndex = mUnmatchedBrackets.last();
+            mTokenList[token.matchIndex].matchIndex=mTokenList.count();
             mUnmatchedBrackets.pop_back();
         }
         break;
     case TokenType::LeftParenthesis:
-        token->matchIndex=-1;
+        token.matchIndex=-1;
         mUnmatchedParenthesis.push_back(mTokenList.count());
         break;
     case TokenType::RightParenthesis:
         if (mUnmatchedParenthesis.isEmpty()) {
-            token->matchIndex=-1;
+            token.matchIndex=-1;
         } else {
-            token->matchIndex = mUnmatchedParenthesis.last();
-            mTokenList[token->matchIndex]->matchIndex=mTokenList.count();
+            token.matchIndex = mUnmatchedParenthesis.last();
+            mTokenList[token.matchIndex].matchIndex=mTokenList.count();
             mUnmatchedParenthesis.pop_back();
         }
         break;
@@ -809,6 +808,51 @@ bool CppTokenizer::isIdentChar(const QChar &ch)
     return ch=='_' || ch.isLetter() ;
 }
 
+bool CppTokenizer::removeTokensOfFiles(const QSet<QString> &files)
+{
+    if (files.isEmpty())
+        return true;
+    // new index of each token, -1 if it's removed
+    QVector<int> newIndices(mTokenList.count());
+    int count = 0;
+    bool removing = false;
+    for (int i=0;i<mTokenList.count();i++) {
+        const QString& text = mTokenList[i].text;
+        if (text.startsWith("#include ")) {
+            int delimPos = text.lastIndexOf(':');
+            if (delimPos>=0)
+                removing = files.contains(text.mid(9,delimPos-9).trimmed());
+        }
+        newIndices[i] = removing?-1:count++;
+    }
+    if (count == mTokenList.count())
+        return true;
+    for (int i=0;i<mTokenList.count();i++) {
+        int matchIndex = mTokenList[i].matchIndex;
+        if (newIndices[i]>=0 && matchIndex>=0 && matchIndex<mTokenList.count()
+                && newIndices[matchIndex]<0)
+            return false;
+    }
+    TokenList tokens;
+    tokens.reserve(count);
+    for (int i=0;i<mTokenList.count();i++) {
+        if (newIndices[i]<0)
+            continue;
+        Token token = mTokenList[i];
+        if (token.matchIndex>=0 && token.matchIndex<mTokenList.count())
+            token.matchIndex = newIndices[token.matchIndex];
+        tokens.append(token);
+    }
+    QList<int> lambdas;
+    foreach (int index, mLambdas) {
+        if (newIndices[index]>=0)
+            lambdas.append(newIndices[index]);
+    }
+    mTokenList = tokens;
+    mLambdas = lambdas;
+    return true;
+}
+
 int CppTokenizer::lambdasCount() const
 {
     return mLambdas.count();
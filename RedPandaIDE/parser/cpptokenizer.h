@@ -18,6 +18,7 @@
 #define CPPTOKENIZER_H
 
 #include <QObject>
+#include <QSet>
 #include "parserutils.h"
 
 class CppTokenizer
@@ -36,21 +37,33 @@ class CppTokenizer
 
 public:
     struct Token {
-      QString text;
+      QString text; // shares data with other tokens of the same text
       int line;
       int matchIndex;
     };
-    using PToken = std::shared_ptr<Token>;
-    using TokenList = QVector<PToken>;
+    // tokens are stored by value, so this is only valid until the next tokenize()/clear()
+    using PToken = const Token*;
+    using TokenList = QVector<Token>;
     explicit CppTokenizer();
 
     void clear();
     void tokenize(const QStringList& buffer);
     void dumpTokens(const QString& fileName);
     const TokenList& tokens();
-    PToken operator[](int i);
-    int tokenCount();
+    PToken operator[](int i) const {
+        return &mTokenList[i];
+    }
+    int tokenCount() const {
+        return mTokenList.count();
+    }
     bool isIdentChar(const QChar& ch);
+    /**
+     * @brief remove the tokens of the files in the set
+     *
+     * Files are told by the "#include file:line" lines of the preprocessed buffer.
+     * @return false if a kept token is paired with a removed one, tokens are unchanged then
+     */
+    bool removeTokensOfFiles(const QSet<QString>& files);
     int lambdasCount() const;
     int indexOfFirstLambda() const;
     void removeFirstLambda();
@@ -59,7 +72,7 @@ private:
     void addToken(const QString& sText, int iLine, TokenType tokenType);
     void advance();
     void countLines();
-    PToken getToken(int index);
+    QString internText(const QString& text);
 
     QString getForInit();
     QString getNextToken(
@@ -106,6 +119,7 @@ private:
     int mCurrentLine;
     QString mLastToken;
     TokenList mTokenList;
+    QSet<QString> mTextPool; // texts of tokens, so same tokens share one copy
     QList<int> mLambdas;
     QVector<int> mUnmatchedBraces; // stack of indices for unmatched '{'
     QVector<int> mUnmatchedBrackets; // stack of indices for unmatched '['
@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2020-2022 Roy Qu (royqh1979@gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "parserbenchmark.h"
+#include "cppparser.h"
+#include "cpppreprocessor.h"
+#include "cpptokenizer.h"
+#include "../settings.h"
+#include "../utils.h"
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QThread>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <psapi.h>
+#elif defined(Q_OS_MACOS)
+#include <mach/mach.h>
+#else
+#include <unistd.h>
+#endif
+
+#define BENCHMARK_PROJECT_HEADERS 250
+#define BENCHMARK_BIG_HEADER_BLOCKS 5000
+
+struct BenchmarkCorpus {
+    QString name;
+    QStringList files; // files to parse
+    bool isProject;
+};
+
+struct BenchmarkOptions {
+    QString compilerSetName;
+    QStringList includePaths;
+    QStringList defines;
+};
+
+static qint64 currentMemoryUsage()
+{
+#ifdef Q_OS_WIN
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.WorkingSetSize;
+    return 0;
+#elif defined(Q_OS_MACOS)
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+                  (task_info_t)&info, &count) != KERN_SUCCESS)
+        return 0;
+    return info.resident_size;
+#else
+    // the second field is the resident set size in pages
+    QFile file("/proc/self/statm");
+    if (!file.open(QFile::ReadOnly))
+        return 0;
+    QList<QByteArray> fields = file.readAll().split(' ');
+    if (fields.count()<2)
+        return 0;
+    return fields[1].toLongLong() * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+static BenchmarkOptions loadOptions()
+{
+    BenchmarkOptions options;
+    Settings::PCompilerSet compilerSet = pSettings->compilerSets().defaultSet();
+    if (!compilerSet)
+        return options;
+    options.compilerSetName = compilerSet->name();
+    options.includePaths.append(compilerSet->CppIncludeDirs());
+    options.includePaths.append(compilerSet->CIncludeDirs());
+    options.includePaths.append(compilerSet->defaultCppIncludeDirs());
+    options.includePaths.append(compilerSet->defaultCIncludeDirs());
+    options.defines = compilerSet->CppDefines();
+    // same as the defines added by resetCppParser()
+    options.defines.append("#define EGE_FOR_AUTO_CODE_COMPLETETION_ONLY");
+    options.defines.append("#define __FILE__  1");
+    options.defines.append("#define __LINE__  1");
+    options.defines.append("#define __DATE__  1");
+    options.defines.append("#define __TIME__  1");
+    return options;
+}
+
+static BenchmarkCorpus generateStdCppCorpus(const QString& folder)
+{
+    BenchmarkCorpus corpus;
+    corpus.name = "stdc++";
+    corpus.isProject = false;
+    QString fileName = includeTrailingPathDelimiter(folder)+"stdcpp.cpp";
+    stringsToFile(QStringList{
+                      "#include <bits/stdc++.h>",
+                      "using namespace std;",
+                      "int main() {",
+                      "    vector<int> v;",
+                      "    return 0;",
+                      "}"},
+                  fileName);
+    corpus.files.append(fileName);
+    return corpus;
+}
+
+static BenchmarkCorpus generateProjectCorpus(const QString& folder)
+{
+    BenchmarkCorpus corpus;
+    corpus.name = "project";
+    corpus.isProject = true;
+    QString dir = includeTrailingPathDelimiter(folder)+"project";
+    QDir().mkpath(dir);
+    dir = includeTrailingPathDelimiter(dir);
+    for (int i=0;i<BENCHMARK_PROJECT_HEADERS;i++) {
+        // headers include each other as a binary tree
+        int parent = (i-1)/2;
+        QStringList header;
+        header.append(QString("#ifndef UNIT_%1_H").arg(i));
+        header.append(QString("#define UNIT_%1_H").arg(i));
+        if (i>0)
+            header.append(QString("#include \"unit%1.h\"").arg(parent));
+        header.append(QString("#define UNIT_%1_SIZE %1").arg(i));
+        if (i>0)
+            header.append(QString("struct Unit%1 : public Unit%2 {").arg(i).arg(parent));
+        else
+            header.append(QString("struct Unit%1 {").arg(i));
+        header.append(QString("    int value%1;").arg(i));
+        header.append(QString("    int get%1() const;").arg(i));
+        header.append(QString("    void set%1(int v);").arg(i));
+        header.append("};");
+        header.append(QString("enum Unit%1Kind { Kind%1A, Kind%1B, Kind%1C };").arg(i));
+        header.append(QString("int unit%1Helper(int a, int b);").arg(i));
+        header.append("#endif");
+        QString headerName = dir+QString("unit%1.h").arg(i);
+        stringsToFile(header, headerName);
+
+        QStringList source;
+        source.append(QString("#include \"unit%1.h\"").arg(i));
+        source.append(QString("int Unit%1::get%1() const { return value%1; }").arg(i));
+        source.append(QString("void Unit%1::set%1(int v) { value%1 = v + UNIT_%1_SIZE; }").arg(i));
+        source.append(QString("int unit%1Helper(int a, int b) {").arg(i));
+        source.append("    int s = 0;");
+        source.append("    for (int k=a;k<b;k++) {");
+        source.append("        s+=k;");
+        source.append("    }");
+        source.append("    return s;");
+        source.append("}");
+        QString sourceName = dir+QString("unit%1.cpp").arg(i);
+        stringsToFile(source, sourceName);
+
+        corpus.files.append(headerName);
+        corpus.files.append(sourceName);
+    }
+    return corpus;
+}
+
+static BenchmarkCorpus generateBigHeaderCorpus(const QString& folder)
+{
+    BenchmarkCorpus corpus;
+    corpus.name = "big-header";
+    corpus.isProject = false;
+    QStringList header;
+    header.append("#ifndef BIG_H");
+    header.append("#define BIG_H");
+    for (int i=0;i<BENCHMARK_BIG_HEADER_BLOCKS;i++) {
+        header.append(QString("#define BIG_%1(x) ((x)+%1)").arg(i));
+        header.append(QString("struct Big%1 {").arg(i));
+        header.append(QString("    int a%1;").arg(i));
+        header.append(QString("    double b%1;").arg(i));
+        header.append(QString("    const char* c%1;").arg(i));
+        header.append(QString("    int sum() const { return a%1 + BIG_%1(1); }").arg(i));
+        header.append("};");
+        header.append(QString("int bigFunc%1(struct Big%1* p, int n);").arg(i));
+        header.append(QString("typedef struct Big%1 BigAlias%1;").arg(i));
+    }
+    header.append("#endif");
+    QString fileName = includeTrailingPathDelimiter(folder)+"big.h";
+    stringsToFile(header, fileName);
+    corpus.files.append(fileName);
+    return corpus;
+}
+
+static QJsonObject benchmarkParse(const BenchmarkCorpus& corpus, const BenchmarkOptions& options)
+{
+    qint64 memory = currentMemoryUsage();
+    QElapsedTimer timer;
+    timer.start();
+    PCppParser parser = std::make_shared<CppParser>();
+    parser->setLanguage(ParserLanguage::CPlusPlus);
+    parser->setEnabled(true);
+    parser->setParseGlobalHeaders(true);
+    parser->setParseLocalHeaders(true);
+    parser->setParseWorkerCount(pSettings->codeCompletion().parseWorkerCount());
+    foreach (const QString& path, options.includePaths)
+        parser->addIncludePath(path);
+    foreach (const QString& define, options.defines)
+        parser->addHardDefineByLine(define);
+    parser->parseHardDefines();
+    if (corpus.isProject) {
+        foreach (const QString& file, corpus.files)
+            parser->addProjectFile(file, true);
+        parser->parseFileList(false);
+    } else {
+        foreach (const QString& file, corpus.files)
+            parser->parseFile(file, false, false, false);
+    }
+    QJsonObject result;
+    result["name"]="parse";
+    result["ms"]=timer.elapsed();
+    result["memoryDelta"]=currentMemoryUsage() - memory;
+    result["scannedFiles"]=parser->scannedFiles().count();
+    result["statements"]=parser->statementList().count();
+    StatementMemoryUsage usage = parser->statementList().memoryUsage();
+    QJsonObject statementMemory;
+    statementMemory["statements"]=usage.statementCount;
+    statementMemory["statementBytes"]=usage.statementBytes;
+    statementMemory["stringBytes"]=usage.stringBytes;
+    statementMemory["sharedStringBytes"]=usage.sharedStringBytes;
+    statementMemory["stringPoolCount"]=usage.stringPoolCount;
+    result["statementMemory"]=statementMemory;
+    return result;
+}
+
+static QJsonObject benchmarkPreprocess(const BenchmarkCorpus& corpus, const BenchmarkOptions& options,
+                                       QList<QStringList>& results)
+{
+    qint64 memory = currentMemoryUsage();
+    QElapsedTimer timer;
+    timer.start();
+    CppPreprocessor preprocessor;
+    foreach (const QString& path, options.includePaths)
+        preprocessor.addIncludePath(includeTrailingPathDelimiter(path));
+    foreach (const QString& define, options.defines) {
+        if (define.startsWith('#'))
+            preprocessor.addHardDefineByLine(define.mid(1).trimmed());
+        else
+            preprocessor.addHardDefineByLine(define);
+    }
+    preprocessor.setScanOptions(true, true);
+    int lines = 0;
+    foreach (const QString& file, corpus.files) {
+        if (preprocessor.scannedFiles().contains(file))
+            continue;
+        preprocessor.preprocess(file);
+        results.append(preprocessor.result());
+        lines += results.back().count();
+        preprocessor.clearTempResults();
+    }
+    QJsonObject result;
+    result["name"]="preprocess";
+    result["ms"]=timer.elapsed();
+    result["memoryDelta"]=currentMemoryUsage() - memory;
+    result["lines"]=lines;
+    return result;
+}
+
+static QJsonObject benchmarkTokenize(const QList<QStringList>& preprocessResults)
+{
+    qint64 memory = currentMemoryUsage();
+    QElapsedTimer timer;
+    timer.start();
+    CppTokenizer tokenizer;
+    int tokens = 0;
+    foreach (const QStringList& buffer, preprocessResults) {
+        tokenizer.tokenize(buffer);
+        tokens += tokenizer.tokenCount();
+    }
+    QJsonObject result;
+    result["name"]="tokenize";
+    result["ms"]=timer.elapsed();
+    result["memoryDelta"]=currentMemoryUsage() - memory;
+    result["tokens"]=tokens;
+    return result;
+}
+
+int runParserBenchmark(const QString &outputFile)
+{
+    QTemporaryDir dir;
+    if (!dir.isValid())
+        return -1;
+    BenchmarkOptions options = loadOptions();
+    QList<BenchmarkCorpus> corpora;
+    corpora.append(generateStdCppCorpus(dir.path()));
+    corpora.append(generateProjectCorpus(dir.path()));
+    corpora.append(generateBigHeaderCorpus(dir.path()));
+
+    QJsonArray corporaResults;
+    foreach (const BenchmarkCorpus& corpus, corpora) {
+        QJsonArray phases;
+        // parse first, so it's not helped by headers cached by the other phases
+        phases.append(benchmarkParse(corpus, options));
+        QList<QStringList> preprocessResults;
+        phases.append(benchmarkPreprocess(corpus, options, preprocessResults));
+        phases.append(benchmarkTokenize(preprocessResults));
+        QJsonObject corpusResult;
+        corpusResult["name"]=corpus.name;
+        corpusResult["files"]=corpus.files.count();
+        corpusResult["phases"]=phases;
+        corporaResults.append(corpusResult);
+    }
+    QJsonObject root;
+    root["version"]=REDPANDA_CPP_VERSION;
+    root["qtVersion"]=qVersion();
+    root["compilerSet"]=options.compilerSetName;
+    root["idealThreadCount"]=QThread::idealThreadCount();
+    root["corpora"]=corporaResults;
+
+    QFile file;
+    bool opened;
+    if (outputFile.isEmpty()) {
+        opened = file.open(stdout, QFile::WriteOnly);
+    } else {
+        file.setFileName(outputFile);
+        opened = file.open(QFile::WriteOnly | QFile::Truncate);
+    }
+    if (!opened)
+        return -1;
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Indented));
+    return 0;
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2020-2022 Roy Qu (royqh1979@gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PARSERBENCHMARK_H
+#define PARSERBENCHMARK_H
+
+#include <QString>
+
+#define PARSER_BENCHMARK_OPTION "--benchmark-parser"
+
+/**
+ * @brief run the preprocessor, tokenizer and parser over fixed generated corpora
+ *
+ * The corpora are a translation unit including <bits/stdc++.h>, a 500 files project
+ * and a large header. For each corpus and phase the wall time, the growth of the process'
+ * resident memory during the phase and the produced lines/tokens/statements are written as json.
+ * The parse phase also reports the estimated memory used by the statements and their strings.
+ * Include paths and defines are taken from the default compiler set.
+ * @param outputFile the json file to write. If empty, write to stdout
+ * @return exit code of the program
+ */
+int runParserBenchmark(const QString& outputFile);
+
+#endif // PARSERBENCHMARK_H
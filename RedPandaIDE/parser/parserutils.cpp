@@ -21,6 +21,10 @@
 #include <QFileInfo>
 #include <QDebug>
 #include <QGlobalStatic>
+#include <QCoreApplication>
+#include <QFileSystemWatcher>
+#include <QAtomicInt>
+#include <QMutex>
 #include "../utils.h"
 
 QStringList CppDirectives;
@@ -38,6 +42,21 @@ QSet<QString> MemberOperators;
 QSet<QString> IOManipulators;
 QSet<QString> AutoTypes;
 
+struct DirectoryListing {
+    bool exists;
+    bool caseInsensitive; // the file system ignores case, entries are in lower case
+    QSet<QString> entries; // names of files and sub directories
+};
+using PDirectoryListing = std::shared_ptr<DirectoryListing>;
+
+// listings of directories searched for header files, shared by all parsers
+static QMutex directoryListingsMutex;
+static QHash<QString,PDirectoryListing> directoryListings;
+// include directories, only listings of them and their sub directories are cached
+static QSet<QString> watchedDirectories;
+static QFileSystemWatcher* directoryWatcher = nullptr;
+static QAtomicInt directoryListingsGeneration;
+
 Q_GLOBAL_STATIC(QSet<QString>,CppHeaderExts)
 Q_GLOBAL_STATIC(QSet<QString>,CppSourceExts)
 
@@ -378,6 +397,156 @@ void initParser()
     IOManipulators.insert("std::flush");
     IOManipulators.insert("std::endl");
 
+    // created in the gui thread, so it can receive change notifications
+    directoryWatcher = new QFileSystemWatcher(QCoreApplication::instance());
+    QObject::connect(directoryWatcher, &QFileSystemWatcher::directoryChanged,
+                     [](const QString& path) {
+        QMutexLocker locker(&directoryListingsMutex);
+        QString prefix = path.endsWith('/')?path:path+'/';
+        QHash<QString,PDirectoryListing>::iterator it = directoryListings.begin();
+        while (it!=directoryListings.end()) {
+            if (it.key()==path || it.key().startsWith(prefix))
+                it = directoryListings.erase(it);
+            else
+                ++it;
+        }
+        directoryListingsGeneration.fetchAndAddRelaxed(1);
+    });
+}
+
+static QString directoryEntryKey(const QString& name, bool caseInsensitive)
+{
+    return caseInsensitive?name.toLower():name;
+}
+
+// path must be cleaned, returns itself for roots
+static QString parentDirectoryPath(const QString& path)
+{
+    int pos = path.lastIndexOf('/');
+    if (pos<0)
+        return path;
+    if (pos==0 || (pos==2 && path[1]==':')) // '/' or 'c:/'
+        return path.left(pos+1);
+    return path.left(pos);
+}
+
+// looks up an entry by another case of its name
+static bool isCaseInsensitiveDirectory(const QDir& dir, const QStringList& names)
+{
+    QSet<QString> nameSet;
+    foreach (const QString& name, names)
+        nameSet.insert(name);
+    foreach (const QString& name, names) {
+        QString otherCase = name.toUpper();
+        if (otherCase == name)
+            otherCase = name.toLower();
+        if (otherCase == name || nameSet.contains(otherCase))
+            continue;
+        return QFileInfo::exists(dir.filePath(otherCase));
+    }
+#if defined(Q_OS_WIN) || defined(Q_OS_MACOS)
+    return true;
+#else
+    return false;
+#endif
+}
+
+// directoryListingsMutex must be locked, returns empty if the path is not in a watched directory
+static QString findWatchedDirectory(const QString& path)
+{
+    QString dirPath = path;
+    while (true) {
+        if (watchedDirectories.contains(dirPath))
+            return dirPath;
+        QString parentPath = parentDirectoryPath(dirPath);
+        if (parentPath == dirPath)
+            return QString();
+        dirPath = parentPath;
+    }
+}
+
+// directoryListingsMutex must be locked, path must be in the watched directory root
+static PDirectoryListing getDirectoryListing(const QString& path, const QString& root)
+{
+    PDirectoryListing listing = directoryListings.value(path);
+    if (listing)
+        return listing;
+    listing = std::make_shared<DirectoryListing>();
+    QDir dir(path);
+    QStringList names;
+    if (path!=root) {
+        int pos = path.lastIndexOf('/');
+        // the parent's listing tells if the directory exists, and its watcher
+        // tells when the directory is created or removed
+        PDirectoryListing parent = getDirectoryListing(parentDirectoryPath(path), root);
+        listing->exists = parent->exists
+                && parent->entries.contains(directoryEntryKey(path.mid(pos+1),parent->caseInsensitive));
+        listing->caseInsensitive = parent->caseInsensitive;
+        if (listing->exists)
+            names = dir.entryList(QDir::AllEntries | QDir::NoDotAndDotDot
+                                  | QDir::Hidden | QDir::System);
+    } else {
+        listing->exists = dir.exists();
+        // nothing watches the creation of a missing include directory
+        if (!listing->exists)
+            return listing;
+        names = dir.entryList(QDir::AllEntries | QDir::NoDotAndDotDot
+                              | QDir::Hidden | QDir::System);
+        listing->caseInsensitive = isCaseInsensitiveDirectory(dir, names);
+    }
+    if (listing->exists) {
+        foreach (const QString& name, names) {
+            listing->entries.insert(directoryEntryKey(name, listing->caseInsensitive));
+        }
+        QMetaObject::invokeMethod(directoryWatcher, [path]() {
+            if (!directoryWatcher->directories().contains(path))
+                directoryWatcher->addPath(path);
+        }, Qt::QueuedConnection);
+    }
+    directoryListings.insert(path,listing);
+    return listing;
+}
+
+void watchIncludeDirectory(const QString &path)
+{
+    QString dirPath = QDir::cleanPath(QDir(path).absolutePath());
+    QMutexLocker locker(&directoryListingsMutex);
+    watchedDirectories.insert(dirPath);
+}
+
+bool isWatchedDirectory(const QString &path)
+{
+    if (!directoryWatcher)
+        return false;
+    QString dirPath = QDir::cleanPath(QDir(path).absolutePath());
+    QMutexLocker locker(&directoryListingsMutex);
+    return !findWatchedDirectory(dirPath).isEmpty();
+}
+
+bool cachedFileExists(const QString &fileName)
+{
+    if (!directoryWatcher)
+        return QFileInfo::exists(fileName);
+    QString path = QDir::cleanPath(QDir(fileName).absolutePath());
+    QString dirPath = parentDirectoryPath(path);
+    if (dirPath==path)
+        return QFileInfo::exists(fileName);
+    int pos = path.lastIndexOf('/');
+    QMutexLocker locker(&directoryListingsMutex);
+    QString root = findWatchedDirectory(dirPath);
+    // changes of other directories are not watched
+    if (root.isEmpty()) {
+        locker.unlock();
+        return QFileInfo::exists(fileName);
+    }
+    PDirectoryListing listing = getDirectoryListing(dirPath, root);
+    return listing->exists
+            && listing->entries.contains(directoryEntryKey(path.mid(pos+1),listing->caseInsensitive));
+}
+
+int cachedFileGeneration()
+{
+    return directoryListingsGeneration.loadAcquire();
 }
 
 QString getHeaderFilename(const QString &relativeTo, const QString &line,
@@ -423,8 +592,9 @@ QString getLocalHeaderFilename(const QString &relativeTo, const QString &fileNam
     QFileInfo relativeFile(relativeTo);
     QDir dir = relativeFile.dir();
     // Search local directory
-    if (dir.exists(fileName)) {
-        return cleanPath(dir.absoluteFilePath(fileName));
+    QString fullName = dir.absoluteFilePath(fileName);
+    if (cachedFileExists(fullName)) {
+        return cleanPath(fullName);
     }
     return "";
 }
@@ -435,8 +605,9 @@ QString getSystemHeaderFilename(const QString &fileName, const QStringList& incl
     // Search compiler include directories
     for (const QString& path:includePaths) {
         QDir dir(path);
-        if (dir.exists(fileName)) {
-            return cleanPath(dir.absoluteFilePath(fileName));
+        QString fullName = dir.absoluteFilePath(fileName);
+        if (cachedFileExists(fullName)) {
+            return cleanPath(fullName);
         }
     }
     //not found
@@ -459,7 +630,7 @@ bool isSystemHeaderFile(const QString &fileName, const QSet<QString> &includePat
     if (isFullName) {
         QFileInfo info(fileName);
         // If it's a full file name, check if its directory is an include path
-        if (info.exists()) { // full file name
+        if (cachedFileExists(fileName)) { // full file name
             QDir dir = info.dir();
             QString absPath = includeTrailingPathDelimiter(dir.absolutePath());
             foreach (const QString& incPath, includePaths) {
@@ -471,7 +642,7 @@ bool isSystemHeaderFile(const QString &fileName, const QSet<QString> &includePat
         //check if it's in the include dir
         for (const QString& includePath: includePaths) {
             QDir dir(includePath);
-            if (dir.exists(fileName))
+            if (cachedFileExists(dir.absoluteFilePath(fileName)))
                 return true;
         }
     }
@@ -558,6 +729,48 @@ void CppScopes::clear()
     mScopes.clear();
 }
 
+const QVector<PCppScope> &CppScopes::scopes() const
+{
+    return mScopes;
+}
+
+void CppScopes::replaceScopes(int startIndex, int endIndex, const QVector<PCppScope> &scopes, int lineDelta)
+{
+    QVector<PCppScope> newScopes;
+    newScopes.reserve(mScopes.count()-(endIndex-startIndex)+scopes.count());
+    for (int i=0;i<startIndex;i++)
+        newScopes.append(mScopes[i]);
+    newScopes.append(scopes);
+    for (int i=endIndex;i<mScopes.count();i++) {
+        mScopes[i]->startLine += lineDelta;
+        newScopes.append(mScopes[i]);
+    }
+    mScopes = newScopes;
+}
+
+quint64 identCharMask(const QString &name)
+{
+    quint64 mask = 0;
+    foreach (const QChar& ch, name) {
+        ushort u = ch.unicode();
+        int bit;
+        if (u>='a' && u<='z')
+            bit = u - 'a';
+        else if (u>='A' && u<='Z')
+            bit = u - 'A';
+        else if (u>='0' && u<='9')
+            bit = 26 + (u - '0');
+        else if (u=='_')
+            bit = 36;
+        else if (u<128)
+            bit = 37 + (u % 26);
+        else
+            bit = 63; // non-ascii chars may change when case is ignored
+        mask |= ((quint64)1 << bit);
+    }
+    return mask;
+}
+
 MemberOperatorType getOperatorType(const QString &phrase, int index)
 {
     if (index>=phrase.length())
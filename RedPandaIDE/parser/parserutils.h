@@ -16,6 +16,7 @@
  */
 #ifndef PARSER_UTILS_H
 #define PARSER_UTILS_H
+#include <QHash>
 #include <QMap>
 #include <QObject>
 #include <QSet>
@@ -40,15 +41,22 @@ struct CodeSnippet {
 using PCodeSnippet = std::shared_ptr<CodeSnippet>;
 
 // preprocess/ macro define
+struct DefineValuePart {
+    QString text; // text before the argument
+    int argIndex; // index of the argument in argList, -1 if none
+    bool stringify; // '#' before the argument
+    bool pasted; // operand of '##', the argument is not macro expanded
+};
+
 struct Define {
     QString name;
     QString args;
     QString value;
     QString filename;
     bool hardCoded;// if true, don't free memory (points to hard defines)
+    bool variadic; // last arg is '...' or 'name...'
     QStringList argList; // args list to format values
-    QList<bool> argUsed;
-    QString formatValue; // format template to format values
+    QList<DefineValuePart> valueParts; // compiled value of function-like defines
 };
 
 using PDefine = std::shared_ptr<Define>;
@@ -159,13 +167,12 @@ Q_DECLARE_OPERATORS_FOR_FLAGS(StatementProperties)
 
 
 
-using PStatementMathPosition = std::shared_ptr<StatementMatchPosition>;
-
 struct Statement;
 using PStatement = std::shared_ptr<Statement>;
 using StatementList = QList<PStatement>;
 using PStatementList = std::shared_ptr<StatementList>;
-using StatementMap = QMultiMap<QString, PStatement>;
+// members are looked up by name far more often than listed in order
+using StatementMap = QMultiHash<QString, PStatement>;
 struct Statement {
 //    Statement();
 //    ~Statement();
@@ -186,15 +193,11 @@ struct Statement {
     QString fullName; // fullname(including class and namespace), ClassA::foo
     QSet<QString> usingList; // using namespaces
     QString noNameArgs;// Args without name
+    QList<QString> internedStrings; // strings counted in the string pool of the statement model
     StatementProperties properties;
 
     // fields for code completion
     int usageCount; //Usage Count
-    int matchPosTotal; // total of matched positions
-    int matchPosSpan; // distance between the first match pos and the last match pos;
-    int firstMatchLength; // length of first match;
-    int caseMatched; // if match with case
-    QList<PStatementMathPosition> matchPositions;
 
     // definiton line/filename is valid
     bool hasDefinition() {
@@ -280,6 +283,12 @@ public:
     PStatement lastScope();
     void removeLastScope();
     void clear();
+    const QVector<PCppScope>& scopes() const;
+    /**
+     * @brief replace scopes in [startIndex, endIndex) with the given scopes,
+     * and move the scopes after them by lineDelta lines
+     */
+    void replaceScopes(int startIndex, int endIndex, const QVector<PCppScope>& scopes, int lineDelta);
 private:
     QVector<PCppScope> mScopes;
 };
@@ -319,12 +328,41 @@ QString getLocalHeaderFilename(const QString& relativeTo, const QString& fileNam
 
 QString getSystemHeaderFilename(const QString& fileName, const QStringList& includePaths);
 bool isSystemHeaderFile(const QString& fileName, const QSet<QString>& includePaths);
+/**
+ * @brief cache and watch listings of the include directory and its sub directories
+ */
+void watchIncludeDirectory(const QString& path);
+/**
+ * @brief check if the directory is in a watched include directory
+ *
+ * Changes in it bump cachedFileGeneration().
+ */
+bool isWatchedDirectory(const QString& path);
+/**
+ * @brief check if the file exists, using cached listings of its directory
+ *
+ * Listings of include directories are read once and dropped when the directory changes,
+ * so looking up headers in include paths doesn't stat the file system again and again.
+ * Files in other directories are checked on the file system.
+ */
+bool cachedFileExists(const QString& fileName);
+/**
+ * @brief changed each time cached directory listings are dropped
+ */
+int cachedFileGeneration();
 bool isHFile(const QString& filename);
 bool isCFile(const QString& filename);
 bool isCppFile(const QString& filename);
 bool isCppKeyword(const QString& word);
 bool isCppControlKeyword(const QString& word);
 bool isScopeTypeKind(StatementKind kind);
+/**
+ * @brief bit set of the chars in the name, ignoring case
+ *
+ * Ascii letters, digits and '_' have their own bits, other chars share the rest.
+ * A name can only contain a phrase if its mask contains the phrase's mask.
+ */
+quint64 identCharMask(const QString& name);
 MemberOperatorType getOperatorType(const QString& phrase, int index);
 QStringList getOwnerExpressionAndMember(
         const QStringList expression,
@@ -19,6 +19,21 @@
 #include <QFile>
 #include <QTextStream>
 
+// if all chars of the phrase appear in the name in order
+static bool isSubsequenceOf(const QString& foldedPhrase, const QString& foldedName)
+{
+    int pos = 0;
+    int len = foldedName.length();
+    foreach (const QChar& ch, foldedPhrase) {
+        while (pos<len && foldedName[pos]!=ch)
+            pos++;
+        if (pos>=len)
+            return false;
+        pos++;
+    }
+    return true;
+}
+
 StatementModel::StatementModel(QObject *parent) : QObject(parent)
 {
     mCount = 0;
@@ -29,11 +44,18 @@ void StatementModel::add(const PStatement& statement)
     if (!statement) {
         return ;
     }
+    internStrings(statement);
     PStatement parent = statement->parentScope.lock();
     if (parent) {
-        addMember(parent->children,statement);
+        if (mSharedStatements.contains(parent.get()))
+            addMember(sharedChildren(parent.get()),statement);
+        else
+            addMember(parent->children,statement);
+        if (parent->kind == StatementKind::skNamespace)
+            addName(parent.get(), statement->command, 1);
     } else {
         addMember(mGlobalStatements,statement);
+        addName(nullptr, statement->command, 1);
     }
     mCount++;
 #ifdef QT_DEBUG
@@ -42,6 +64,19 @@ void StatementModel::add(const PStatement& statement)
 
 }
 
+void StatementModel::addSharedStatements(const StatementMap &statements, int count)
+{
+    if (mGlobalStatements.isEmpty())
+        mGlobalStatements = statements;
+    else
+        mGlobalStatements.unite(statements);
+    for (auto it=statements.constBegin();it!=statements.constEnd();++it) {
+        addName(nullptr, it.key(), 1);
+        addSharedStatement(it.value());
+    }
+    mCount += count;
+}
+
 void StatementModel::deleteStatement(const PStatement& statement)
 {
     if (!statement) {
@@ -50,9 +85,20 @@ void StatementModel::deleteStatement(const PStatement& statement)
     PStatement parent = statement->parentScope.lock();
     int count = 0;
     if (parent) {
-        count = deleteMember(parent->children,statement);
+        if (mSharedStatements.contains(parent.get()))
+            count = deleteMember(sharedChildren(parent.get()),statement);
+        else
+            count = deleteMember(parent->children,statement);
+        if (parent->kind == StatementKind::skNamespace)
+            removeName(parent.get(), statement->command, count);
     } else {
         count = deleteMember(mGlobalStatements,statement);
+        removeName(nullptr, statement->command, count);
+    }
+    // children are dropped with it
+    if (count>0) {
+        releaseStrings(statement);
+        removeNameIndexes(statement);
     }
     mCount -= count;
 #ifdef QT_DEBUG
@@ -65,9 +111,11 @@ const StatementMap &StatementModel::childrenStatements(const PStatement& stateme
 {
     if (!statement) {
         return mGlobalStatements;
-    } else {
-        return statement->children;
     }
+    auto it = mSharedStatementChildren.constFind(statement.get());
+    if (it!=mSharedStatementChildren.constEnd())
+        return it.value();
+    return statement->children;
 }
 
 const StatementMap &StatementModel::childrenStatements(std::weak_ptr<Statement> statement) const
@@ -79,11 +127,82 @@ const StatementMap &StatementModel::childrenStatements(std::weak_ptr<Statement>
 void StatementModel::clear() {
     mCount=0;
     mGlobalStatements.clear();
+    mNameIndexes.clear();
+    mSharedStatements.clear();
+    mSharedStatementChildren.clear();
+    mStringPool.clear();
 #ifdef QT_DEBUG
     mAllStatements.clear();
 #endif
 }
 
+void StatementModel::copyFrom(const StatementModel &model, QHash<const Statement *, PStatement> &copies)
+{
+    clear();
+    mCount = model.mCount;
+    mStringPool = model.mStringPool;
+    mSharedStatements = model.mSharedStatements;
+    mGlobalStatements = copyMembers(model.mGlobalStatements, copies);
+    for (auto it=model.mSharedStatementChildren.constBegin();it!=model.mSharedStatementChildren.constEnd();++it) {
+        mSharedStatementChildren.insert(it.key(),copyMembers(it.value(), copies));
+    }
+    // a statement may be copied before its parent (typedef struct has multiple parents)
+    for (auto it=copies.begin();it!=copies.end();++it) {
+        PStatement parent = it.value()->parentScope.lock();
+        if (parent) {
+            PStatement parentCopy = copies.value(parent.get());
+            if (parentCopy)
+                it.value()->parentScope = parentCopy;
+        }
+    }
+    for (auto it=model.mNameIndexes.constBegin();it!=model.mNameIndexes.constEnd();++it) {
+        PStatement scopeCopy = copies.value(it.key());
+        mNameIndexes.insert(scopeCopy?scopeCopy.get():it.key(), it.value());
+    }
+#ifdef QT_DEBUG
+    foreach (const PStatement& statement, model.mAllStatements) {
+        mAllStatements.append(copies.value(statement.get(),statement));
+    }
+#endif
+}
+
+int StatementModel::count() const
+{
+    return mCount;
+}
+
+QStringList StatementModel::findNames(const PStatement &scope, const QString &phrase) const
+{
+    QStringList result;
+    auto indexIt = mNameIndexes.constFind(scope.get());
+    if (indexIt==mNameIndexes.constEnd())
+        return result;
+    const NameIndex& index = indexIt.value();
+    QString foldedPhrase = phrase.toLower();
+    if (foldedPhrase.isEmpty())
+        return index.items.keys();
+    // only the names containing the rarest char of the phrase are checked
+    const QSet<QString>* candidates = nullptr;
+    foreach (const QChar& ch, foldedPhrase) {
+        auto it = index.namesByChar.constFind(ch);
+        if (it==index.namesByChar.constEnd())
+            return result;
+        if (!candidates || it.value().count()<candidates->count())
+            candidates = &it.value();
+    }
+    quint64 mask = identCharMask(foldedPhrase);
+    foreach (const QString& name, *candidates) {
+        const NameIndexItem& item = index.items.constFind(name).value();
+        // most names are rejected by the char mask without looking at the chars
+        if ((item.charMask & mask) != mask)
+            continue;
+        if (!isSubsequenceOf(foldedPhrase, item.foldedName))
+            continue;
+        result.append(name);
+    }
+    return result;
+}
+
 void StatementModel::dump(const QString &logFile)
 {
     QFile file(logFile);
@@ -93,6 +212,49 @@ void StatementModel::dump(const QString &logFile)
     }
 }
 
+static void countStatementMemory(const StatementModel& model,
+                                 const StatementMap& map,
+                                 int& statementCount,
+                                 qint64& stringBytes,
+                                 QSet<const void*>& stringData,
+                                 qint64& sharedStringBytes)
+{
+    foreach (const PStatement& statement, map) {
+        statementCount++;
+        const QString* strings[] = {
+            &statement->type, &statement->command, &statement->args, &statement->value,
+            &statement->noNameArgs, &statement->fullName,
+            &statement->fileName, &statement->definitionFileName
+        };
+        for (const QString* s:strings) {
+            if (s->isEmpty())
+                continue;
+            qint64 bytes = sizeof(QArrayData) + (s->capacity()+1) * sizeof(QChar);
+            stringBytes += bytes;
+            if (!stringData.contains(s->constData())) {
+                stringData.insert(s->constData());
+                sharedStringBytes += bytes;
+            }
+        }
+        countStatementMemory(model, model.childrenStatements(statement), statementCount,
+                             stringBytes, stringData, sharedStringBytes);
+    }
+}
+
+StatementMemoryUsage StatementModel::memoryUsage() const
+{
+    StatementMemoryUsage usage;
+    usage.statementCount = 0;
+    usage.stringBytes = 0;
+    usage.sharedStringBytes = 0;
+    QSet<const void*> stringData;
+    countStatementMemory(*this, mGlobalStatements, usage.statementCount,
+                         usage.stringBytes, stringData, usage.sharedStringBytes);
+    usage.statementBytes = (qint64)usage.statementCount * sizeof(Statement);
+    usage.stringPoolCount = mStringPool.count();
+    return usage;
+}
+
 #ifdef QT_DEBUG
 void StatementModel::dumpAll(const QString &logFile)
 {
@@ -127,6 +289,145 @@ void StatementModel::addMember(StatementMap &map, const PStatement& statement)
 //    lst->append(statement);
 }
 
+void StatementModel::addName(const Statement *scope, const QString &name, int count)
+{
+    NameIndex& index = mNameIndexes[scope];
+    auto it = index.items.find(name);
+    if (it!=index.items.end()) {
+        it->count += count;
+        return;
+    }
+    NameIndexItem item;
+    item.foldedName = name.toLower();
+    item.charMask = identCharMask(item.foldedName);
+    item.count = count;
+    index.items.insert(name, item);
+    foreach (const QChar& ch, item.foldedName)
+        index.namesByChar[ch].insert(name);
+}
+
+void StatementModel::removeName(const Statement *scope, const QString &name, int count)
+{
+    auto indexIt = mNameIndexes.find(scope);
+    if (indexIt==mNameIndexes.end())
+        return;
+    NameIndex& index = indexIt.value();
+    auto it = index.items.find(name);
+    if (it==index.items.end())
+        return;
+    it->count -= count;
+    if (it->count>0)
+        return;
+    foreach (const QChar& ch, it->foldedName) {
+        auto charIt = index.namesByChar.find(ch);
+        if (charIt==index.namesByChar.end())
+            continue;
+        charIt->remove(name);
+        if (charIt->isEmpty())
+            index.namesByChar.erase(charIt);
+    }
+    index.items.erase(it);
+    if (index.items.isEmpty())
+        mNameIndexes.erase(indexIt);
+}
+
+// indexes of removed namespaces are dropped, their addresses may be reused by new statements
+void StatementModel::removeNameIndexes(const PStatement &statement)
+{
+    if (statement->kind != StatementKind::skNamespace)
+        return;
+    mNameIndexes.remove(statement.get());
+    foreach (const PStatement& child, childrenStatements(statement))
+        removeNameIndexes(child);
+}
+
+void StatementModel::internStrings(const PStatement &statement)
+{
+    QString* fields[] = {
+        &statement->type, &statement->command, &statement->args, &statement->value,
+        &statement->noNameArgs, &statement->fullName,
+        &statement->fileName, &statement->definitionFileName
+    };
+    for (QString* field:fields) {
+        if (field->isEmpty())
+            continue;
+        intern(*field);
+        // fields may be changed later, so the interned strings are released instead of them
+        statement->internedStrings.append(*field);
+    }
+}
+
+void StatementModel::releaseStrings(const PStatement &statement)
+{
+    foreach (const QString& s, statement->internedStrings)
+        release(s);
+    statement->internedStrings.clear();
+    foreach (const PStatement& child, childrenStatements(statement))
+        releaseStrings(child);
+}
+
+void StatementModel::intern(QString &s)
+{
+    auto it = mStringPool.find(s);
+    if (it!=mStringPool.end()) {
+        s = it.key();
+        it.value()++;
+    } else {
+        mStringPool.insert(s,1);
+    }
+}
+
+void StatementModel::release(const QString &s)
+{
+    auto it = mStringPool.find(s);
+    if (it==mStringPool.end())
+        return;
+    if (--it.value()<=0)
+        mStringPool.erase(it);
+}
+
+void StatementModel::addSharedStatement(const PStatement &statement)
+{
+    mSharedStatements.insert(statement.get());
+    foreach (const PStatement& child, statement->children) {
+        if (statement->kind == StatementKind::skNamespace)
+            addName(statement.get(), child->command, 1);
+        addSharedStatement(child);
+    }
+}
+
+StatementMap StatementModel::copyMembers(const StatementMap &map, QHash<const Statement *, PStatement> &copies) const
+{
+    // replacing the values keeps the order of overloaded members
+    StatementMap result = map;
+    for (auto it=result.begin();it!=result.end();++it) {
+        it.value() = copyStatement(it.value(), copies);
+    }
+    return result;
+}
+
+PStatement StatementModel::copyStatement(const PStatement &statement, QHash<const Statement *, PStatement> &copies) const
+{
+    // shared statements are never changed
+    if (mSharedStatements.contains(statement.get()))
+        return statement;
+    PStatement copy = copies.value(statement.get());
+    if (copy)
+        return copy;
+    copy = std::make_shared<Statement>(*statement);
+    copies.insert(statement.get(),copy);
+    copy->children = copyMembers(statement->children, copies);
+    return copy;
+}
+
+StatementMap &StatementModel::sharedChildren(const Statement *statement)
+{
+    auto it = mSharedStatementChildren.find(statement);
+    if (it==mSharedStatementChildren.end())
+        it = mSharedStatementChildren.insert(statement, statement->children);
+    return it.value();
+}
+
 int StatementModel::deleteMember(StatementMap &map, const PStatement& statement)
 {
     if (!statement)
@@ -134,7 +435,7 @@ int StatementModel::deleteMember(StatementMap &map, const PStatement& statement)
     return map.remove(statement->command,statement);
 }
 
-void StatementModel::dumpStatementMap(StatementMap &map, QTextStream &out, int level)
+void StatementModel::dumpStatementMap(const StatementMap &map, QTextStream &out, int level)
 {
     QString indent(level,'\t');
     foreach (const PStatement& statement,map) {
@@ -155,7 +456,8 @@ void StatementModel::dumpStatementMap(StatementMap &map, QTextStream &out, int l
         #else
                          <<endl;
         #endif
-        if (statement->children.isEmpty())
+        const StatementMap& children = childrenStatements(statement);
+        if (children.isEmpty())
             continue;
         out<<indent<<statement->command<<" {"
      #if QT_VERSION >= QT_VERSION_CHECK(5,15,0)
@@ -163,7 +465,7 @@ void StatementModel::dumpStatementMap(StatementMap &map, QTextStream &out, int l
      #else
                       <<endl;
      #endif
-        dumpStatementMap(statement->children,out,level+1);
+        dumpStatementMap(children,out,level+1);
         out<<indent<<"}"
      #if QT_VERSION >= QT_VERSION_CHECK(5,15,0)
                       <<Qt::endl;
@@ -21,6 +21,30 @@
 #include <QTextStream>
 #include "parserutils.h"
 
+// memory used by the statements of a model
+struct StatementMemoryUsage {
+    int statementCount;
+    qint64 statementBytes; // without strings
+    qint64 stringBytes; // strings if they were not shared
+    qint64 sharedStringBytes; // strings actually used
+    int stringPoolCount; // strings in the string pool
+};
+
+// a name of the statements in a scope, for the fast lookup in code completion
+struct NameIndexItem {
+    QString foldedName; // lower case
+    quint64 charMask; // chars in the name, see identCharMask()
+    int count; // count of statements with the name in the scope
+};
+
+// names of the statements in a scope
+struct NameIndex {
+    QHash<QString,NameIndexItem> items; // by name
+    // names by the (lower case) chars in them,
+    // a lookup only checks the names containing the rarest char of the phrase
+    QHash<QChar,QSet<QString>> namesByChar;
+};
+
 class StatementModel : public QObject
 {
     Q_OBJECT
@@ -28,23 +52,72 @@ public:
     explicit StatementModel(QObject *parent = nullptr);
 
     void add(const PStatement& statement);
+    /**
+     * @brief add global statements shared with other models
+     *
+     * The statements and their children must not be changed after they are added.
+     * Children added to them later are only kept by this model, see childrenStatements().
+     * @param statements
+     * @param count count of the statements and all their children
+     */
+    void addSharedStatements(const StatementMap& statements, int count);
+    void internStrings(const PStatement& statement);
 //    function DeleteFirst: Integer;
 //    function DeleteLast: Integer;
     void deleteStatement(const PStatement& statement);
     const StatementMap& childrenStatements(const PStatement& statement = PStatement()) const;
     const StatementMap& childrenStatements(std::weak_ptr<Statement> statement) const;
     void clear();
+    /**
+     * @brief make this model a copy of the model, that doesn't share changeable statements with it
+     *
+     * Shared statements are kept, other statements are copied.
+     * @param copies the copy of each copied statement, by the original one
+     */
+    void copyFrom(const StatementModel& model, QHash<const Statement*,PStatement>& copies);
+    int count() const;
+    /**
+     * @brief names of the statements in the scope that may match the phrase in code completion
+     *
+     * Only global statements (null scope) and members of namespaces are indexed,
+     * nothing is returned for other scopes.
+     * A name is returned if it contains all chars of the phrase in order, ignoring case.
+     * If the phrase is empty, all names are returned.
+     */
+    QStringList findNames(const PStatement& scope, const QString& phrase) const;
     void dump(const QString& logFile);
+    /**
+     * @brief statement count and estimated memory usage of statements and their strings
+     */
+    StatementMemoryUsage memoryUsage() const;
 #ifdef QT_DEBUG
     void dumpAll(const QString& logFile);
 #endif
 private:
     void addMember(StatementMap& map, const PStatement& statement);
+    void addName(const Statement* scope, const QString& name, int count);
+    void removeName(const Statement* scope, const QString& name, int count);
+    void removeNameIndexes(const PStatement& statement);
     int deleteMember(StatementMap& map, const PStatement& statement);
-    void dumpStatementMap(StatementMap& map, QTextStream& out, int level);
+    void dumpStatementMap(const StatementMap& map, QTextStream& out, int level);
+    void releaseStrings(const PStatement& statement);
+    void intern(QString& s);
+    void release(const QString& s);
+    void addSharedStatement(const PStatement& statement);
+    StatementMap copyMembers(const StatementMap& map, QHash<const Statement*,PStatement>& copies) const;
+    PStatement copyStatement(const PStatement& statement, QHash<const Statement*,PStatement>& copies) const;
+    StatementMap& sharedChildren(const Statement* statement);
 private:
     int mCount;
+    // strings used by statements, so equal type names/identifiers/file names share one copy.
+    // the value is the count of statement fields using it, unused strings are removed
+    QHash<QString,int> mStringPool;
     StatementMap mGlobalStatements;  //may have overloaded functions, so use PStatementList to store
+    // by the scope (null for global), only global statements and members of namespaces are indexed
+    QHash<const Statement*,NameIndex> mNameIndexes;
+    QSet<const Statement*> mSharedStatements;
+    // children of shared statements in this model, including the ones added by this model
+    QHash<const Statement*,StatementMap> mSharedStatementChildren;
 #ifdef QT_DEBUG
     StatementList mAllStatements;
 #endif
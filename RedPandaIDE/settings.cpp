@@ -3847,6 +3847,16 @@ void Settings::CodeCompletion::setShareParser(bool newShareParser)
     mShareParser = newShareParser;
 }
 
+int Settings::CodeCompletion::parseWorkerCount() const
+{
+    return mParseWorkerCount;
+}
+
+void Settings::CodeCompletion::setParseWorkerCount(int newParseWorkerCount)
+{
+    mParseWorkerCount = newParseWorkerCount;
+}
+
 bool Settings::CodeCompletion::hideSymbolsStartsWithUnderLine() const
 {
     return mHideSymbolsStartsWithUnderLine;
@@ -3986,6 +3996,7 @@ void Settings::CodeCompletion::doSave()
     saveValue("hide_symbols_start_with_two_underline", mHideSymbolsStartsWithTwoUnderLine);
     saveValue("hide_symbols_start_with_underline", mHideSymbolsStartsWithUnderLine);
     saveValue("share_parser",mShareParser);
+    saveValue("parse_worker_count",mParseWorkerCount);
 }
 
 
@@ -4038,6 +4049,7 @@ void Settings::CodeCompletion::doLoad()
 //#endif
     mClearWhenEditorHidden = boolValue("clear_when_editor_hidden",doClear);
     mShareParser = boolValue("share_parser",shouldShare);
+    mParseWorkerCount = intValue("parse_worker_count",0);
 }
 
 Settings::CodeFormatter::CodeFormatter(Settings *settings):
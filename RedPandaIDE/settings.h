@@ -626,6 +626,9 @@ public:
         bool shareParser();
         void setShareParser(bool newShareParser);
 
+        int parseWorkerCount() const;
+        void setParseWorkerCount(int newParseWorkerCount);
+
     private:
         int mWidth;
         int mHeight;
@@ -644,6 +647,7 @@ public:
         bool mHideSymbolsStartsWithUnderLine;
         bool mClearWhenEditorHidden;
         bool mShareParser;
+        int mParseWorkerCount;
 
         // _Base interface
     protected:
@@ -55,6 +55,7 @@ void EditorCodeCompletionWidget::doLoad()
     ui->chkHideSymbolsStartWithUnderline->setChecked(pSettings->codeCompletion().hideSymbolsStartsWithUnderLine());
 
     ui->chkEditorShareCodeParser->setChecked(pSettings->codeCompletion().shareParser());
+    ui->spinParseWorkerCount->setValue(pSettings->codeCompletion().parseWorkerCount());
     ui->spinMinCharRequired->setValue(pSettings->codeCompletion().minCharRequired());
 }
 
@@ -84,6 +85,7 @@ void EditorCodeCompletionWidget::doSave()
     pSettings->codeCompletion().setHideSymbolsStartsWithUnderLine(ui->chkHideSymbolsStartWithUnderline->isChecked());
 
     pSettings->codeCompletion().setShareParser(ui->chkEditorShareCodeParser->isChecked());
+    pSettings->codeCompletion().setParseWorkerCount(ui->spinParseWorkerCount->value());
 
     pSettings->codeCompletion().save();
 }
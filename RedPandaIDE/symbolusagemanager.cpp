@@ -53,6 +53,7 @@ void SymbolUsageManager::load()
                               .arg(error.errorString()));
     }
 
+    QMutexLocker locker(&mMutex);
     mUsages.clear();
     QJsonArray array = doc.array();
     foreach (const QJsonValue& val, array) {
@@ -78,11 +79,14 @@ void SymbolUsageManager::save()
                               .arg(filename));
     }
     QJsonArray array;
-    foreach (const PSymbolUsage& usage,mUsages) {
-        QJsonObject object;
-        object["symbol"]=usage->fullName;
-        object["count"]=usage->count;
-        array.append(object);
+    {
+        QMutexLocker locker(&mMutex);
+        foreach (const PSymbolUsage& usage,mUsages) {
+            QJsonObject object;
+            object["symbol"]=usage->fullName;
+            object["count"]=usage->count;
+            array.append(object);
+        }
     }
     QJsonDocument doc;
     doc.setArray(array);
@@ -96,17 +100,31 @@ void SymbolUsageManager::save()
 
 void SymbolUsageManager::reset()
 {
-    mUsages.clear();
+    {
+        QMutexLocker locker(&mMutex);
+        mUsages.clear();
+    }
     save();
 }
 
 PSymbolUsage SymbolUsageManager::findUsage(const QString &fullName) const
 {
+    QMutexLocker locker(&mMutex);
     return mUsages.value(fullName,PSymbolUsage());
 }
 
+int SymbolUsageManager::usageCount(const QString &fullName) const
+{
+    QMutexLocker locker(&mMutex);
+    PSymbolUsage usage = mUsages.value(fullName,PSymbolUsage());
+    if (usage)
+        return usage->count;
+    return 0;
+}
+
 void SymbolUsageManager::updateUsage(const QString &symbol, int count)
 {
+    QMutexLocker locker(&mMutex);
     PSymbolUsage usage = mUsages.value(symbol,PSymbolUsage());
     if (usage) {
         usage->count = count;
@@ -20,6 +20,7 @@
 #include <QObject>
 #include <memory>
 #include <QHash>
+#include <QMutex>
 #include <QString>
 
 struct SymbolUsage {
@@ -37,9 +38,14 @@ public:
     void save();
     void reset();
     PSymbolUsage findUsage(const QString& fullName) const;
+    /**
+     * @brief use count of the symbol, 0 if not used. Can be called from worker threads.
+     */
+    int usageCount(const QString& fullName) const;
     void updateUsage(const QString& symbol, int count);
 private:
     QHash<QString, PSymbolUsage> mUsages;
+    mutable QMutex mMutex; // code completion reads usages in worker threads
 };
 
 using PSymbolUsageManager = std::shared_ptr<SymbolUsageManager>;
@@ -84,6 +84,7 @@
 #define DEV_INTERNAL_OPEN "$__DEV_INTERNAL_OPEN"
 #define DEV_LASTOPENS_FILE "lastopens.json"
 #define DEV_SYMBOLUSAGE_FILE  "symbolusage.json"
+#define DEV_PARSER_CACHE_DIR  "parsercache"
 #define DEV_CODESNIPPET_FILE  "codesnippets.json"
 #define DEV_NEWFILETEMPLATES_FILE "newfiletemplate.txt"
 #define DEV_AUTOLINK_FILE "autolink.json"
@@ -286,6 +286,7 @@ void resetCppParser(std::shared_ptr<CppParser> parser, int compilerSetIndex)
     parser->setEnabled(true);
     parser->setParseGlobalHeaders(true);
     parser->setParseLocalHeaders(true);
+    parser->setParseWorkerCount(pSettings->codeCompletion().parseWorkerCount());
     // Set options depending on the current compiler set
     if (compilerSetIndex<0) {
         compilerSetIndex=pSettings->compilerSets().defaultIndex();
@@ -328,6 +329,10 @@ void resetCppParser(std::shared_ptr<CppParser> parser, int compilerSetIndex)
         parser->addHardDefineByLine("#define __LINE__  1");
         parser->addHardDefineByLine("#define __DATE__  1");
         parser->addHardDefineByLine("#define __TIME__  1");
+        parser->setSystemHeaderCache(
+                    includeTrailingPathDelimiter(pSettings->dirs().config())+DEV_PARSER_CACHE_DIR,
+                    QString("%1 %2").arg(compilerSet->name(),
+                                         isCpp?compilerSet->cppCompiler():compilerSet->CCompiler()));
     }
     parser->parseHardDefines();
     pMainWindow->disconnect(parser.get(),
@@ -266,7 +266,7 @@ PClassBrowserNode ClassBrowserModel::addChild(ClassBrowserNode *node, const PSta
     }
     //don't show enum type's children values (they are displayed in parent scope)
     if (statement->kind != StatementKind::skEnumType) {
-        filterChildren(newNode.get(), statement->children);
+        filterChildren(newNode.get(), mParser->statementList().childrenStatements(statement));
     }
     return newNode;
 }
@@ -314,9 +314,18 @@ void ClassBrowserModel::sortNode(ClassBrowserNode *node)
             return node1->statement->command.toLower() < node2->statement->command.toLower();
         });
     } else if (pSettings->ui().classBrowserSortType()) {
+        // children statements are hashed, order statements of the same kind by name
         std::sort(node->children.begin(),node->children.end(),
                   [](ClassBrowserNode* node1,ClassBrowserNode* node2) {
-            return node1->statement->kind < node2->statement->kind;
+            if (node1->statement->kind != node2->statement->kind)
+                return node1->statement->kind < node2->statement->kind;
+            return node1->statement->command < node2->statement->command;
+        });
+    } else {
+        // children statements are hashed, sort them by name like the old ordered map
+        std::sort(node->children.begin(),node->children.end(),
+                  [](ClassBrowserNode* node1,ClassBrowserNode* node2) {
+            return node1->statement->command < node2->statement->command;
         });
     }
     foreach(ClassBrowserNode* child,node->children) {
@@ -380,7 +389,7 @@ void ClassBrowserModel::filterChildren(ClassBrowserNode *node, const StatementMa
                 PStatement dummy = createDummy(statement);
                 scopeNode = addChild(parentNode,dummy);
             }
-            filterChildren(scopeNode.get(),statement->children);
+            filterChildren(scopeNode.get(),mParser->statementList().childrenStatements(statement));
         } else {
             addChild(parentNode,statement);
         }
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2020-2022 Roy Qu (royqh1979@gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "codecompletionmatcher.h"
+
+void CodeCompletionMatchList::clear()
+{
+    // keeps the allocated memory
+    matches.resize(0);
+    spans.resize(0);
+}
+
+CodeCompletionMatcher::CodeCompletionMatcher(const QString &phrase, bool ignoreCase):
+    mPhrase(phrase),
+    mCharMask(identCharMask(phrase)),
+    mIgnoreCase(ignoreCase)
+{
+}
+
+bool CodeCompletionMatcher::match(const PStatement &statement, CodeCompletionMatchList &list) const
+{
+    return match(statement, identCharMask(statement->command), list);
+}
+
+bool CodeCompletionMatcher::match(const PStatement &statement, quint64 charMask, CodeCompletionMatchList &list) const
+{
+    const QString& command = statement->command;
+    // names that lack any char of the phrase are rejected without searching
+    if ((charMask & mCharMask) != mCharMask)
+        return false;
+    Qt::CaseSensitivity caseSensitivity = mIgnoreCase?Qt::CaseInsensitive:Qt::CaseSensitive;
+    int firstSpan = list.spans.count();
+    int matched = 0;
+    int caseMatched = 0;
+    int pos = 0;
+    int lastPos = -10;
+    int totalPos = 0;
+    foreach (const QChar& ch, mPhrase) {
+        pos = command.indexOf(ch,pos,caseSensitivity);
+        if (pos<0)
+            break;
+        if (pos == lastPos+1) {
+            list.spans.last().end++;
+        } else {
+            StatementMatchPosition span;
+            span.start = pos;
+            span.end = pos+1;
+            list.spans.append(span);
+        }
+        if (ch==command[pos])
+            caseMatched++;
+        matched++;
+        totalPos += pos;
+        lastPos = pos;
+        pos+=1;
+    }
+    int len = mPhrase.length();
+    if (matched != len || (!mIgnoreCase && caseMatched != len)) {
+        list.spans.resize(firstSpan);
+        return false;
+    }
+    CodeCompletionMatch match;
+    match.statement = statement;
+    match.caseMatched = caseMatched;
+    match.usageCount = 0;
+    match.matchPosTotal = totalPos;
+    match.firstSpan = firstSpan;
+    match.spanCount = list.spans.count() - firstSpan;
+    if (match.spanCount>0) {
+        const StatementMatchPosition& first = list.spans[firstSpan];
+        match.firstMatchLength = first.end - first.start;
+        match.matchPosSpan = list.spans.last().end - first.start;
+    } else {
+        match.firstMatchLength = 0;
+        match.matchPosSpan = 0;
+    }
+    list.matches.append(match);
+    return true;
+}
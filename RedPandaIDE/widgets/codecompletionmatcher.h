@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2020-2022 Roy Qu (royqh1979@gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef CODECOMPLETIONMATCHER_H
+#define CODECOMPLETIONMATCHER_H
+
+#include <QVector>
+#include "parser/parserutils.h"
+
+struct CodeCompletionMatch {
+    PStatement statement;
+    int matchPosTotal; // total of matched positions
+    int matchPosSpan; // distance between the first match pos and the last match pos;
+    int firstMatchLength; // length of first match;
+    int caseMatched; // count of chars matched with case
+    int usageCount; // how many times the statement is used
+    int firstSpan; // index of the first matched span in CodeCompletionMatchList::spans
+    int spanCount; // count of matched spans
+};
+
+/**
+ * @brief statements matched by a completion phrase
+ *
+ * Matched spans of all statements are stored in one buffer. Clear and reuse the list
+ * for each search, so its memory is reused too.
+ */
+struct CodeCompletionMatchList {
+    QVector<CodeCompletionMatch> matches;
+    QVector<StatementMatchPosition> spans;
+    void clear();
+};
+
+/**
+ * @brief fuzzy matcher for completion phrases
+ *
+ * A statement matches if all chars of the phrase appear in its name in order.
+ * Scores are written into the match list, the statements are not changed,
+ * so one statement can be matched by many searches at the same time.
+ */
+class CodeCompletionMatcher
+{
+public:
+    CodeCompletionMatcher(const QString& phrase, bool ignoreCase);
+    /**
+     * @brief append the statement and its scores to the list if it matches
+     * @return if the statement matches
+     */
+    bool match(const PStatement& statement, CodeCompletionMatchList& list) const;
+    /**
+     * @brief same as above, but the name's char mask is computed by the caller
+     * @param charMask identCharMask() of the statement's command
+     */
+    bool match(const PStatement& statement, quint64 charMask, CodeCompletionMatchList& list) const;
+private:
+    QString mPhrase;
+    quint64 mCharMask;
+    bool mIgnoreCase;
+};
+
+#endif // CODECOMPLETIONMATCHER_H
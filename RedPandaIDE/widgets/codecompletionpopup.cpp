@@ -28,6 +28,9 @@
 #include <QDebug>
 #include <QApplication>
 #include <QPainter>
+#include <QRunnable>
+
+#define SEARCH_CANCEL_CHECK_INTERVAL 256
 
 CodeCompletionPopup::CodeCompletionPopup(QWidget *parent) :
     QWidget(parent),
@@ -39,7 +42,7 @@ CodeCompletionPopup::CodeCompletionPopup(QWidget *parent) :
 {
     setWindowFlags(Qt::Popup);
     mListView = new CodeCompletionListView(this);
-    mModel=new CodeCompletionListModel(&mCompletionStatementList);
+    mModel=new CodeCompletionListModel(&mCompletionMatches);
     mDelegate = new CodeCompletionListItemDelegate(mModel,this);
     QItemSelectionModel *m=mListView->selectionModel();
     mListView->setModel(mModel);
@@ -60,10 +63,18 @@ CodeCompletionPopup::CodeCompletionPopup(QWidget *parent) :
 
     mHideSymbolsStartWithTwoUnderline = false;
     mHideSymbolsStartWithUnderline = false;
+    mSearchGlobalStatements = false;
+    mSearchLine = -1;
+    mSearchGeneration = std::make_shared<QAtomicInt>(0);
+    // one search at a time, stale searches are canceled
+    mSearchPool.setMaxThreadCount(1);
 }
 
 CodeCompletionPopup::~CodeCompletionPopup()
 {
+    mSearchGeneration->fetchAndAddOrdered(1);
+    mSearchPool.clear();
+    mSearchPool.waitForDone();
     delete mListView;
     delete mModel;
 }
@@ -134,44 +145,76 @@ bool CodeCompletionPopup::search(const QString &memberPhrase, bool autoHideOnSin
 //        filterList(symbol);
 //    }
 
-    mModel->notifyUpdated();
     setCursor(oldCursor);
 
-    if (!mCompletionStatementList.isEmpty()) {
-        PColorSchemeItem item = mColors->value(StatementKind::skUnknown,PColorSchemeItem());
-        if (item)
-            mDelegate->setNormalColor(item->foreground());
-        else
-            mDelegate->setNormalColor(palette().color(QPalette::Text));
-        item = mColors->value(StatementKind::skKeyword,PColorSchemeItem());
-        if (item)
-            mDelegate->setMatchedColor(item->foreground());
-        else
-            mDelegate->setMatchedColor(palette().color(QPalette::HighlightedText));
-        mListView->setCurrentIndex(mModel->index(0,0));
+    if (showSearchResults()) {
         // if only one suggestion, and is exactly the symbol to search, hide the frame (the search is over)
         // if only one suggestion and auto hide , don't show the frame
-        if(mCompletionStatementList.count() == 1)
+        if(mCompletionMatches.matches.count() == 1)
             if (autoHideOnSingleResult
-                    || (memberPhrase == mCompletionStatementList.front()->command)) {
+                    || (memberPhrase == mCompletionMatches.matches.front().statement->command)) {
             return true;
         }
-    } else {
-        hide();
     }
     return false;
 }
 
+void CodeCompletionPopup::onSearchFinished(int searchGeneration, const QString& memberPhrase,
+                                           const CodeCompletionMatchList &matches)
+{
+    QMutexLocker locker(&mMutex);
+    if (searchGeneration != mSearchGeneration->loadAcquire())
+        return;
+    if (!isVisible() || memberPhrase != mMemberPhrase)
+        return;
+    mCompletionMatches = matches;
+    mShownPhrase = memberPhrase;
+    showSearchResults();
+}
+
+void CodeCompletionPopup::finishSearch()
+{
+    QMutexLocker locker(&mMutex);
+    if (mShownPhrase == mMemberPhrase)
+        return;
+    // the shown list is stale, the pending search is replaced by a synchronous one
+    mSearchPool.clear();
+    filterList(mMemberPhrase);
+    showSearchResults();
+}
+
+bool CodeCompletionPopup::showSearchResults()
+{
+    mModel->notifyUpdated();
+    if (mCompletionMatches.matches.isEmpty()) {
+        hide();
+        return false;
+    }
+    PColorSchemeItem item = mColors->value(StatementKind::skUnknown,PColorSchemeItem());
+    if (item)
+        mDelegate->setNormalColor(item->foreground());
+    else
+        mDelegate->setNormalColor(palette().color(QPalette::Text));
+    item = mColors->value(StatementKind::skKeyword,PColorSchemeItem());
+    if (item)
+        mDelegate->setMatchedColor(item->foreground());
+    else
+        mDelegate->setMatchedColor(palette().color(QPalette::HighlightedText));
+    mListView->setCurrentIndex(mModel->index(0,0));
+    return true;
+}
+
 PStatement CodeCompletionPopup::selectedStatement()
 {
     if (isEnabled()) {
+        finishSearch();
         int index = mListView->currentIndex().row();
         if (mListView->currentIndex().isValid()
-                && (index<mCompletionStatementList.count()) ) {
-            return mCompletionStatementList[index];
+                && (index<mCompletionMatches.matches.count()) ) {
+            return mCompletionMatches.matches[index].statement;
         } else {
-            if (!mCompletionStatementList.isEmpty())
-                return mCompletionStatementList.front();
+            if (!mCompletionMatches.matches.isEmpty())
+                return mCompletionMatches.matches.front().statement;
             else
                 return PStatement();
         }
@@ -208,6 +251,17 @@ void CodeCompletionPopup::addChildren(const PStatement& scopeStatement, const QS
     }
 }
 
+void CodeCompletionPopup::addNamespaceMembers(const PStatement &namespaceStatement, const QString &fileName, int line)
+{
+    if (!isIncluded(namespaceStatement->fileName)
+      && !isIncluded(namespaceStatement->definitionFileName))
+        return;
+    // namespaces like std are large, their members are looked up when searching
+    mSearchNamespaces.append(namespaceStatement);
+    mSearchFileName = fileName;
+    mSearchLine = line;
+}
+
 void CodeCompletionPopup::addFunctionWithoutDefinitionChildren(const PStatement& scopeStatement, const QString &fileName, int line)
 {
     if (scopeStatement && !isIncluded(scopeStatement->fileName)
@@ -242,17 +296,73 @@ void CodeCompletionPopup::addFunctionWithoutDefinitionChildren(const PStatement&
     }
 }
 
-void CodeCompletionPopup::addStatement(const PStatement& statement, const QString &fileName, int line)
+static bool isStatementVisible(const PStatement &statement, const QString &fileName, int line)
 {
-    if (mAddedStatements.contains(statement->command))
-        return;
     if (statement->kind == StatementKind::skConstructor
             || statement->kind == StatementKind::skDestructor
             || statement->kind == StatementKind::skBlock)
-        return;
+        return false;
     if ((line!=-1)
             && (line < statement->line)
             && (fileName == statement->fileName))
+        return false;
+    return true;
+}
+
+// the first visible member of the namespace with the name
+static PStatement findNamespaceMember(const StatementModel& statements,
+                                      const PStatement& namespaceStatement,
+                                      const QString &command,
+                                      const QString& fileName,
+                                      int line)
+{
+    const StatementMap& children = statements.childrenStatements(namespaceStatement);
+    for (auto it=children.constFind(command);it!=children.constEnd() && it.key()==command;++it) {
+        if (isStatementVisible(it.value(), fileName, line))
+            return it.value();
+    }
+    return PStatement();
+}
+
+static PStatement findGlobalStatement(const StatementModel& statements,
+                                      const QSet<QString>& includedFiles,
+                                      const QString &command,
+                                      const QString& fileName,
+                                      int line)
+{
+    const StatementMap& children = statements.childrenStatements();
+    for (auto it=children.constFind(command);it!=children.constEnd() && it.key()==command;++it) {
+        const PStatement& statement = it.value();
+        int statementLine = line;
+        if (statement->fileName.isEmpty()) {
+            // hard defines
+            statementLine = -1;
+        } else if (!includedFiles.contains(statement->fileName)
+                   && !includedFiles.contains(statement->definitionFileName)) {
+            continue;
+        }
+        if (isStatementVisible(statement, fileName, statementLine))
+            return statement;
+    }
+    return PStatement();
+}
+
+// a search is canceled when a newer search is started
+static bool isSearchCanceled(const std::shared_ptr<QAtomicInt>& generation, int searchGeneration)
+{
+    return generation->loadAcquire()!=searchGeneration;
+}
+
+void CodeCompletionPopup::addStatement(const PStatement& statement, const QString &fileName, int line)
+{
+    if (mAddedStatements.contains(statement->command))
+        return;
+    if (!isStatementVisible(statement, fileName, line))
+        return;
+    // global statements hide members of the file's usings
+    if (mSearchGlobalStatements
+            && findGlobalStatement(mParser->statementList(), mIncludedFiles, statement->command,
+                                   mSearchFileName, mSearchLine))
         return;
     mAddedStatements.insert(statement->command);
     mFullCompletionStatementList.append(statement);
@@ -262,15 +372,17 @@ static bool nameComparator(PStatement statement1,PStatement statement2) {
     return statement1->command < statement2->command;
 }
 
-static bool defaultComparator(PStatement statement1,PStatement statement2) {
-    if (statement1->matchPosSpan!=statement2->matchPosSpan)
-        return statement1->matchPosSpan < statement2->matchPosSpan;
-    if (statement1->firstMatchLength != statement2->firstMatchLength)
-        return statement1->firstMatchLength > statement2->firstMatchLength;
-    if (statement1->matchPosTotal != statement2->matchPosTotal)
-        return statement1->matchPosTotal < statement2->matchPosTotal;
-    if (statement1->caseMatched != statement2->caseMatched)
-        return statement1->caseMatched > statement2->caseMatched;
+static bool defaultComparator(const CodeCompletionMatch& match1,const CodeCompletionMatch& match2) {
+    const PStatement& statement1 = match1.statement;
+    const PStatement& statement2 = match2.statement;
+    if (match1.matchPosSpan!=match2.matchPosSpan)
+        return match1.matchPosSpan < match2.matchPosSpan;
+    if (match1.firstMatchLength != match2.firstMatchLength)
+        return match1.firstMatchLength > match2.firstMatchLength;
+    if (match1.matchPosTotal != match2.matchPosTotal)
+        return match1.matchPosTotal < match2.matchPosTotal;
+    if (match1.caseMatched != match2.caseMatched)
+        return match1.caseMatched > match2.caseMatched;
     // Show user template first
     if (statement1->kind == StatementKind::skUserCodeSnippet) {
         if (statement2->kind != StatementKind::skUserCodeSnippet)
@@ -290,15 +402,17 @@ static bool defaultComparator(PStatement statement1,PStatement statement2) {
         return nameComparator(statement1,statement2);
 }
 
-static bool sortByScopeComparator(PStatement statement1,PStatement statement2){
-    if (statement1->matchPosSpan!=statement2->matchPosSpan)
-        return statement1->matchPosSpan < statement2->matchPosSpan;
-    if (statement1->firstMatchLength != statement2->firstMatchLength)
-        return statement1->firstMatchLength > statement2->firstMatchLength;
-    if (statement1->matchPosTotal != statement2->matchPosTotal)
-        return statement1->matchPosTotal < statement2->matchPosTotal;
-    if (statement1->caseMatched != statement2->caseMatched)
-        return statement1->caseMatched > statement2->caseMatched;
+static bool sortByScopeComparator(const CodeCompletionMatch& match1,const CodeCompletionMatch& match2) {
+    const PStatement& statement1 = match1.statement;
+    const PStatement& statement2 = match2.statement;
+    if (match1.matchPosSpan!=match2.matchPosSpan)
+        return match1.matchPosSpan < match2.matchPosSpan;
+    if (match1.firstMatchLength != match2.firstMatchLength)
+        return match1.firstMatchLength > match2.firstMatchLength;
+    if (match1.matchPosTotal != match2.matchPosTotal)
+        return match1.matchPosTotal < match2.matchPosTotal;
+    if (match1.caseMatched != match2.caseMatched)
+        return match1.caseMatched > match2.caseMatched;
     // Show user template first
     if (statement1->kind == StatementKind::skUserCodeSnippet) {
         if (statement2->kind != StatementKind::skUserCodeSnippet)
@@ -334,15 +448,17 @@ static bool sortByScopeComparator(PStatement statement1,PStatement statement2){
         return nameComparator(statement1,statement2);
 }
 
-static bool sortWithUsageComparator(PStatement statement1,PStatement statement2) {
-    if (statement1->matchPosSpan!=statement2->matchPosSpan)
-        return statement1->matchPosSpan < statement2->matchPosSpan;
-    if (statement1->firstMatchLength != statement2->firstMatchLength)
-        return statement1->firstMatchLength > statement2->firstMatchLength;
-    if (statement1->matchPosTotal != statement2->matchPosTotal)
-        return statement1->matchPosTotal < statement2->matchPosTotal;
-    if (statement1->caseMatched != statement2->caseMatched)
-        return statement1->caseMatched > statement2->caseMatched;
+static bool sortWithUsageComparator(const CodeCompletionMatch& match1,const CodeCompletionMatch& match2) {
+    const PStatement& statement1 = match1.statement;
+    const PStatement& statement2 = match2.statement;
+    if (match1.matchPosSpan!=match2.matchPosSpan)
+        return match1.matchPosSpan < match2.matchPosSpan;
+    if (match1.firstMatchLength != match2.firstMatchLength)
+        return match1.firstMatchLength > match2.firstMatchLength;
+    if (match1.matchPosTotal != match2.matchPosTotal)
+        return match1.matchPosTotal < match2.matchPosTotal;
+    if (match1.caseMatched != match2.caseMatched)
+        return match1.caseMatched > match2.caseMatched;
     // Show user template first
     if (statement1->kind == StatementKind::skUserCodeSnippet) {
         if (statement2->kind != StatementKind::skUserCodeSnippet)
@@ -353,8 +469,8 @@ static bool sortWithUsageComparator(PStatement statement1,PStatement statement2)
         return false;
         //show most freq first
     }
-    if (statement1->usageCount != statement2->usageCount)
-        return statement1->usageCount > statement2->usageCount;
+    if (match1.usageCount != match2.usageCount)
+        return match1.usageCount > match2.usageCount;
 
     if ((statement1->kind != StatementKind::skKeyword)
                && (statement2->kind == StatementKind::skKeyword)) {
@@ -366,15 +482,17 @@ static bool sortWithUsageComparator(PStatement statement1,PStatement statement2)
         return nameComparator(statement1,statement2);
 }
 
-static bool sortByScopeWithUsageComparator(PStatement statement1,PStatement statement2){
-    if (statement1->matchPosSpan!=statement2->matchPosSpan)
-        return statement1->matchPosSpan < statement2->matchPosSpan;
-    if (statement1->firstMatchLength != statement2->firstMatchLength)
-        return statement1->firstMatchLength > statement2->firstMatchLength;
-    if (statement1->matchPosTotal != statement2->matchPosTotal)
-        return statement1->matchPosTotal < statement2->matchPosTotal;
-    if (statement1->caseMatched != statement2->caseMatched)
-        return statement1->caseMatched > statement2->caseMatched;
+static bool sortByScopeWithUsageComparator(const CodeCompletionMatch& match1,const CodeCompletionMatch& match2) {
+    const PStatement& statement1 = match1.statement;
+    const PStatement& statement2 = match2.statement;
+    if (match1.matchPosSpan!=match2.matchPosSpan)
+        return match1.matchPosSpan < match2.matchPosSpan;
+    if (match1.firstMatchLength != match2.firstMatchLength)
+        return match1.firstMatchLength > match2.firstMatchLength;
+    if (match1.matchPosTotal != match2.matchPosTotal)
+        return match1.matchPosTotal < match2.matchPosTotal;
+    if (match1.caseMatched != match2.caseMatched)
+        return match1.caseMatched > match2.caseMatched;
     // Show user template first
     if (statement1->kind == StatementKind::skUserCodeSnippet) {
         if (statement2->kind != StatementKind::skUserCodeSnippet)
@@ -385,8 +503,8 @@ static bool sortByScopeWithUsageComparator(PStatement statement1,PStatement stat
         return false;
         //show most freq first
     }
-    if (statement1->usageCount != statement2->usageCount)
-        return statement1->usageCount > statement2->usageCount;
+    if (match1.usageCount != match2.usageCount)
+        return match1.usageCount > match2.usageCount;
 
         // show non-system defines before keyword
     if (statement1->kind == StatementKind::skKeyword) {
@@ -415,128 +533,209 @@ static bool sortByScopeWithUsageComparator(PStatement statement1,PStatement stat
         return nameComparator(statement1,statement2);
 }
 
-void CodeCompletionPopup::filterList(const QString &member)
+/*
+ * match and sort the statements for the search phrase.
+ * runs on worker threads, so only the context is used.
+ * returns false if the search is canceled.
+ */
+static bool searchStatements(const CodeCompletionSearchContext& context,
+                             CodeCompletionMatchList& matches,
+                             const std::shared_ptr<QAtomicInt>& generation,
+                             int searchGeneration)
 {
-    QMutexLocker locker(&mMutex);
-    mCompletionStatementList.clear();
-    if (!mParser)
-        return;
-    if (!mParser->enabled())
-        return;
-    //we don't need to freeze here since we use smart pointers
-    //  and data have been retrieved from the parser
-//    if (!mParser->freeze())
-//        return;
-//    {
-//        auto action = finally([this]{
-//            mParser->unFreeze();
-//        });
-//        if (mParserSerialId!=mParser->serialId()) {
-//            return;
-//        }
-
-    mCompletionStatementList.clear();
-    mCompletionStatementList.reserve(mFullCompletionStatementList.size());
-    bool hideSymbolsTwoUnderline = mHideSymbolsStartWithTwoUnderline && !member.startsWith("__") ;
-    bool hideSymbolsUnderline = mHideSymbolsStartWithUnderline && !member.startsWith("_") ;
-    int len = member.length();
-    foreach (const PStatement& statement, mFullCompletionStatementList) {
-
-        int matched = 0;
-        int caseMatched = 0;
-        QString command = statement->command;
-        int pos = 0;
-        int lastPos = -10;
-        int totalPos = 0;
-        statement->matchPositions.clear();
-        if (hideSymbolsTwoUnderline && statement->command.startsWith("__")) {
-            continue;
-        } else if (hideSymbolsUnderline && statement->command.startsWith("_")) {
-            continue;
-        } else {
-            foreach (const QChar& ch, member) {
-                if (mIgnoreCase)
-                    pos = command.indexOf(ch,pos,Qt::CaseInsensitive);
-                else
-                    pos = command.indexOf(ch,pos,Qt::CaseSensitive);
-                if (pos<0) {
-                    break;
+    matches.clear();
+    if (!context.parser || !context.parser->enabled())
+        return true;
+    const QString& member = context.phrase;
+
+    // global statements and members of namespaces are looked up by the parser's name index,
+    // so only the names that may match are checked below
+    StatementList globalStatements;
+    if (context.searchGlobalStatements || !context.namespaces.isEmpty()) {
+        if (!context.parser->freeze())
+            return true;
+        auto action = finally([&context]{
+            context.parser->unFreeze();
+        });
+        const StatementModel& statementList = context.parser->statementList();
+        QSet<QString> foundNames;
+        if (context.searchGlobalStatements) {
+            foreach (const QString& command, statementList.findNames(PStatement(), member)) {
+                if (isSearchCanceled(generation, searchGeneration))
+                    return false;
+                if (context.addedStatements.contains(command))
+                    continue;
+                PStatement statement = findGlobalStatement(statementList,
+                                                           context.includedFiles, command,
+                                                           context.fileName, context.line);
+                if (statement) {
+                    globalStatements.append(statement);
+                    foundNames.insert(command);
                 }
-                if (pos == lastPos+1) {
-                    statement->matchPositions.last()->end++;
-                } else {
-                    PStatementMathPosition matchPosition=std::make_shared<StatementMatchPosition>();
-                    matchPosition->start = pos;
-                    matchPosition->end = pos+1;
-                    statement->matchPositions.append(matchPosition);
+            }
+        }
+        // global statements hide members of the file's usings
+        foreach (const PStatement& namespaceStatement, context.namespaces) {
+            foreach (const QString& command, statementList.findNames(namespaceStatement, member)) {
+                if (isSearchCanceled(generation, searchGeneration))
+                    return false;
+                if (context.addedStatements.contains(command) || foundNames.contains(command))
+                    continue;
+                PStatement statement = findNamespaceMember(statementList, namespaceStatement,
+                                                           command, context.fileName, context.line);
+                if (statement) {
+                    globalStatements.append(statement);
+                    foundNames.insert(command);
                 }
-                if (ch==command[pos])
-                    caseMatched++;
-                matched++;
-                totalPos += pos;
-                lastPos = pos;
-                pos+=1;
             }
         }
+    }
 
-        if (mIgnoreCase && matched== len) {
-            statement->caseMatched = caseMatched;
-            statement->matchPosTotal = totalPos;
-            if (member.length()>0) {
-                statement->firstMatchLength = statement->matchPositions.front()->end - statement->matchPositions.front()->start;
-                statement->matchPosSpan = statement->matchPositions.last()->end - statement->matchPositions.front()->start;
-            } else
-                statement->firstMatchLength = 0;
-            mCompletionStatementList.append(statement);
-        } else if (caseMatched == len) {
-            statement->caseMatched = caseMatched;
-            statement->matchPosTotal = totalPos;
-            if (member.length()>0) {
-                statement->firstMatchLength = statement->matchPositions.front()->end - statement->matchPositions.front()->start;
-                statement->matchPosSpan = statement->matchPositions.last()->end - statement->matchPositions.front()->start;
-            } else
-                statement->firstMatchLength = 0;
-            mCompletionStatementList.append(statement);
-        } else {
-            statement->matchPositions.clear();
-            statement->caseMatched = 0;
-            statement->matchPosTotal = 0;
-            statement->firstMatchLength = 0;
-            statement->matchPosSpan = 0;
+    matches.matches.reserve(context.statements.size()+globalStatements.size());
+    bool hideSymbolsTwoUnderline = context.hideSymbolsStartWithTwoUnderline && !member.startsWith("__") ;
+    bool hideSymbolsUnderline = context.hideSymbolsStartWithUnderline && !member.startsWith("_") ;
+    CodeCompletionMatcher matcher(member, context.ignoreCase);
+    int count = 0;
+    for (const StatementList* statements : {&context.statements, &globalStatements}) {
+        // masks of the global statements are not computed beforehand
+        const QVector<quint64>* charMasks = (statements == &context.statements)?&context.charMasks:nullptr;
+        for (int i=0;i<statements->count();i++) {
+            const PStatement& statement = statements->at(i);
+            count++;
+            if ((count % SEARCH_CANCEL_CHECK_INTERVAL == 0)
+                    && isSearchCanceled(generation, searchGeneration))
+                return false;
+            if (hideSymbolsTwoUnderline && statement->command.startsWith("__")) {
+                continue;
+            } else if (hideSymbolsUnderline && statement->command.startsWith("_")) {
+                continue;
+            }
+            if (charMasks && i<charMasks->count())
+                matcher.match(statement, charMasks->at(i), matches);
+            else
+                matcher.match(statement, matches);
         }
     }
-    if (mRecordUsage) {
-        int usageCount;
-        foreach (const PStatement& statement,mCompletionStatementList) {
-            if (statement->usageCount == -1) {
-                PSymbolUsage usage = pMainWindow->symbolUsageManager()->findUsage(statement->fullName);
-                if (usage) {
-                    usageCount = usage->count;
-                } else {
-                    usageCount = 0;
-                }
-                statement->usageCount = usageCount;
-            }
+    if (isSearchCanceled(generation, searchGeneration))
+        return false;
+    if (context.recordUsage) {
+        PSymbolUsageManager usageManager = pMainWindow->symbolUsageManager();
+        for (CodeCompletionMatch& match:matches.matches) {
+            // statements are shared with the gui thread, counts are only read from the manager
+            match.usageCount = usageManager->usageCount(match.statement->fullName);
         }
-        if (mSortByScope) {
-            std::sort(mCompletionStatementList.begin(),
-                      mCompletionStatementList.end(),
+        if (context.sortByScope) {
+            std::sort(matches.matches.begin(),
+                      matches.matches.end(),
                       sortByScopeWithUsageComparator);
         } else {
-            std::sort(mCompletionStatementList.begin(),
-                      mCompletionStatementList.end(),
+            std::sort(matches.matches.begin(),
+                      matches.matches.end(),
                       sortWithUsageComparator);
         }
-    } else if (mSortByScope) {
-        std::sort(mCompletionStatementList.begin(),
-                  mCompletionStatementList.end(),
+    } else if (context.sortByScope) {
+        std::sort(matches.matches.begin(),
+                  matches.matches.end(),
                   sortByScopeComparator);
     } else {
-        std::sort(mCompletionStatementList.begin(),
-                  mCompletionStatementList.end(),
+        std::sort(matches.matches.begin(),
+                  matches.matches.end(),
                   defaultComparator);
     }
-    //    }
+    return true;
+}
+
+/**
+ * @brief runs a completion search on a worker thread
+ *
+ * The results are handed to the popup in the gui thread, unless a newer search
+ * has been started in the meantime.
+ */
+class CodeCompletionSearchTask : public QRunnable {
+public:
+    CodeCompletionSearchTask(CodeCompletionPopup* popup,
+                             const CodeCompletionSearchContext& context,
+                             const std::shared_ptr<QAtomicInt>& generation,
+                             int searchGeneration):
+        mPopup(popup),
+        mContext(context),
+        mGeneration(generation),
+        mSearchGeneration(searchGeneration) {
+    }
+
+    void run() override {
+        if (isSearchCanceled(mGeneration, mSearchGeneration))
+            return;
+        std::shared_ptr<CodeCompletionMatchList> matches = std::make_shared<CodeCompletionMatchList>();
+        if (!searchStatements(mContext, *matches, mGeneration, mSearchGeneration))
+            return;
+        CodeCompletionPopup* popup = mPopup;
+        int searchGeneration = mSearchGeneration;
+        QString phrase = mContext.phrase;
+        QMetaObject::invokeMethod(popup, [popup, searchGeneration, phrase, matches]() {
+            popup->onSearchFinished(searchGeneration, phrase, *matches);
+        }, Qt::QueuedConnection);
+    }
+private:
+    CodeCompletionPopup* mPopup;
+    CodeCompletionSearchContext mContext;
+    std::shared_ptr<QAtomicInt> mGeneration;
+    int mSearchGeneration;
+};
+
+CodeCompletionSearchContext CodeCompletionPopup::searchContext(const QString &phrase)
+{
+    // candidates are only appended after the list is cleared
+    if (mFullCompletionCharMasks.count()>mFullCompletionStatementList.count())
+        mFullCompletionCharMasks.clear();
+    mFullCompletionCharMasks.reserve(mFullCompletionStatementList.count());
+    for (int i=mFullCompletionCharMasks.count();i<mFullCompletionStatementList.count();i++)
+        mFullCompletionCharMasks.append(identCharMask(mFullCompletionStatementList[i]->command));
+    CodeCompletionSearchContext context;
+    context.phrase = phrase;
+    context.parser = mParser;
+    context.statements = mFullCompletionStatementList;
+    context.charMasks = mFullCompletionCharMasks;
+    context.includedFiles = mIncludedFiles;
+    context.addedStatements = mAddedStatements;
+    context.searchGlobalStatements = mSearchGlobalStatements;
+    context.namespaces = mSearchNamespaces;
+    context.fileName = mSearchFileName;
+    context.line = mSearchLine;
+    context.ignoreCase = mIgnoreCase;
+    context.recordUsage = mRecordUsage;
+    context.sortByScope = mSortByScope;
+    context.hideSymbolsStartWithUnderline = mHideSymbolsStartWithUnderline;
+    context.hideSymbolsStartWithTwoUnderline = mHideSymbolsStartWithTwoUnderline;
+    return context;
+}
+
+void CodeCompletionPopup::filterList(const QString &member)
+{
+    QMutexLocker locker(&mMutex);
+    // cancel searches running in background
+    int searchGeneration = mSearchGeneration->fetchAndAddOrdered(1)+1;
+    searchStatements(searchContext(member), mCompletionMatches,
+                     mSearchGeneration, searchGeneration);
+    mShownPhrase = member;
+}
+
+void CodeCompletionPopup::searchInBackground(const QString &memberPhrase)
+{
+    QMutexLocker locker(&mMutex);
+
+    mMemberPhrase = memberPhrase;
+
+    if (!isEnabled()) {
+        hide();
+        return;
+    }
+    // the running search is stale, and the waiting ones will never be used
+    int searchGeneration = mSearchGeneration->fetchAndAddOrdered(1)+1;
+    mSearchPool.clear();
+    mSearchPool.start(new CodeCompletionSearchTask(this, searchContext(memberPhrase),
+                                                   mSearchGeneration, searchGeneration));
+    // previous results are shown until the search is finished
 }
 
 void CodeCompletionPopup::getCompletionFor(
@@ -614,31 +813,16 @@ void CodeCompletionPopup::getCompletionFor(
                 }
             }
 
-            PStatement scopeStatement = mCurrentScope;
-            // repeat until reach global
-            while (scopeStatement) {
-                //add members of current scope that not added before
-                if (scopeStatement->kind == StatementKind::skClass) {
-                    addChildren(scopeStatement, fileName, -1);
-                } else {
-                    addChildren(scopeStatement, fileName, line);
-                }
-
-                // add members of all usings (in current scope ) and not added before
-                foreach (const QString& namespaceName,scopeStatement->usingList) {
-                    PStatementList namespaceStatementsList =
-                            mParser->findNamespace(namespaceName);
-                    if (!namespaceStatementsList)
-                        continue;
-                    foreach (const PStatement& namespaceStatement,*namespaceStatementsList) {
-                        addChildren(namespaceStatement, fileName, line);
-                    }
-                }
-                scopeStatement=scopeStatement->parentScope.lock();
+            // members of the enclosing scopes and of the namespaces they use,
+            // already filtered by the line
+            foreach (const PStatement& statement, mParser->listVisibleScopeMembers(fileName, line)) {
+                addStatement(statement, fileName, -1);
             }
 
-            // add all global members and not added before
-            addChildren(nullptr, fileName, line);
+            // global members that are not added before are looked up when searching
+            mSearchGlobalStatements = true;
+            mSearchFileName = fileName;
+            mSearchLine = line;
 
             // add members of all fusings
             mUsings = mParser->getFileUsings(fileName);
@@ -648,7 +832,7 @@ void CodeCompletionPopup::getCompletionFor(
                 if (!namespaceStatementsList)
                     continue;
                 foreach (const PStatement& namespaceStatement, *namespaceStatementsList) {
-                    addChildren(namespaceStatement, fileName, line);
+                    addNamespaceMembers(namespaceStatement, fileName, line);
                 }
             }
 
@@ -656,8 +840,10 @@ void CodeCompletionPopup::getCompletionFor(
             //the identifier to be completed is a member of variable/class
             if (memberOperator == "::" && ownerExpression.isEmpty()) {
                 // start with '::', we only find in global
-                // add all global members and not added before
-                addChildren(nullptr, fileName, line);
+                // global members are looked up when searching
+                mSearchGlobalStatements = true;
+                mSearchFileName = fileName;
+                mSearchLine = line;
                 return;
             }
             if (memberExpression.length()==2 && memberExpression.front()!="~")
@@ -691,7 +877,7 @@ void CodeCompletionPopup::getCompletionFor(
                             mParser->findNamespace(ownerStatement->baseType);
                     if (namespaceStatementsList) {
                         foreach (const PStatement& namespaceStatement, *namespaceStatementsList) {
-                            addChildren(namespaceStatement, fileName, line);
+                            addNamespaceMembers(namespaceStatement, fileName, line);
                         }
                     }
                     return;
@@ -888,6 +1074,7 @@ void CodeCompletionPopup::getCompletionForFunctionWithoutDefinition(const QStrin
 void CodeCompletionPopup::getCompletionListForTypeKeywordComplex(const QString &preWord)
 {
     mFullCompletionStatementList.clear();
+    mFullCompletionCharMasks.clear();
     if (preWord == "long") {
         addKeyword("long");
         addKeyword("double");
@@ -1091,11 +1278,16 @@ void CodeCompletionPopup::hideEvent(QHideEvent *event)
 {
     QMutexLocker locker(&mMutex);
     mListView->setKeypressedCallback(nullptr);
-    mCompletionStatementList.clear();
-//    foreach (PStatement statement, mFullCompletionStatementList) {
-//        statement->matchPositions.clear();
-//    }
+    // results of running searches are dropped
+    mSearchGeneration->fetchAndAddOrdered(1);
+    mSearchPool.clear();
+    mCompletionMatches.clear();
+    mShownPhrase.clear();
     mFullCompletionStatementList.clear();
+    mFullCompletionCharMasks.clear();
+    mSearchGlobalStatements = false;
+    mSearchNamespaces.clear();
+    mSearchFileName.clear();
     mIncludedFiles.clear();
     mUsings.clear();
     mAddedStatements.clear();
@@ -1114,32 +1306,32 @@ bool CodeCompletionPopup::event(QEvent *event)
     return result;
 }
 
-CodeCompletionListModel::CodeCompletionListModel(const StatementList *statements, QObject *parent):
+CodeCompletionListModel::CodeCompletionListModel(const CodeCompletionMatchList *matches, QObject *parent):
     QAbstractListModel(parent),
-    mStatements(statements)
+    mMatches(matches)
 {
 
 }
 
 int CodeCompletionListModel::rowCount(const QModelIndex &) const
 {
-    return mStatements->count();
+    return mMatches->matches.count();
 }
 
 QVariant CodeCompletionListModel::data(const QModelIndex &index, int role) const
 {
     if (!index.isValid())
         return QVariant();
-    if (index.row()>=mStatements->count())
+    if (index.row()>=mMatches->matches.count())
         return QVariant();
 
     switch(role) {
     case Qt::DisplayRole: {
-        PStatement statement = mStatements->at(index.row());
+        PStatement statement = mMatches->matches.at(index.row()).statement;
         return statement->command;
         }
     case Qt::DecorationRole:
-        PStatement statement = mStatements->at(index.row());
+        PStatement statement = mMatches->matches.at(index.row()).statement;
         return pIconsManager->getPixmapForStatement(statement);
     }
     return QVariant();
@@ -1149,21 +1341,26 @@ PStatement CodeCompletionListModel::statement(const QModelIndex &index) const
 {
     if (!index.isValid())
         return PStatement();
-    if (index.row()>=mStatements->count())
+    if (index.row()>=mMatches->matches.count())
         return PStatement();
-    return mStatements->at(index.row());
+    return mMatches->matches.at(index.row()).statement;
 }
 
 QPixmap CodeCompletionListModel::statementIcon(const QModelIndex &index) const
 {
     if (!index.isValid())
         return QPixmap();
-    if (index.row()>=mStatements->count())
+    if (index.row()>=mMatches->matches.count())
         return QPixmap();
-    PStatement statement = mStatements->at(index.row());
+    PStatement statement = mMatches->matches.at(index.row()).statement;
     return pIconsManager->getPixmapForStatement(statement);
 }
 
+const CodeCompletionMatchList *CodeCompletionListModel::matches() const
+{
+    return mMatches;
+}
+
 void CodeCompletionListModel::notifyUpdated()
 {
     beginResetModel();
@@ -1190,18 +1387,21 @@ void CodeCompletionListItemDelegate::paint(QPainter *painter, const QStyleOption
         QString text = statement->command;
         int pos=0;
         int y=option.rect.bottom()-painter->fontMetrics().descent();
-        foreach (const PStatementMathPosition& matchPosition, statement->matchPositions) {
-            if (pos<matchPosition->start) {
-                QString t = text.mid(pos,matchPosition->start-pos);
+        const CodeCompletionMatchList* matches = mModel->matches();
+        const CodeCompletionMatch& match = matches->matches.at(index.row());
+        for (int i=match.firstSpan;i<match.firstSpan+match.spanCount;i++) {
+            const StatementMatchPosition& matchPosition = matches->spans.at(i);
+            if (pos<matchPosition.start) {
+                QString t = text.mid(pos,matchPosition.start-pos);
                 painter->setPen(normalColor);
                 painter->drawText(x,y,t);
                 x+=painter->fontMetrics().horizontalAdvance(t);
             }
-            QString t = text.mid(matchPosition->start, matchPosition->end-matchPosition->start);
+            QString t = text.mid(matchPosition.start, matchPosition.end-matchPosition.start);
             painter->setPen(mMatchedColor);
             painter->drawText(x,y,t);
             x+=painter->fontMetrics().horizontalAdvance(t);
-            pos=matchPosition->end;
+            pos=matchPosition.end;
         }
         if (pos<text.length()) {
             QString t = text.mid(pos,text.length()-pos);
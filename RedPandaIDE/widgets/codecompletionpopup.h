@@ -18,23 +18,49 @@
 #define CODECOMPLETIONPOPUP_H
 
 #include <QListView>
+#include <QThreadPool>
 #include <QWidget>
 #include "parser/cppparser.h"
 #include "codecompletionlistview.h"
+#include "codecompletionmatcher.h"
 
 class ColorSchemeItem;
 class CodeCompletionListModel : public QAbstractListModel {
     Q_OBJECT
 public:
-    explicit CodeCompletionListModel(const StatementList* statements,QObject *parent = nullptr);
+    explicit CodeCompletionListModel(const CodeCompletionMatchList* matches,QObject *parent = nullptr);
     int rowCount(const QModelIndex &parent) const override;
     QVariant data(const QModelIndex &index, int role) const override;
     PStatement statement(const QModelIndex &index) const;
     QPixmap statementIcon(const QModelIndex &index) const;
+    const CodeCompletionMatchList* matches() const;
     void notifyUpdated();
 
 private:
-    const StatementList* mStatements;
+    const CodeCompletionMatchList* mMatches;
+};
+
+/**
+ * @brief everything a completion search needs, copied from the popup
+ *
+ * Searches run on a worker thread, so they don't read the popup itself.
+ */
+struct CodeCompletionSearchContext {
+    QString phrase;
+    PCppParser parser;
+    StatementList statements; // candidates found when preparing the search
+    QVector<quint64> charMasks; // identCharMask() of the candidates' names
+    QSet<QString> includedFiles;
+    QSet<QString> addedStatements;
+    bool searchGlobalStatements; // also search global statements in the parser
+    StatementList namespaces; // also search members of these namespaces in the parser
+    QString fileName;
+    int line;
+    bool ignoreCase;
+    bool recordUsage;
+    bool sortByScope;
+    bool hideSymbolsStartWithUnderline;
+    bool hideSymbolsStartWithTwoUnderline;
 };
 
 enum class CodeCompletionType {
@@ -90,6 +116,12 @@ public:
                        CodeCompletionType completionType,
                        const QSet<QString>& customKeywords);
     bool search(const QString& memberPhrase, bool autoHideOnSingleResult);
+    /**
+     * @brief search on a worker thread, the current results are shown until it's finished
+     *
+     * Starting a new search or hiding the popup cancels the running one.
+     */
+    void searchInBackground(const QString& memberPhrase);
 
     PStatement selectedStatement();
 
@@ -129,10 +161,17 @@ public:
 private:
     void addChildren(const PStatement& scopeStatement, const QString& fileName,
                      int line);
+    void addNamespaceMembers(const PStatement& namespaceStatement, const QString& fileName,
+                     int line);
     void addFunctionWithoutDefinitionChildren(const PStatement& scopeStatement, const QString& fileName,
                      int line);
     void addStatement(const PStatement& statement, const QString& fileName, int line);
+    CodeCompletionSearchContext searchContext(const QString& phrase);
     void filterList(const QString& member);
+    void finishSearch();
+    void onSearchFinished(int searchGeneration, const QString& memberPhrase,
+                          const CodeCompletionMatchList& matches);
+    bool showSearchResults();
     void getCompletionFor(
             const QStringList& ownerExpression,
             const QString& memberOperator,
@@ -161,11 +200,22 @@ private:
     QList<PCodeSnippet> mCodeSnippets; //(Code template list)
     //QList<PStatement> mCodeInsStatements; //temporary (user code template) statements created when show code suggestion
     StatementList mFullCompletionStatementList;
-    StatementList mCompletionStatementList;
+    // identCharMask() of the names in mFullCompletionStatementList, computed once for all keystrokes
+    QVector<quint64> mFullCompletionCharMasks;
+    CodeCompletionMatchList mCompletionMatches;
     QSet<QString> mIncludedFiles;
     QSet<QString> mUsings;
     QSet<QString> mAddedStatements;
+    // global statements and members of namespaces are not in mFullCompletionStatementList,
+    // but found by the parser's name index when searching
+    bool mSearchGlobalStatements;
+    StatementList mSearchNamespaces;
+    QString mSearchFileName;
+    int mSearchLine;
+    std::shared_ptr<QAtomicInt> mSearchGeneration; // increased when a search is started or canceled
+    QThreadPool mSearchPool;
     QString mMemberPhrase;
+    QString mShownPhrase; // the phrase mCompletionMatches are searched for
     QString mMemberOperator;
 #if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
     QRecursiveMutex mMutex;
@@ -196,6 +246,8 @@ public:
     bool event(QEvent *event) override;
     const QString &memberOperator() const;
 
+    friend class CodeCompletionSearchTask;
+
 };
 
 #endif // CODECOMPLETIONPOPUP_H
@@ -124,11 +124,37 @@ void CodeFoldingRanges::insert(int index, PCodeFoldingRange range)
     mRanges.insert(index,range);
 }
 
+void CodeFoldingRanges::insert(int index, const CodeFoldingRanges &ranges)
+{
+    mRanges.insert(index, ranges.count(), PCodeFoldingRange());
+    for (int i=0;i<ranges.count();i++)
+        mRanges[index+i] = ranges[i];
+}
+
 void CodeFoldingRanges::remove(int index)
 {
     mRanges.remove(index);
 }
 
+void CodeFoldingRanges::remove(int index, int count)
+{
+    mRanges.remove(index, count);
+}
+
+int CodeFoldingRanges::findFirst(int fromLine) const
+{
+    int start = 0;
+    int end = mRanges.count();
+    while (start<end) {
+        int mid = (start+end)/2;
+        if (mRanges[mid]->fromLine<fromLine)
+            start = mid+1;
+        else
+            end = mid;
+    }
+    return start;
+}
+
 void CodeFoldingRanges::add(PCodeFoldingRange foldRange)
 {
     mRanges.push_back(foldRange);
@@ -71,7 +71,11 @@ public:
                                int fromLine, int toLine);
 
     void insert(int index, PCodeFoldingRange range);
+    void insert(int index, const CodeFoldingRanges& ranges);
     void remove(int index);
+    void remove(int index, int count);
+    // index of the first range starting at or after fromLine (ranges are sorted by fromLine)
+    int findFirst(int fromLine) const;
     void add(PCodeFoldingRange foldRange);
     PCodeFoldingRange operator[](int index) const;
 };
@@ -91,5 +95,13 @@ public:
     explicit CodeFoldingRange(PCodeFoldingRange parent, int fromLine, int toLine);
 };
 
+// A collapsed fold not inside another collapsed fold, used to map lines to rows
+struct CollapsedFold {
+    int fromLine;
+    int toLine;
+    int linesCollapsed;
+    int linesHiddenBefore; // lines hidden by the collapsed folds before it
+};
+
 }
 #endif // CODEFOLDING_H
@@ -38,9 +38,13 @@
 #include <QDrag>
 #include <QMimeData>
 #include <QDesktopWidget>
+#include <QElapsedTimer>
 #include <QTextEdit>
 #include <QMimeData>
 
+#define RESCAN_TIME_SLICE 20 // ms
+#define RESCAN_LINES_PER_CHECK 200 // lines highlighted between checks of the elapsed time
+
 namespace QSynedit {
 SynEdit::SynEdit(QWidget *parent) : QAbstractScrollArea(parent),
     mDropped(false)
@@ -128,6 +132,7 @@ SynEdit::SynEdit(QWidget *parent) : QAbstractScrollArea(parent),
     mWantTabs = false;
     mLeftChar = 1;
     mTopLine = 1;
+    mLinesInWindow = 0;
     mCaretX = 1;
     mLastCaretColumn = 1;
     mCaretY = 1;
@@ -143,11 +148,20 @@ SynEdit::SynEdit(QWidget *parent) : QAbstractScrollArea(parent),
     //mScrollTimer->setInterval(100);
     connect(mScrollTimer, &QTimer::timeout,this, &SynEdit::onScrollTimeout);
 
+    mRescanTimer = new QTimer(this);
+    mRescanTimer->setInterval(0);
+    connect(mRescanTimer, &QTimer::timeout, this, &SynEdit::onRescanTimeout);
+    mRescanLine = -1;
+    mRescanCanStopLine = -1;
+    mRescanFoldLine = -1;
+
     qreal dpr=devicePixelRatioF();
     mContentImage = std::make_shared<QImage>(clientWidth()*dpr,clientHeight()*dpr,QImage::Format_ARGB32);
     mContentImage->setDevicePixelRatio(dpr);
 
     mUseCodeFolding = true;
+    mStateFlags.setFlag(StateFlag::sfFoldRangesOutdated);
+    mCollapsedFoldsOutdated = true;
     m_blinkTimerId = 0;
     m_blinkStatus = 0;
 
@@ -898,31 +912,72 @@ int SynEdit::lineToRow(int aLine) const
 
 int SynEdit::foldRowToLine(int Row) const
 {
-    int result = Row;
-    for (int i=0;i<mAllFoldRanges.count();i++) {
-        PCodeFoldingRange range = mAllFoldRanges[i];
-        if (range->collapsed && !range->parentCollapsed() && range->fromLine < result) {
-            result += range->linesCollapsed;
-        }
+    const QVector<CollapsedFold>& folds = collapsedFolds();
+    // find the last fold starting before the row. rows of the fold starts are sorted
+    int start = 0;
+    int end = folds.count();
+    while (start<end) {
+        int mid = (start+end)/2;
+        if (folds[mid].fromLine - folds[mid].linesHiddenBefore < Row)
+            start = mid+1;
+        else
+            end = mid;
     }
-    return result;
+    if (start==0)
+        return Row;
+    const CollapsedFold& fold = folds[start-1];
+    return Row + fold.linesHiddenBefore + fold.linesCollapsed;
 }
 
 int SynEdit::foldLineToRow(int Line) const
 {
-    int result = Line;
-    for (int i=mAllFoldRanges.count()-1;i>=0;i--) {
-        PCodeFoldingRange range =mAllFoldRanges[i];
-        if (range->collapsed && !range->parentCollapsed()) {
-            // Line is found after fold
-            if (range->toLine < Line)
-                result -= range->linesCollapsed;
-            // Inside fold
-            else if (range->fromLine < Line && Line <= range->toLine)
-                result -= Line - range->fromLine;
+    const QVector<CollapsedFold>& folds = collapsedFolds();
+    // find the last fold starting before the line
+    int start = 0;
+    int end = folds.count();
+    while (start<end) {
+        int mid = (start+end)/2;
+        if (folds[mid].fromLine < Line)
+            start = mid+1;
+        else
+            end = mid;
+    }
+    if (start==0)
+        return Line;
+    const CollapsedFold& fold = folds[start-1];
+    // Line is found after fold
+    if (fold.toLine < Line)
+        return Line - fold.linesHiddenBefore - fold.linesCollapsed;
+    // Inside fold
+    return fold.fromLine - fold.linesHiddenBefore;
+}
+
+const QVector<CollapsedFold> &SynEdit::collapsedFolds() const
+{
+    if (mCollapsedFoldsOutdated) {
+        mCollapsedFolds.clear();
+        int linesHidden = 0;
+        for (int i=0;i<mAllFoldRanges.count();i++) {
+            PCodeFoldingRange range = mAllFoldRanges[i];
+            if (!range->collapsed)
+                continue;
+            // only folds inside the last collapsed one can have a collapsed parent
+            if (!mCollapsedFolds.isEmpty()
+                    && range->fromLine <= mCollapsedFolds.back().toLine
+                    && range->parentCollapsed())
+                continue;
+            mCollapsedFolds.append(CollapsedFold{range->fromLine, range->toLine,
+                                                 range->linesCollapsed, linesHidden});
+            linesHidden += range->linesCollapsed;
         }
+        mCollapsedFoldsOutdated = false;
     }
-    return result;
+    return mCollapsedFolds;
+}
+
+void SynEdit::invalidateCollapsedFolds()
+{
+    mCollapsedFoldsOutdated = true;
 }
 
 void SynEdit::setDefaultKeystrokes()
@@ -3408,40 +3463,113 @@ void SynEdit::updateModifiedStatus()
 
 int SynEdit::scanFrom(int Index, int canStopIndex)
 {
-    HighlighterState iRange;
     int Result = std::max(0,Index);
     if (Result >= mDocument->count())
         return Result;
+    if (mRescanLine>=0 && mRescanLine < Result) {
+        // the states of the lines before are not known yet, leave it to the background scan
+        mRescanCanStopLine = std::max(mRescanCanStopLine, canStopIndex);
+        return Result;
+    }
+    // lines in the window are highlighted now, the rest in the background
+    return scanLines(Result, canStopIndex, Result, rowToLine(mTopLine + mLinesInWindow) - 1);
+}
 
+int SynEdit::scanLines(int startLine, int canStopLine, int foldStartLine, int lastLine)
+{
+    HighlighterState iRange;
+    int Result = startLine;
     if (Result == 0) {
         mHighlighter->resetState();
     } else {
         mHighlighter->setState(mDocument->ranges(Result-1));
     }
     do {
+        if (Result == mRescanLine) {
+            // take over the lines waiting for the background scan
+            canStopLine = std::max(canStopLine, mRescanCanStopLine);
+            foldStartLine = std::min(foldStartLine, mRescanFoldLine);
+            stopBackgroundScan();
+        }
         mHighlighter->setLine(mDocument->getString(Result), Result);
         mHighlighter->nextToEol();
         iRange = mHighlighter->getState();
-        if (Result > canStopIndex){
+        if (Result > canStopLine){
             if (mDocument->ranges(Result).state == iRange.state
                     && mDocument->ranges(Result).braceLevel == iRange.braceLevel
                     && mDocument->ranges(Result).parenthesisLevel == iRange.parenthesisLevel
                     && mDocument->ranges(Result).bracketLevel == iRange.bracketLevel
                     ) {
                 if (mUseCodeFolding)
-                    rescanFolds();
+                    rescanFolds(foldStartLine, Result);
                 return Result;// avoid the final Decrement
             }
         }
         mDocument->setRange(Result,iRange);
         Result ++ ;
+        if (Result > lastLine && Result < mDocument->count()) {
+            // continue in the background. It also covers the lines left by the last one
+            if (mRescanLine>=0) {
+                canStopLine = std::max(canStopLine, mRescanCanStopLine);
+                foldStartLine = std::min(foldStartLine, mRescanFoldLine);
+            }
+            mRescanLine = Result;
+            mRescanCanStopLine = canStopLine;
+            mRescanFoldLine = foldStartLine;
+            mRescanTimer->start();
+            return Result - 1;
+        }
     } while (Result < mDocument->count());
     Result--;
     if (mUseCodeFolding)
-        rescanFolds();
+        rescanFolds(foldStartLine, Result);
     return Result;
 }
 
+void SynEdit::ensureRangesScanned(int line)
+{
+    if (mRescanLine<0 || line<mRescanLine)
+        return;
+    if (!mHighlighter) {
+        stopBackgroundScan();
+        return;
+    }
+    mDocument->beginUpdate();
+    auto action = finally([this]{
+        mDocument->endUpdate();
+    });
+    int lastLine = scanLines(mRescanLine, mRescanCanStopLine, mRescanFoldLine,
+                             std::min(line, mDocument->count()-1));
+    invalidateLines(1, lastLine + 1);
+}
+
+void SynEdit::stopBackgroundScan()
+{
+    mRescanLine = -1;
+    mRescanTimer->stop();
+}
+
+void SynEdit::onRescanTimeout()
+{
+    if (mRescanLine<0 || !mHighlighter || mRescanLine >= mDocument->count()) {
+        stopBackgroundScan();
+        return;
+    }
+    mDocument->beginUpdate();
+    auto action = finally([this]{
+        mDocument->endUpdate();
+    });
+    QElapsedTimer timer;
+    timer.start();
+    int startLine = mRescanLine;
+    int lastLine;
+    do {
+        lastLine = scanLines(mRescanLine, mRescanCanStopLine, mRescanFoldLine,
+                             mRescanLine + RESCAN_LINES_PER_CHECK - 1);
+    } while (mRescanLine>=0 && timer.elapsed() < RESCAN_TIME_SLICE);
+    invalidateLines(startLine + 1, lastLine + 1);
+}
+
 void SynEdit::rescanRange(int line)
 {
     if (!mHighlighter)
@@ -3464,13 +3592,16 @@ void SynEdit::rescanRange(int line)
 
 void SynEdit::rescanRanges()
 {
+    stopBackgroundScan();
     if (mHighlighter && !mDocument->empty()) {
-        mHighlighter->resetState();
-        for (int i =0;i<mDocument->count();i++) {
-            mHighlighter->setLine(mDocument->getString(i), i);
-            mHighlighter->nextToEol();
-            mDocument->setRange(i, mHighlighter->getState());
-        }
+        // old states are meaningless, highlight to the last line.
+        // lines in the window are highlighted now, the rest in the background.
+        // hidden editors (like the ones used to search files) are read right after
+        int lastLine = mDocument->count()-1;
+        if (isVisible())
+            lastLine = rowToLine(mTopLine + mLinesInWindow) - 1;
+        scanLines(0, mDocument->count()-1, 0, lastLine);
+        return;
     }
     if (mUseCodeFolding)
         rescanFolds();
@@ -3480,6 +3611,7 @@ void SynEdit::uncollapse(PCodeFoldingRange FoldRange)
 {
     FoldRange->linesCollapsed = 0;
     FoldRange->collapsed = false;
+    invalidateCollapsedFolds();
 
     // Redraw the collapsed line
     invalidateLines(FoldRange->fromLine, INT_MAX);
@@ -3493,6 +3625,7 @@ void SynEdit::collapse(PCodeFoldingRange FoldRange)
 {
     FoldRange->linesCollapsed = FoldRange->toLine - FoldRange->fromLine;
     FoldRange->collapsed = true;
+    invalidateCollapsedFolds();
 
     // Extract caret from fold
     if ((mCaretY > FoldRange->fromLine) && (mCaretY <= FoldRange->toLine)) {
@@ -3511,30 +3644,43 @@ void SynEdit::collapse(PCodeFoldingRange FoldRange)
 
 void SynEdit::foldOnListInserted(int Line, int Count)
 {
+    invalidateCollapsedFolds();
     // Delete collapsed inside selection
     for (int i = mAllFoldRanges.count()-1;i>=0;i--) {
         PCodeFoldingRange range = mAllFoldRanges[i];
         if (range->fromLine == Line - 1) {// insertion starts at fold line
             if (range->collapsed)
                 uncollapse(range);
-        } else if (range->fromLine >= Line) // insertion of count lines above FromLine
+        }
+        if (range->fromLine >= Line) // insertion of count lines above FromLine
             range->move(Count);
+        else if (range->toLine >= Line) // insertion inside the fold
+            range->toLine += Count;
     }
 }
 
 void SynEdit::foldOnListDeleted(int Line, int Count)
 {
+    invalidateCollapsedFolds();
     // Delete collapsed inside selection
     for (int i = mAllFoldRanges.count()-1;i>=0;i--) {
         PCodeFoldingRange range = mAllFoldRanges[i];
         if (range->fromLine == Line && Count == 1)  {// open up because we are messing with the starting line
             if (range->collapsed)
                 uncollapse(range);
-        } else if (range->fromLine >= Line - 1 && range->fromLine < Line + Count) // delete inside affectec area
+        } else if (range->fromLine >= Line - 1 && range->fromLine < Line + Count) {// delete inside affectec area
             mAllFoldRanges.remove(i);
-        else if (range->fromLine >= Line + Count) // Move after affected area
+            // its parent and sub folds still refer to it
+            mStateFlags.setFlag(StateFlag::sfFoldRangesOutdated);
+            continue;
+        } else if (range->fromLine >= Line + Count) {// Move after affected area
             range->move(-Count);
-
+            continue;
+        }
+        if (range->toLine >= Line + Count)
+            range->toLine -= Count;
+        else if (range->toLine >= Line) // the closing line is deleted, the fold's end is unknown
+            mStateFlags.setFlag(StateFlag::sfFoldRangesOutdated);
     }
 
 }
@@ -3542,6 +3688,8 @@ void SynEdit::foldOnListDeleted(int Line, int Count)
 void SynEdit::foldOnListCleared()
 {
     mAllFoldRanges.clear();
+    invalidateCollapsedFolds();
+    mStateFlags.setFlag(StateFlag::sfFoldRangesOutdated);
 }
 
 void SynEdit::rescanFolds()
@@ -3549,11 +3697,42 @@ void SynEdit::rescanFolds()
     if (!mUseCodeFolding)
         return;
     rescanForFoldRanges();
+    invalidateCollapsedFolds();
+    invalidateGutter();
+}
+
+void SynEdit::rescanFolds(int startLine, int endLine)
+{
+    if (!mUseCodeFolding)
+        return;
+    if (!rescanForFoldRanges(startLine, endLine))
+        rescanForFoldRanges();
+    invalidateCollapsedFolds();
     invalidateGutter();
 }
 
 static void null_deleter(CodeFoldingRanges *) {}
 
+// new folds at the same lines as the old ones keep their collapsed state.
+// both lists are sorted by fromLine
+static void restoreCollapsedFolds(const CodeFoldingRanges& oldRanges, const CodeFoldingRanges& newRanges)
+{
+    int j=0;
+    for (int i=0;i<newRanges.count();i++) {
+        PCodeFoldingRange range = newRanges[i];
+        while (j<oldRanges.count() && oldRanges[j]->fromLine < range->fromLine)
+            j++;
+        for (int k=j;k<oldRanges.count() && oldRanges[k]->fromLine == range->fromLine;k++) {
+            PCodeFoldingRange oldRange = oldRanges[k];
+            if (oldRange->toLine == range->toLine) {
+                range->collapsed = oldRange->collapsed;
+                range->linesCollapsed = oldRange->linesCollapsed;
+                break;
+            }
+        }
+    }
+}
+
 void SynEdit::rescanForFoldRanges()
 {
     // Delete all uncollapsed folds
@@ -3562,6 +3741,7 @@ void SynEdit::rescanForFoldRanges()
 //        if (!range->collapsed && !range->parentCollapsed())
 //            mAllFoldRanges.remove(i);
 //    }
+    mStateFlags.setFlag(StateFlag::sfFoldRangesOutdated, false);
 
     // Did we leave any collapsed folds and are we viewing a code file?
     if (mAllFoldRanges.count() > 0) {
@@ -3571,27 +3751,10 @@ void SynEdit::rescanForFoldRanges()
         PCodeFoldingRanges temporaryAllFoldRanges = std::make_shared<CodeFoldingRanges>();
         scanForFoldRanges(temporaryAllFoldRanges);
 
-        // Combine new with old folds, preserve parent order
-        for (int i = 0; i< temporaryAllFoldRanges->count();i++) {
-            PCodeFoldingRange tempFoldRange=temporaryAllFoldRanges->range(i);
-            int j=0;
-            while (j <ranges.count()) {
-                PCodeFoldingRange foldRange = ranges[j];
-                //qDebug()<<TemporaryAllFoldRanges->range(i)->fromLine<<ranges[j]->fromLine;
-                if (tempFoldRange->fromLine == foldRange->fromLine
-                        && tempFoldRange->toLine == foldRange->toLine) {
-                    //qDebug()<<"-"<<foldRange->fromLine;
-                    mAllFoldRanges.add(foldRange);
-                    break;
-                }
-                j++;
-            }
-            if (j>=ranges.count()) {
-                //qDebug()<<"--"<<tempFoldRange->fromLine;
-                mAllFoldRanges.add(tempFoldRange);
-            }
-        }
-
+        // Combine new with old folds. Keep the new folds, so parents and sub folds
+        // stay consistent
+        restoreCollapsedFolds(ranges, *temporaryAllFoldRanges);
+        mAllFoldRanges = *temporaryAllFoldRanges;
     } else {
 
         // We ended up with no folds after deleting, just pass standard data...
@@ -3600,6 +3763,134 @@ void SynEdit::rescanForFoldRanges()
     }
 }
 
+// a fold not closed in the document has the same fromLine and toLine
+static bool foldOpenAt(const PCodeFoldingRange& range, int line)
+{
+    return range->fromLine < line
+            && (range->toLine >= line || range->toLine == range->fromLine);
+}
+
+CodeFoldingRanges SynEdit::foldRangesOpenAt(int index, int line)
+{
+    // folds in mAllFoldRanges[0,index) open at the line, outermost first
+    CodeFoldingRanges result;
+    if (index<=0)
+        return result;
+    // folds between the innermost open fold and the line are nested in it
+    PCodeFoldingRange range = mAllFoldRanges[index-1];
+    while (range && !foldOpenAt(range,line))
+        range = range->parent.lock();
+    while (range) {
+        result.insert(0,range);
+        range = range->parent.lock();
+    }
+    return result;
+}
+
+bool SynEdit::rescanForFoldRanges(int startLine, int endLine)
+{
+    // only brace folds are computed from the line states alone
+    if (mStateFlags.testFlag(StateFlag::sfFoldRangesOutdated)
+            || !mHighlighter
+            || mCodeFolding.foldRegions.count()!=1)
+        return false;
+    PCodeFoldingDefine foldRegion = mCodeFolding.foldRegions.get(0);
+    if (foldRegion->openSymbol!='{' || foldRegion->closeSymbol!='}')
+        return false;
+
+    // fold lines start from 1
+    int fromLine = startLine + 1;
+    int toLine = endLine + 1;
+    int first = mAllFoldRanges.findFirst(fromLine);
+    int last = mAllFoldRanges.findFirst(toLine + 1);
+    CodeFoldingRanges openedBefore = foldRangesOpenAt(first, fromLine);
+    CodeFoldingRanges openedAfter = foldRangesOpenAt(last, toLine + 1);
+
+    // The lines after the changed ones are not changed, so the folds open after the
+    // changed lines are closed at the same lines as before, level by level.
+    // If the nesting level after the changed lines differs, the states don't agree
+    // with the folds. Rescan them all.
+    int level = openedBefore.count();
+    for (int line=startLine;line<=endLine;line++) {
+        level = std::max(0, level - mDocument->rightBraces(line));
+        level += mDocument->leftBraces(line);
+    }
+    if (level != openedAfter.count())
+        return false;
+
+    QVector<int> oldBeforeToLines;
+    for (int i=0;i<openedBefore.count();i++)
+        oldBeforeToLines.append(openedBefore[i]->toLine);
+    QVector<int> oldAfterToLines;
+    for (int i=0;i<openedAfter.count();i++)
+        oldAfterToLines.append(openedAfter[i]->toLine);
+
+    // remove folds starting in the changed lines
+    CodeFoldingRanges oldRanges;
+    for (int i=first;i<last;i++)
+        oldRanges.add(mAllFoldRanges[i]);
+    mAllFoldRanges.remove(first, last - first);
+    for (int i=0;i<openedBefore.count();i++) {
+        PCodeFoldingRanges subRanges = openedBefore[i]->subFoldRanges;
+        int subFirst = subRanges->findFirst(fromLine);
+        subRanges->remove(subFirst, subRanges->findFirst(toLine + 1) - subFirst);
+    }
+
+    // scan the changed lines
+    CodeFoldingRanges newRanges;
+    QVector<PCodeFoldingRange> parents;
+    for (int i=0;i<openedBefore.count();i++)
+        parents.append(openedBefore[i]);
+    for (int line=startLine;line<=endLine;line++) {
+        for (int i=0; i<mDocument->rightBraces(line) && !parents.isEmpty();i++) {
+            parents.back()->toLine = line + 1;
+            parents.pop_back();
+        }
+        for (int i=0; i<mDocument->leftBraces(line);i++) {
+            PCodeFoldingRange parent = parents.isEmpty()?PCodeFoldingRange():parents.back();
+            PCodeFoldingRange range = std::make_shared<CodeFoldingRange>(parent, line + 1, line + 1);
+            if (parent) {
+                PCodeFoldingRanges subRanges = parent->subFoldRanges;
+                subRanges->insert(subRanges->findFirst(line + 2), range);
+            }
+            newRanges.add(range);
+            parents.append(range);
+        }
+    }
+
+    // folds still open take over the closing lines and the later sub folds
+    // of the folds open at the same level before
+    for (int i=0;i<parents.count();i++) {
+        PCodeFoldingRange range = parents[i];
+        PCodeFoldingRange oldRange = openedAfter[i];
+        if (range == oldRange)
+            continue;
+        if (oldAfterToLines[i] == oldRange->fromLine) // not closed
+            range->toLine = range->fromLine;
+        else
+            range->toLine = oldAfterToLines[i];
+        PCodeFoldingRanges oldSubRanges = oldRange->subFoldRanges;
+        int j = oldSubRanges->findFirst(toLine + 1);
+        while (j<oldSubRanges->count()) {
+            PCodeFoldingRange subRange = oldSubRanges->range(j);
+            subRange->parent = range;
+            range->subFoldRanges->add(subRange);
+            oldSubRanges->remove(j);
+        }
+    }
+
+    for (int i=0;i<openedBefore.count();i++) {
+        PCodeFoldingRange range = openedBefore[i];
+        if (range->collapsed && range->toLine != oldBeforeToLines[i]) {
+            range->collapsed = false;
+            range->linesCollapsed = 0;
+        }
+    }
+    restoreCollapsedFolds(oldRanges, newRanges);
+    mAllFoldRanges.insert(first, newRanges);
+    return true;
+}
+
 void SynEdit::scanForFoldRanges(PCodeFoldingRanges TopFoldRanges)
 {
     PCodeFoldingRanges parentFoldRanges = TopFoldRanges;
@@ -3745,7 +4036,7 @@ void SynEdit::findSubFoldRange(PCodeFoldingRanges TopFoldRanges, int FoldIndex,P
 
 PCodeFoldingRange SynEdit::collapsedFoldStartAtLine(int Line)
 {
-    for (int i = 0; i< mAllFoldRanges.count() - 1; i++ ) {
+    for (int i = mAllFoldRanges.findFirst(Line); i< mAllFoldRanges.count(); i++ ) {
         if (mAllFoldRanges[i]->fromLine == Line && mAllFoldRanges[i]->collapsed) {
             return mAllFoldRanges[i];
         } else if (mAllFoldRanges[i]->fromLine > Line) {
@@ -3762,13 +4053,9 @@ void SynEdit::initializeCaret()
 
 PCodeFoldingRange SynEdit::foldStartAtLine(int Line) const
 {
-    for (int i = 0; i<mAllFoldRanges.count();i++) {
-        PCodeFoldingRange range = mAllFoldRanges[i];
-        if (range->fromLine == Line ){
-            return range;
-        } else if (range->fromLine>Line)
-            break; // sorted by line. don't bother scanning further
-    }
+    int i = mAllFoldRanges.findFirst(Line);
+    if (i<mAllFoldRanges.count() && mAllFoldRanges[i]->fromLine == Line)
+        return mAllFoldRanges[i];
     return PCodeFoldingRange();
 }
 
@@ -4791,6 +5078,8 @@ void SynEdit::setUseCodeFolding(bool value)
 {
     if (mUseCodeFolding!=value) {
         mUseCodeFolding = value;
+        // folds are not maintained while folding is off
+        mStateFlags.setFlag(StateFlag::sfFoldRangesOutdated);
     }
 }
 
@@ -6675,6 +6964,7 @@ void SynEdit::onLinesChanging()
 
 void SynEdit::onLinesCleared()
 {
+    stopBackgroundScan();
     if (mUseCodeFolding)
         foldOnListCleared();
     clearUndo();
@@ -6691,6 +6981,20 @@ void SynEdit::onLinesCleared()
 
 void SynEdit::onLinesDeleted(int index, int count)
 {
+    if (mRescanLine>=0) {
+        if (mDocument->count()==0) {
+            stopBackgroundScan();
+        } else {
+            int lastLine = mDocument->count()-1;
+            for (int* pLine : {&mRescanLine, &mRescanCanStopLine, &mRescanFoldLine}) {
+                if (*pLine >= index + count)
+                    *pLine -= count;
+                else if (*pLine >= index)
+                    *pLine = index;
+                *pLine = std::min(*pLine, lastLine);
+            }
+        }
+    }
     if (mUseCodeFolding)
         foldOnListDeleted(index + 1, count);
     if (mHighlighter && mDocument->count() > 0)
@@ -6701,6 +7005,12 @@ void SynEdit::onLinesDeleted(int index, int count)
 
 void SynEdit::onLinesInserted(int index, int count)
 {
+    if (mRescanLine>=0) {
+        for (int* pLine : {&mRescanLine, &mRescanCanStopLine, &mRescanFoldLine}) {
+            if (*pLine >= index)
+                *pLine += count;
+        }
+    }
     if (mUseCodeFolding)
         foldOnListInserted(index + 1, count);
     if (mHighlighter && mDocument->count() > 0) {
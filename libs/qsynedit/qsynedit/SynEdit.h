@@ -24,6 +24,7 @@
 #include <QStringList>
 #include <QTimer>
 #include <QWidget>
+#include <climits>
 #include "MiscClasses.h"
 #include "CodeFolding.h"
 #include "Types.h"
@@ -66,7 +67,8 @@ enum class StateFlag  {
     sfIgnoreNextChar = 0x0008,
     sfCaretVisible = 0x0010,
     sfDblClicked = 0x0020,
-    sfWaitForDragging = 0x0040
+    sfWaitForDragging = 0x0040,
+    sfFoldRangesOutdated = 0x0080 // fold ranges can't be updated incrementally, rescan them all
 };
 
 Q_DECLARE_FLAGS(StateFlags,StateFlag)
@@ -343,6 +345,8 @@ public:
 
     PHighlighter highlighter() const;
     void setHighlighter(const PHighlighter &highlighter);
+    // highlight lines up to line (0-based) left to the background scan, so their states are valid
+    void ensureRangesScanned(int line = INT_MAX);
 
     bool useCodeFolding() const;
     void setUseCodeFolding(bool value);
@@ -503,6 +507,8 @@ private:
     QString expandAtWideGlyphs(const QString& S);
     void updateModifiedStatus();
     int scanFrom(int Index, int canStopIndex);
+    int scanLines(int startLine, int canStopLine, int foldStartLine, int lastLine);
+    void stopBackgroundScan();
     void rescanRange(int line);
     void rescanRanges();
     void uncollapse(PCodeFoldingRange FoldRange);
@@ -512,13 +518,18 @@ private:
     void foldOnListDeleted(int Line, int Count);
     void foldOnListCleared();
     void rescanFolds(); // rescan for folds
+    void rescanFolds(int startLine, int endLine); // update folds for changed lines
     void rescanForFoldRanges();
+    bool rescanForFoldRanges(int startLine, int endLine);
+    CodeFoldingRanges foldRangesOpenAt(int index, int line);
     void scanForFoldRanges(PCodeFoldingRanges TopFoldRanges);
     int lineHasChar(int Line, int startChar, QChar character, const QString& highlighterAttrName);
     void findSubFoldRange(PCodeFoldingRanges TopFoldRanges,int FoldIndex,PCodeFoldingRanges& parentFoldRanges, PCodeFoldingRange Parent);
     PCodeFoldingRange collapsedFoldStartAtLine(int Line);
     void initializeCaret();
     PCodeFoldingRange foldStartAtLine(int Line) const;
+    const QVector<CollapsedFold>& collapsedFolds() const;
+    void invalidateCollapsedFolds();
     bool foldCollapsedBetween(int startLine, int endLine) const;
     QString substringByColumns(const QString& s, int startColumn, int& colLen);
     PCodeFoldingRange foldAroundLine(int Line);
@@ -633,6 +644,7 @@ private slots:
     //void onRedoAdded();
     void onScrollTimeout();
     void onDraggingScrollTimeout();
+    void onRescanTimeout();
     void onUndoAdded();
     void onSizeOrFontChanged(bool bFont);
     void onChanged();
@@ -641,6 +653,10 @@ private slots:
 private:
     std::shared_ptr<QImage> mContentImage;
     CodeFoldingRanges mAllFoldRanges;
+    // collapsed folds not hidden by other collapsed folds, sorted by fromLine.
+    // rebuilt when used after folds change
+    mutable QVector<CollapsedFold> mCollapsedFolds;
+    mutable bool mCollapsedFoldsOutdated;
     CodeFoldingOptions mCodeFolding;
     bool mUseCodeFolding;
     bool  mAlwaysShowCaret;
@@ -711,6 +727,12 @@ private:
     int mScrollDeltaX;
     int mScrollDeltaY;
 
+    // lines from mRescanLine are highlighted in the background, -1 if there's none
+    QTimer* mRescanTimer;
+    int mRescanLine;
+    int mRescanCanStopLine; // the highlighting can stop after it, once the states agree
+    int mRescanFoldLine; // folds are updated from it when the highlighting stops
+
     PSynEdit  fChainedEditor;
 
     int mPaintTransientLock;
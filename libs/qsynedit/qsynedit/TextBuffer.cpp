@@ -21,6 +21,7 @@
 #include <QTextCodec>
 #include <QTextStream>
 #include <QMutexLocker>
+#include <QThread>
 #include <stdexcept>
 #include "SynEdit.h"
 #include <QMessageBox>
@@ -28,6 +29,8 @@
 #include "qt_utils/charsetinfo.h"
 #include <QDebug>
 
+#define DOCUMENT_CHUNK_SIZE 1024
+
 namespace QSynedit {
 
 Document::Document(const QFont& font, const QFont& nonAsciiFont, QObject *parent):
@@ -57,68 +60,71 @@ static void ListIndexOutOfBounds(int index) {
 
 int Document::parenthesisLevels(int Index)
 {
-    QMutexLocker locker(&mMutex);
-    if (Index>=0 && Index < mLines.size()) {
-        return mLines[Index]->fRange.parenthesisLevel;
+    QMutexLocker locker(readMutex());
+    if (Index>=0 && Index < mLines.count()) {
+        return mLines.at(Index).fRange.parenthesisLevel;
     } else
         return 0;
 }
 
 int Document::bracketLevels(int Index)
 {
-    QMutexLocker locker(&mMutex);
-    if (Index>=0 && Index < mLines.size()) {
-        return mLines[Index]->fRange.bracketLevel;
+    QMutexLocker locker(readMutex());
+    if (Index>=0 && Index < mLines.count()) {
+        return mLines.at(Index).fRange.bracketLevel;
     } else
         return 0;
 }
 
 int Document::braceLevels(int Index)
 {
-    QMutexLocker locker(&mMutex);
-    if (Index>=0 && Index < mLines.size()) {
-        return mLines[Index]->fRange.braceLevel;
+    QMutexLocker locker(readMutex());
+    if (Index>=0 && Index < mLines.count()) {
+        return mLines.at(Index).fRange.braceLevel;
     } else
         return 0;
 }
 
 int Document::lineColumns(int Index)
 {
-    QMutexLocker locker(&mMutex);
-    if (Index>=0 && Index < mLines.size()) {
-        if (mLines[Index]->fColumns == -1) {
+    QMutexLocker locker(readMutex());
+    if (Index>=0 && Index < mLines.count()) {
+        if (mLines.at(Index).fColumns == -1) {
+            // caching the columns changes the line
+            QMutexLocker writeLocker(&mMutex);
             return calculateLineColumns(Index);
         } else
-            return mLines[Index]->fColumns;
+            return mLines.at(Index).fColumns;
     } else
         return 0;
 }
 
 int Document::leftBraces(int Index)
 {
-    QMutexLocker locker(&mMutex);
-    if (Index>=0 && Index < mLines.size()) {
-        return mLines[Index]->fRange.leftBraces;
+    QMutexLocker locker(readMutex());
+    if (Index>=0 && Index < mLines.count()) {
+        return mLines.at(Index).fRange.leftBraces;
     } else
         return 0;
 }
 
 int Document::rightBraces(int Index)
 {
-    QMutexLocker locker(&mMutex);
-    if (Index>=0 && Index < mLines.size()) {
-        return mLines[Index]->fRange.rightBraces;
+    QMutexLocker locker(readMutex());
+    if (Index>=0 && Index < mLines.count()) {
+        return mLines.at(Index).fRange.rightBraces;
     } else
         return 0;
 }
 
 int Document::lengthOfLongestLine() {
-    QMutexLocker locker(&mMutex);
+    QMutexLocker locker(readMutex());
     if (mIndexOfLongestLine < 0) {
+        QMutexLocker writeLocker(&mMutex);
         int MaxLen = -1;
         mIndexOfLongestLine = -1;
         if (mLines.count() > 0 ) {
-            for (int i=0;i<mLines.size();i++) {
+            for (int i=0;i<mLines.count();i++) {
                 int len = lineColumns(i);
                 if (len > MaxLen) {
                     MaxLen = len;
@@ -128,7 +134,7 @@ int Document::lengthOfLongestLine() {
         }
     }
     if (mIndexOfLongestLine >= 0)
-        return mLines[mIndexOfLongestLine]->fColumns;
+        return mLines.at(mIndexOfLongestLine).fColumns;
     else
         return 0;
 }
@@ -148,9 +154,9 @@ QString Document::lineBreak() const
 
 HighlighterState Document::ranges(int Index)
 {
-    QMutexLocker locker(&mMutex);
-    if (Index>=0 && Index < mLines.size()) {
-        return mLines[Index]->fRange;
+    QMutexLocker locker(readMutex());
+    if (Index>=0 && Index < mLines.count()) {
+        return mLines.at(Index).fRange;
     } else {
          ListIndexOutOfBounds(Index);
     }
@@ -160,8 +166,8 @@ HighlighterState Document::ranges(int Index)
 void Document::insertItem(int Index, const QString &s)
 {
     beginUpdate();
-    PDocumentLine line = std::make_shared<DocumentLine>();
-    line->fString = s;
+    DocumentLine line;
+    line.fString = s;
     mIndexOfLongestLine = -1;
     mLines.insert(Index,line);
     endUpdate();
@@ -170,8 +176,8 @@ void Document::insertItem(int Index, const QString &s)
 void Document::addItem(const QString &s)
 {
     beginUpdate();
-    PDocumentLine line = std::make_shared<DocumentLine>();
-    line->fString = s;
+    DocumentLine line;
+    line.fString = s;
     mIndexOfLongestLine = -1;
     mLines.append(line);
     endUpdate();
@@ -179,7 +185,7 @@ void Document::addItem(const QString &s)
 
 bool Document::getAppendNewLineAtEOF()
 {
-    QMutexLocker locker(&mMutex);
+    QMutexLocker locker(readMutex());
     return mAppendNewLineAtEOF;
 }
 
@@ -196,28 +202,28 @@ void Document::setRange(int Index, const HighlighterState& ARange)
         ListIndexOutOfBounds(Index);
     }
     beginUpdate();
-    mLines[Index]->fRange = ARange;
+    mLines[Index].fRange = ARange;
     endUpdate();
 }
 
 QString Document::getString(int Index)
 {
-    QMutexLocker locker(&mMutex);
+    QMutexLocker locker(readMutex());
     if (Index<0 || Index>=mLines.count()) {
         return QString();
     }
-    return mLines[Index]->fString;
+    return mLines.at(Index).fString;
 }
 
 int Document::count()
 {
-    QMutexLocker locker(&mMutex);
+    QMutexLocker locker(readMutex());
     return mLines.count();
 }
 
 QString Document::text()
 {
-    QMutexLocker locker(&mMutex);
+    QMutexLocker locker(readMutex());
     return getTextStr();
 }
 
@@ -248,11 +254,12 @@ void Document::setContents(const QStringList &text)
 
 QStringList Document::contents()
 {
-    QMutexLocker locker(&mMutex);
+    // lines are implicitly shared, so this is a cheap snapshot of the document
+    QMutexLocker locker(readMutex());
     QStringList Result;
-    DocumentLines list = mLines;
-    foreach (const PDocumentLine& line, list) {
-        Result.append(line->fString);
+    Result.reserve(mLines.count());
+    for (int i=0;i<mLines.count();i++) {
+        Result.append(mLines.at(i).fString);
     }
     return Result;
 }
@@ -305,10 +312,10 @@ void Document::addStrings(const QStringList &Strings)
 
 int Document::getTextLength()
 {
-    QMutexLocker locker(&mMutex);
+    QMutexLocker locker(readMutex());
     int Result = 0;
-    foreach (const PDocumentLine& line, mLines ) {
-        Result += line->fString.length();
+    for (int i=0;i<mLines.count();i++) {
+        Result += mLines.at(i).fString.length();
         if (mFileEndingType == FileEndingType::Windows) {
             Result += 2;
         } else {
@@ -361,9 +368,7 @@ void Document::exchange(int Index1, int Index2)
         ListIndexOutOfBounds(Index2);
     }
     beginUpdate();
-    PDocumentLine temp = mLines[Index1];
-    mLines[Index1]=mLines[Index2];
-    mLines[Index2]=temp;
+    std::swap(mLines[Index1],mLines[Index2]);
     //mList.swapItemsAt(Index1,Index2);
     if (mIndexOfLongestLine == Index1) {
         mIndexOfLongestLine = Index2;
@@ -396,7 +401,7 @@ void Document::deleteAt(int Index)
         mIndexOfLongestLine = -1;
     else if (mIndexOfLongestLine>Index)
         mIndexOfLongestLine -= 1;
-    mLines.removeAt(Index);
+    mLines.remove(Index,1);
     emit deleted(Index,1);
     endUpdate();
 }
@@ -405,12 +410,11 @@ QString Document::getTextStr() const
 {
     QString result;
     for (int i=0;i<mLines.count()-1;i++) {
-        const PDocumentLine& line = mLines[i];
-        result.append(line->fString);
+        result.append(mLines[i].fString);
         result.append(lineBreak());
     }
-    if (mLines.length()>0) {
-        result.append(mLines.back()->fString);
+    if (mLines.count()>0) {
+        result.append(mLines[mLines.count()-1].fString);
     }
     return result;
 }
@@ -424,14 +428,14 @@ void Document::putString(int Index, const QString &s, bool notify) {
             ListIndexOutOfBounds(Index);
         }
         beginUpdate();
-        int oldColumns = mLines[Index]->fColumns;
-        mLines[Index]->fString = s;
+        int oldColumns = mLines[Index].fColumns;
+        mLines[Index].fString = s;
         calculateLineColumns(Index);
-        if (mIndexOfLongestLine == Index && oldColumns>mLines[Index]->fColumns )
+        if (mIndexOfLongestLine == Index && oldColumns>mLines[Index].fColumns )
             mIndexOfLongestLine = -1;
         else if (mIndexOfLongestLine>=0
                  && mIndexOfLongestLine<mLines.count()
-                 && mLines[Index]->fColumns > mLines[mIndexOfLongestLine]->fColumns)
+                 && mLines[Index].fColumns > mLines[mIndexOfLongestLine].fColumns)
             mIndexOfLongestLine = Index;
         if (notify)
             emit putted(Index,1);
@@ -447,12 +451,23 @@ void Document::setUpdateState(bool Updating)
         emit changed();
 }
 
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+QRecursiveMutex *Document::readMutex()
+#else
+QMutex *Document::readMutex()
+#endif
+{
+    if (QThread::currentThread() == thread())
+        return nullptr;
+    return &mMutex;
+}
+
 int Document::calculateLineColumns(int Index)
 {
-    PDocumentLine line = mLines[Index];
+    DocumentLine& line = mLines[Index];
 
-    line->fColumns = stringColumns(line->fString,0);
-    return line->fColumns;
+    line.fColumns = stringColumns(line.fString,0);
+    return line.fColumns;
 }
 
 void Document::insertLines(int Index, int NumLines)
@@ -468,12 +483,7 @@ void Document::insertLines(int Index, int NumLines)
         endUpdate();
     });
     mIndexOfLongestLine = -1;
-    PDocumentLine line;
-    mLines.insert(Index,NumLines,line);
-    for (int i=Index;i<Index+NumLines;i++) {
-        line = std::make_shared<DocumentLine>();
-        mLines[i]=line;
-    }
+    mLines.insert(Index,NumLines,DocumentLine());
     emit inserted(Index,NumLines);
 }
 
@@ -678,14 +688,15 @@ void Document::saveToFile(QFile &file, const QByteArray& encoding,
         codec = QTextCodec::codecForName(realEncoding);
     }
     bool allAscii = true;
-    for (PDocumentLine& line:mLines) {
+    for (int i=0;i<mLines.count();i++) {
+        const DocumentLine& line = mLines[i];
         if (allAscii) {
-            allAscii = isTextAllAscii(line->fString);
+            allAscii = isTextAllAscii(line.fString);
         }
         if (!allAscii) {
-            file.write(codec->fromUnicode(line->fString));
+            file.write(codec->fromUnicode(line.fString));
         } else {
-            file.write(line->fString.toLatin1());
+            file.write(line.fString.toLatin1());
         }
         file.write(lineBreak().toLatin1());
     }
@@ -770,7 +781,7 @@ void Document::internalClear()
 
 FileEndingType Document::getFileEndingType()
 {
-    QMutexLocker locker(&mMutex);
+    QMutexLocker locker(readMutex());
     return mFileEndingType;
 }
 
@@ -782,7 +793,7 @@ void Document::setFileEndingType(const FileEndingType &fileEndingType)
 
 bool Document::empty()
 {
-    QMutexLocker locker(&mMutex);
+    QMutexLocker locker(readMutex());
     return mLines.count()==0;
 }
 
@@ -791,8 +802,8 @@ void Document::resetColumns()
     QMutexLocker locker(&mMutex);
     mIndexOfLongestLine = -1;
     if (mLines.count() > 0 ) {
-        for (int i=0;i<mLines.size();i++) {
-            mLines[i]->fColumns = -1;
+        for (int i=0;i<mLines.count();i++) {
+            mLines[i].fColumns = -1;
         }
     }
 }
@@ -801,8 +812,8 @@ void Document::invalidAllLineColumns()
 {
     QMutexLocker locker(&mMutex);
     mIndexOfLongestLine = -1;
-    for (PDocumentLine& line:mLines) {
-        line->fColumns = -1;
+    for (int i=0;i<mLines.count();i++) {
+        mLines[i].fColumns = -1;
     }
 }
 
@@ -813,6 +824,174 @@ DocumentLine::DocumentLine():
 {
 }
 
+DocumentLines::DocumentLines():
+    mCount(0),
+    mLastChunk(0)
+{
+}
+
+int DocumentLines::count() const
+{
+    return mCount;
+}
+
+bool DocumentLines::isEmpty() const
+{
+    return mCount==0;
+}
+
+DocumentLine &DocumentLines::operator[](int index)
+{
+    const PChunk& chunk = mChunks[findChunk(index)];
+    return chunk->lines[index-chunk->start];
+}
+
+const DocumentLine &DocumentLines::operator[](int index) const
+{
+    return at(index);
+}
+
+const DocumentLine &DocumentLines::at(int index) const
+{
+    const PChunk& chunk = mChunks.at(findChunk(index));
+    return chunk->lines.at(index-chunk->start);
+}
+
+void DocumentLines::insert(int index, const DocumentLine &line)
+{
+    insert(index,1,line);
+}
+
+void DocumentLines::insert(int index, int count, const DocumentLine &line)
+{
+    if (count<=0)
+        return;
+    int chunkIndex;
+    if (index>=mCount) {
+        // appending lines, don't split the full last chunk
+        if (mChunks.isEmpty() || mChunks.back()->lines.count()>=DOCUMENT_CHUNK_SIZE) {
+            PChunk chunk = std::make_shared<Chunk>();
+            chunk->start = mCount;
+            mChunks.append(chunk);
+        }
+        chunkIndex = mChunks.count()-1;
+    } else {
+        chunkIndex = findChunk(index);
+    }
+    const PChunk& chunk = mChunks[chunkIndex];
+    chunk->lines.insert(index-chunk->start,count,line);
+    mCount+=count;
+    for (int i=chunkIndex+1;i<mChunks.count();i++)
+        mChunks[i]->start+=count;
+    if (chunk->lines.count()>DOCUMENT_CHUNK_SIZE)
+        splitChunk(chunkIndex);
+}
+
+void DocumentLines::append(const DocumentLine &line)
+{
+    insert(mCount,1,line);
+}
+
+void DocumentLines::remove(int index, int count)
+{
+    count = std::min(count, mCount-index);
+    if (index<0 || count<=0)
+        return;
+    int firstChunk = findChunk(index);
+    int chunkIndex = firstChunk;
+    int offset = index - mChunks[chunkIndex]->start;
+    int left = count;
+    while (left>0) {
+        const PChunk& chunk = mChunks[chunkIndex];
+        int n = std::min(left, chunk->lines.count()-offset);
+        chunk->lines.remove(offset,n);
+        left-=n;
+        offset=0;
+        if (chunk->lines.isEmpty())
+            mChunks.remove(chunkIndex);
+        else
+            chunkIndex++;
+    }
+    mCount-=count;
+    int start = index;
+    if (firstChunk<mChunks.count() && mChunks[firstChunk]->start<index)
+        start = mChunks[firstChunk]->start;
+    for (int i=firstChunk;i<mChunks.count();i++) {
+        mChunks[i]->start = start;
+        start += mChunks[i]->lines.count();
+    }
+    // the lines left in the first and the last chunk
+    mergeChunk(firstChunk+1);
+    mergeChunk(firstChunk);
+    mLastChunk = 0;
+}
+
+void DocumentLines::clear()
+{
+    mChunks.clear();
+    mCount = 0;
+    mLastChunk = 0;
+}
+
+int DocumentLines::findChunk(int index) const
+{
+    int lastChunk = mLastChunk.load(std::memory_order_relaxed);
+    if (lastChunk<mChunks.count()) {
+        const PChunk& chunk = mChunks.at(lastChunk);
+        if (index>=chunk->start && index<chunk->start+chunk->lines.count())
+            return lastChunk;
+    }
+    int start = 0;
+    int end = mChunks.count()-1;
+    while (start<end) {
+        int mid = (start+end+1)/2;
+        if (mChunks.at(mid)->start<=index)
+            start = mid;
+        else
+            end = mid-1;
+    }
+    mLastChunk.store(start, std::memory_order_relaxed);
+    return start;
+}
+
+void DocumentLines::splitChunk(int chunkIndex)
+{
+    PChunk chunk = mChunks[chunkIndex];
+    int n = chunk->lines.count();
+    int pieces = (n+DOCUMENT_CHUNK_SIZE-1)/DOCUMENT_CHUNK_SIZE;
+    int pieceSize = (n+pieces-1)/pieces;
+    QVector<PChunk> newChunks;
+    for (int pos=pieceSize;pos<n;pos+=pieceSize) {
+        PChunk newChunk = std::make_shared<Chunk>();
+        newChunk->start = chunk->start+pos;
+        newChunk->lines = chunk->lines.mid(pos,pieceSize);
+        newChunks.append(newChunk);
+    }
+    chunk->lines.remove(pieceSize,n-pieceSize);
+    chunk->lines.squeeze();
+    for (int i=0;i<newChunks.count();i++)
+        mChunks.insert(chunkIndex+1+i,newChunks[i]);
+}
+
+void DocumentLines::mergeChunk(int chunkIndex)
+{
+    // merge a small chunk into one of its neighbours
+    if (chunkIndex<0 || chunkIndex>=mChunks.count())
+        return;
+    PChunk chunk = mChunks[chunkIndex];
+    if (chunk->lines.count()>=DOCUMENT_CHUNK_SIZE/4)
+        return;
+    if (chunkIndex>0
+            && mChunks[chunkIndex-1]->lines.count()+chunk->lines.count()<=DOCUMENT_CHUNK_SIZE) {
+        mChunks[chunkIndex-1]->lines.append(chunk->lines);
+        mChunks.remove(chunkIndex);
+    } else if (chunkIndex+1<mChunks.count()
+               && mChunks[chunkIndex+1]->lines.count()+chunk->lines.count()<=DOCUMENT_CHUNK_SIZE) {
+        chunk->lines.append(mChunks[chunkIndex+1]->lines);
+        mChunks.remove(chunkIndex+1);
+    }
+}
+
 
 UndoList::UndoList():QObject()
 {
@@ -23,6 +23,7 @@
 #include <QMutex>
 #include <QVector>
 #include <memory>
+#include <atomic>
 #include <QFile>
 #include "MiscProcs.h"
 #include "Types.h"
@@ -39,11 +40,53 @@ public:
   explicit DocumentLine();
 };
 
-typedef std::shared_ptr<DocumentLine> PDocumentLine;
+}
 
-typedef QVector<PDocumentLine> DocumentLines;
+// lines are moved around when lines are inserted or deleted in their chunk
+Q_DECLARE_TYPEINFO(QSynedit::DocumentLine, Q_MOVABLE_TYPE);
 
-typedef std::shared_ptr<DocumentLines> PDocumentLines;
+namespace QSynedit {
+
+/**
+ * @brief lines of a document, stored by value in chunks of at most DOCUMENT_CHUNK_SIZE lines
+ *
+ * Inserting or deleting lines only moves the lines in the chunks involved and the
+ * (short) chunk list, instead of all the lines after them. Lines are found by a
+ * binary search on the start lines of the chunks.
+ */
+class DocumentLines {
+public:
+    explicit DocumentLines();
+    DocumentLines(const DocumentLines&) = delete;
+    DocumentLines& operator=(const DocumentLines&) = delete;
+
+    int count() const;
+    bool isEmpty() const;
+    DocumentLine& operator[](int index);
+    const DocumentLine& operator[](int index) const;
+    const DocumentLine& at(int index) const;
+    void insert(int index, const DocumentLine& line);
+    void insert(int index, int count, const DocumentLine& line);
+    void append(const DocumentLine& line);
+    void remove(int index, int count);
+    void clear();
+private:
+    struct Chunk {
+        int start; // index of the chunk's first line in the document
+        QVector<DocumentLine> lines;
+    };
+    using PChunk = std::shared_ptr<Chunk>;
+
+    int findChunk(int index) const;
+    void splitChunk(int chunkIndex);
+    void mergeChunk(int chunkIndex);
+private:
+    QVector<PChunk> mChunks;
+    int mCount;
+    // chunk of the last line accessed, lines are mostly accessed in order.
+    // atomic because readers in the document's own thread don't take the lock
+    mutable std::atomic<int> mLastChunk;
+};
 
 class Document;
 
@@ -153,6 +196,18 @@ private:
 #endif
 
     int calculateLineColumns(int Index);
+    /*
+     * Lines are only changed in the thread owning the document (the gui thread), and
+     * every change is done while holding mMutex. So reading in the owner thread doesn't
+     * need the lock; readers in other threads (like the todo or the parser threads) must
+     * take it to get a consistent view.
+     * Returns nullptr in the owner thread.
+     */
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+    QRecursiveMutex* readMutex();
+#else
+    QMutex* readMutex();
+#endif
 };
 
 enum class ChangeReason {